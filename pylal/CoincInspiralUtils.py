@@ -4,6 +4,7 @@ from glue.ligolw import ligolw
 from glue.ligolw import table
 from glue.ligolw import lsctables
 from glue.ligolw import utils
+from pylal import ligolw_stream
 from pylal.tools import XLALCalculateEThincaParameter
 from pylal.xlal import date
 from pylal.xlal.datatypes.ligotimegps import LIGOTimeGPS
@@ -71,13 +72,41 @@ def simpleEThinca(trigger1, trigger2):
   
   return simple_ethinca
 
-def readCoincInspiralFromFiles(fileList,statistic=None):
+def _readInspiralTablesFromFile(thisFile, columns=None):
+  """
+  Return the sngl and sim inspiral tables of a file, or None for those
+  the file does not contain.  If columns is given the file is streamed
+  through pylal.ligolw_stream and only those sngl_inspiral columns are kept.
+  """
+  if columns is not None:
+    data = ligolw_stream.read_tables([thisFile], \
+        {lsctables.SnglInspiralTable.tableName: columns, \
+         lsctables.SimInspiralTable.tableName: None})
+    sngls = ligolw_stream.table_from_columns(lsctables.SnglInspiralTable, \
+        data[lsctables.SnglInspiralTable.tableName])
+    sims = ligolw_stream.table_from_columns(lsctables.SimInspiralTable, \
+        data[lsctables.SimInspiralTable.tableName])
+    return sngls or None, sims or None
+
+  lsctables.use_in(ExtractCoincInspiralTableLIGOLWContentHandler)
+  doc = utils.load_filename(thisFile, gz = (thisFile or "stdin").endswith(".gz"), contenthandler=ExtractCoincInspiralTableLIGOLWContentHandler)
+  try: sims = table.get_table(doc, lsctables.SimInspiralTable.tableName)
+  except: sims = None
+  try: sngls = table.get_table(doc, lsctables.SnglInspiralTable.tableName)
+  except: sngls = None
+  doc.unlink()
+  return sngls, sims
+
+def readCoincInspiralFromFiles(fileList,statistic=None,columns=None):
   """
   read in the Sngl and SimInspiralTables from a list of files
   if Sngls are found, construct coincs, add injections (if any)
   also return Sims (if any)
   @param fileList: list of input files
   @param statistic: instance of coincStatistic, to use in creating coincs
+  @param columns: if given, stream the files and keep only these
+                  sngl_inspiral columns, which must include event_id, ifo
+                  and those the statistic needs
   """
   if not fileList:
     return coincInspiralTable(), None
@@ -88,21 +117,15 @@ def readCoincInspiralFromFiles(fileList,statistic=None):
   sims = None
   coincs = None
 
-  lsctables.use_in(ExtractCoincInspiralTableLIGOLWContentHandler)
   for thisFile in fileList:
-    doc = utils.load_filename(thisFile, gz = (thisFile or "stdin").endswith(".gz"), contenthandler=ExtractCoincInspiralTableLIGOLWContentHandler)
-    # extract the sim inspiral table
-    try: 
-      simInspiralTable = \
-          table.get_table(doc, lsctables.SimInspiralTable.tableName)
+    snglInspiralTable, simInspiralTable = \
+        _readInspiralTablesFromFile(thisFile, columns)
+    # collect the sim inspiral tables
+    if simInspiralTable:
       if sims: sims.extend(simInspiralTable)
       else: sims = simInspiralTable
-    except: simInspiralTable = None
 
-    # extract the sngl inspiral table, construct coincs
-    try: snglInspiralTable = \
-      table.get_table(doc, lsctables.SnglInspiralTable.tableName)
-    except: snglInspiralTable = None
+    # construct coincs from the sngl inspiral table
     if snglInspiralTable:
       coincFromFile = coincInspiralTable(snglInspiralTable,statistic)
       if simInspiralTable: 
@@ -110,11 +133,43 @@ def readCoincInspiralFromFiles(fileList,statistic=None):
       if coincs: coincs.extend(coincFromFile)
       else: coincs = coincFromFile
 
-    doc.unlink()
-
   return coincs, sims
 
 
+def readCoincInspiralColumnsFromFiles(fileList,statistic=None,columns=None):
+  """
+  Like readCoincInspiralFromFiles, but return the coincs as a
+  coincInspiralColumns, whose statistics are computed column-wise and whose
+  rows are only built on demand.
+  @param fileList: list of input files
+  @param statistic: instance of coincStatistic, to use in creating coincs
+  @param columns: if given, the sngl_inspiral columns to keep, as for
+                  readCoincInspiralFromFiles
+  """
+  if not (isinstance(statistic,coincStatistic)):
+    raise TypeError, "invalid statistic, must be coincStatistic"
+
+  sims = None
+  parts = []
+
+  for thisFile in fileList:
+    snglInspiralTable, simInspiralTable = \
+        _readInspiralTablesFromFile(thisFile, columns)
+    if simInspiralTable:
+      if sims: sims.extend(simInspiralTable)
+      else: sims = simInspiralTable
+
+    # coincs are found one file at a time, as event_ids may be reused
+    # between files
+    if snglInspiralTable:
+      coincFromFile = coincInspiralColumns(snglInspiralTable,statistic)
+      if simInspiralTable:
+        coincFromFile.add_sim_inspirals(simInspiralTable)
+      parts.append(coincFromFile)
+
+  return coincInspiralColumns.concatenate(parts), sims
+
+
 ########################################
 class coincStatistic:
   """
@@ -666,3 +721,234 @@ class coincInspiralTable:
         triggers_within_segment.append(trig)
 
     return triggers_within_segment
+
+
+#######################################
+def _sngl_column(inspTriggers, name, dtype=float):
+  """
+  Return the attribute name of every trigger in inspTriggers as an array.
+  """
+  return numpy.fromiter((getattr(trig, name) for trig in inspTriggers), \
+      dtype=dtype, count=len(inspTriggers))
+
+def _sngl_stat_values(inspTriggers, statistic):
+  """
+  Return the single-ifo contribution of each trigger to the coinc statistic,
+  computed column-wise with the same formulas as the SnglInspiral get_*
+  methods used by coincInspiralTable.row.add_trig.
+  """
+  name = statistic.name
+  if name in ('effective_snr', 'new_snr'):
+    snr = _sngl_column(inspTriggers, 'snr')
+    rchisq = _sngl_column(inspTriggers, 'chisq') / \
+        (2 * _sngl_column(inspTriggers, 'chisq_dof') - 2)
+    if name == 'effective_snr':
+      return snr / (1 + snr**2 / statistic.eff_snr_denom_fac)**(0.25) / \
+          rchisq**(0.25)
+    index = statistic.new_snr_index
+    return numpy.where(rchisq > 1., \
+        snr / ((1 + numpy.maximum(rchisq, 1.)**(index / 2.)) / 2)**(1. / index), \
+        snr)
+  if 'bitten_l' in name:
+    return _sngl_column(inspTriggers, 'snr')
+  if name == 'far':
+    return _sngl_column(inspTriggers, 'alpha')
+  if name == 'ifar':
+    return 1. / numpy.maximum(_sngl_column(inspTriggers, 'alpha'), 1e-9)
+  if name == 'lvS5stat':
+    return _sngl_column(inspTriggers, 'beta')
+  return _sngl_column(inspTriggers, name)
+
+
+class coincInspiralColumns(object):
+  """
+  Column-wise equivalent of coincInspiralTable.  The sngl_inspiral triggers
+  are grouped by event_id with a single sort and the coinc statistic is
+  computed for all coincs at once as a reduction over each group, so that
+  building coincs from millions of triggers does not involve a Python
+  object per coinc.  The results are held in arrays, one entry per coinc:
+
+    event_id   the coinc's event_id, as an integer
+    numifos    the number of triggers in the coinc
+    stat       the coinc statistic
+    rsq, bl    the bitten_l components (zero for other statistics)
+    trig_index trig_index[i, j] is the position in sngl_table of the
+               trigger from ifos[j] in coinc i, or -1 if there is none
+
+  Coincs are kept in order of first appearance of their event_id and coincs
+  with fewer than two triggers are dropped, as in coincInspiralTable.
+  Indexing or iterating returns coincInspiralTable.row objects, which are
+  only built when asked for; to_table() builds all of them.
+  """
+  def __init__(self, inspTriggers = None, stat = None):
+    """
+    @param inspTriggers: a metaDataTable containing inspiral triggers
+                         from which to construct coincidences
+    @param stat:         an instance of coincStatistic
+    """
+    self.stat = stat
+    self.sngl_table = inspTriggers
+    self.sim_table = None
+    self.event_id = numpy.zeros(0, dtype=numpy.int64)
+    self.numifos = numpy.zeros(0, dtype=int)
+    self.stat_values = numpy.zeros(0, dtype=float)
+    self.rsq = numpy.zeros(0, dtype=float)
+    self.bl = numpy.zeros(0, dtype=float)
+    self.trig_index = numpy.zeros((0, len(ifos)), dtype=int)
+    self._rows = []
+    if not inspTriggers:
+      return
+
+    event_ids = numpy.fromiter((int(trig.event_id) for trig in inspTriggers), \
+        dtype=numpy.int64, count=len(inspTriggers))
+    ifo_index = numpy.fromiter((ifos.index(trig.ifo) for trig in inspTriggers),\
+        dtype=int, count=len(inspTriggers))
+    values = _sngl_stat_values(inspTriggers, stat)
+
+    # group the triggers by event_id; the stable sort keeps the triggers of
+    # each coinc in file order, so the last of a group is the last added
+    order = numpy.argsort(event_ids, kind='mergesort')
+    sorted_ids = event_ids[order]
+    starts = numpy.flatnonzero(numpy.concatenate(([True], \
+        sorted_ids[1:] != sorted_ids[:-1])))
+    ends = numpy.append(starts[1:], len(order))
+    group = numpy.repeat(numpy.arange(len(starts)), ends - starts)
+
+    # the event_ids are meant to be unique to a coinc, so two triggers from
+    # the same ifo in one group means that ids have collided
+    slots = group * len(ifos) + ifo_index[order]
+    if len(numpy.unique(slots)) != len(slots):
+      raise ValueError, "event_id collision: more than one trigger from the "\
+          "same ifo in a coincidence"
+
+    trig_index = -numpy.ones((len(starts), len(ifos)), dtype=int)
+    trig_index[group, ifo_index[order]] = order
+
+    numifos = ends - starts
+    values = values[order]
+    name = stat.name
+    rsq = numpy.zeros(len(starts), dtype=float)
+    bl = numpy.zeros(len(starts), dtype=float)
+    if name in ('far', 'ifar', 'lvS5stat'):
+      # each trigger overwrites the stat, so the last one wins
+      stat_values = values[ends - 1]
+    elif 'bitten_l' in name:
+      rsq = numpy.sqrt(numpy.add.reduceat(values**2, starts))
+      bl = numpy.minimum.reduceat(stat.a * values - stat.b, starts)
+      stat_values = numpy.minimum(bl, rsq)
+      if name == 'bitten_lsq':
+        stat_values = numpy.where(numifos > 2, rsq, stat_values)
+    else:
+      stat_values = numpy.sqrt(numpy.add.reduceat(values**2, starts))
+
+    # keep coincs of two or more triggers, in order of first appearance
+    keep = numifos > 1
+    first = order[starts]
+    keep = numpy.flatnonzero(keep)[numpy.argsort(first[keep], kind='mergesort')]
+
+    self.event_id = sorted_ids[starts][keep]
+    self.numifos = numifos[keep]
+    self.stat_values = stat_values[keep]
+    self.rsq = rsq[keep]
+    self.bl = bl[keep]
+    self.trig_index = trig_index[keep]
+    self._rows = [None] * len(keep)
+
+  def __len__(self):
+    return len(self.event_id)
+
+  def __getitem__(self, i):
+    """
+    Return coinc i as a coincInspiralTable.row, building it on first use.
+    """
+    row = self._rows[i]
+    if row is None:
+      row = coincInspiralTable.row(None, numifos = int(self.numifos[i]), \
+          stat = float(self.stat_values[i]))
+      row.rsq = float(self.rsq[i])
+      row.bl = float(self.bl[i])
+      for j in numpy.flatnonzero(self.trig_index[i] >= 0):
+        setattr(row, ifos[j], self.sngl_table[self.trig_index[i, j]])
+      row.event_id = iter(row).next().event_id
+      if self.sim_table is not None:
+        row.add_sim(self.sim_table[i])
+      self._rows[i] = row
+    return row
+
+  def __iter__(self):
+    for i in xrange(len(self)):
+      yield self[i]
+
+  def getstat(self):
+    return self.stat_values
+
+  def ifo_mask(self, ifo):
+    """
+    Return a boolean array that is True for the coincs with a trigger
+    from ifo.
+    """
+    return self.trig_index[:, ifos.index(ifo)] >= 0
+
+  def sngl_column(self, ifo, name, default = numpy.nan):
+    """
+    Return the column name of the ifo trigger in each coinc, with default
+    for the coincs without a trigger from ifo.
+    """
+    index = self.trig_index[:, ifos.index(ifo)]
+    out = numpy.empty(len(self), dtype=float)
+    out.fill(default)
+    if len(self):
+      column = _sngl_column(self.sngl_table, name)
+      out[index >= 0] = column[index[index >= 0]]
+    return out
+
+  def add_sim_inspirals(self, sim_inspiral):
+    """
+    Attach the sim_inspiral table, one injection per coinc.
+
+    @param sim_inspiral: a simInspiralTable
+    """
+    if len(self) != len(sim_inspiral):
+      raise ValueError, "Number of injections doesn't match number of coincs"
+    self.sim_table = sim_inspiral
+    self._rows = [None] * len(self)
+
+  @classmethod
+  def concatenate(cls, parts):
+    """
+    Return the coincs of several coincInspiralColumns objects, for example
+    one per file, as one object.  The sngl (and sim) tables are joined in
+    the same order.
+    """
+    parts = [part for part in parts if len(part)]
+    new = cls(stat = parts and parts[0].stat or None)
+    if not parts:
+      return new
+    new.sngl_table = table.new_from_template(parts[0].sngl_table)
+    offsets = []
+    for part in parts:
+      offsets.append(len(new.sngl_table))
+      new.sngl_table.extend(part.sngl_table)
+    if all(part.sim_table is not None for part in parts):
+      new.sim_table = table.new_from_template(parts[0].sim_table)
+      for part in parts:
+        new.sim_table.extend(part.sim_table)
+    new.event_id = numpy.concatenate([part.event_id for part in parts])
+    new.numifos = numpy.concatenate([part.numifos for part in parts])
+    new.stat_values = numpy.concatenate([part.stat_values for part in parts])
+    new.rsq = numpy.concatenate([part.rsq for part in parts])
+    new.bl = numpy.concatenate([part.bl for part in parts])
+    new.trig_index = numpy.concatenate([numpy.where(part.trig_index >= 0, \
+        part.trig_index + offset, -1) for part, offset in zip(parts, offsets)])
+    new._rows = [None] * len(new.event_id)
+    return new
+
+  def to_table(self):
+    """
+    Return the coincs as a coincInspiralTable.
+    """
+    coincs = coincInspiralTable(stat=self.stat)
+    coincs.sngl_table = self.sngl_table
+    coincs.sim_table = self.sim_table
+    coincs.extend(list(self))
+    return coincs
@@ -23,7 +23,6 @@
 #
 
 import numpy
-import itertools
 
 from pylal.xlal.datatypes.ligotimegps import LIGOTimeGPS
 from glue import segments
@@ -33,6 +32,9 @@ from glue.ligolw import utils
 from glue.ligolw import ilwd
 from glue.ligolw import ligolw
 
+from pylal import _multiinspiralutils
+from pylal import ligolw_stream
+
 #
 # =============================================================================
 #
@@ -41,14 +43,24 @@ from glue.ligolw import ligolw
 # =============================================================================
 #
 
-def ReadMultiInspiralFromFiles(fileList):
+def ReadMultiInspiralFromFiles(fileList, columns=None, asarrays=False):
   """
   Read the multiInspiral tables from a list of files
   @param fileList: list of input files
+  @param columns: if given, stream the files and keep only these columns
+  @param asarrays: with columns, return a dictionary of numpy arrays, one
+  per column, rather than building a MultiInspiralTable row by row
   """
   if not fileList:
     return multiInspiralTable(), None
 
+  if columns is not None and asarrays:
+    return ligolw_stream.read_columns(fileList,\
+        lsctables.MultiInspiralTable.tableName, columns=columns)
+  if columns is not None:
+    return ligolw_stream.read_table(fileList, lsctables.MultiInspiralTable,\
+        columns=columns)
+
   multis = None
 
   for thisFile in fileList:
@@ -230,102 +242,45 @@ def cluster_multi_inspirals(mi_table, dt, loudest_by="snr"):
         * louder than those events in the preceeding and following bins
           that are within the clustering time window
 
-    @return: a new MultiInspiralTable containing those clustered events
+    The binning is done once and shared between ranking statistics, so
+    clustering by several columns is cheaper in a single call than in
+    one call per column.
+
+    @return: a new MultiInspiralTable containing those clustered events,
+        or a list of such tables, one per column, if loudest_by is a list
 
     @param mi_table:
         MultiInspiralTable to cluster
     @param dt:
         width (seconds) of clustering window
     @keyword loudest_by:
-        column by which to rank events, default: 'snr'
+        column by which to rank events, default: 'snr', or a list of
+        columns
 
     @type mi_table: glue.ligolw.lsctables.MultiInspiralTable
     @type dt: float
-    @type loudest_by: string
+    @type loudest_by: string or list of strings
     @rtype: glue.ligolw.lsctables.MultiInspiralTable
     """
-    cluster_table = table.new_from_template(mi_table)
-    if not len(mi_table):
-        return cluster_table
-
-    # get data
-    end_time = numpy.asarray(mi_table.get_end()).astype(float)
-    if hasattr(mi_table, "get_%s" % loudest_by):
-        stat = numpy.asarray(getattr(mi_table, "get_%s" % loudest_by)())
-    else:
-        stat = numpy.asarray(mi_table.get_column(loudest_by))
-
-    # get times
-    start = round(end_time.min())
-    end = round(end_time.max()+1)
-
-    # generate bins
-    num_bins  = int((end-start)//dt + 1)
-    time_bins = []
-    loudest_stat = numpy.zeros(num_bins)
-    loudest_time = numpy.zeros(num_bins)
-    for n in range(num_bins):
-        time_bins.append([])
-
-    # bin triggers
-    for i,(t,s) in enumerate(itertools.izip(end_time, stat)):
-        bin_ = int(float(t-start)//dt)
-        time_bins[bin_].append(i)
-        if s > loudest_stat[bin_]:
-            loudest_stat[bin_] = s
-            loudest_time[bin_] = t
-
-    # loop over all bins
-    for i,bin_ in enumerate(time_bins):
-        if len(bin_)<1:
-            continue
-        first = i==0
-        last = i==(num_bins-1)
-
-        prev = i-1
-        next_ = i+1
-        check_prev = (not first and len(time_bins[prev]) > 0)
-        check_next = (not last and len(time_bins[next_]) > 0)
-
-        # pick loudest event in bin
-        idx = bin_[stat[bin_].argmax()]
-        s = stat[idx]
-        t = end_time[idx]
-
-        # trigger was loudest in it's bin, search loudest event
-        # in previous bin
-        if (check_prev and (t - loudest_time[prev]) < dt and
-                s < loudest_stat[prev]):
-            continue
-
-        # Same for the next bin
-        if (check_next and (loudest_time[next_] - t) < dt and
-                s < loudest_stat[next_]):
-            continue
-
-        loudest=True
-
-        # trigger was loudest in it's bin, search previous bin
-        if check_prev and not (t - loudest_time[prev]) < dt:
-            for idx2 in time_bins[prev]:
-                t2 = end_time[idx2]
-                if (t - end_time[idx2]) < dt and s < stat[idx2]:
-                    loudest = False
-                    break
-        if not loudest:
-            continue
-
-        # if still loudest, check the next bin
-        if check_next and not (loudest_time[next_] - t) < dt:
-            for idx2 in time_bins[next_]:
-                if (end_time[idx2] - t) < dt and s < stat[idx2]:
-                    loudest = False
-                    break
-        if not loudest:
-            continue
-
-        # this was the loudest trigger in its vicinity,
-        # keep it and move to the next bin
-        cluster_table.append(mi_table[idx])
-
-    return cluster_table
+    columns = isinstance(loudest_by, basestring) and [loudest_by] or\
+              list(loudest_by)
+    cluster_tables = [table.new_from_template(mi_table) for c in columns]
+
+    if len(mi_table):
+        # get data
+        end_time = numpy.asarray(mi_table.get_end()).astype(float)
+        stat = numpy.empty((len(columns), len(mi_table)))
+        for i,column in enumerate(columns):
+            if hasattr(mi_table, "get_%s" % column):
+                stat[i] = getattr(mi_table, "get_%s" % column)()
+            else:
+                stat[i] = mi_table.get_column(column)
+
+        # cluster
+        keep = _multiinspiralutils.cluster_time_bins(end_time, stat, dt)
+        for cluster_table,idx in zip(cluster_tables, keep):
+            cluster_table.extend(mi_table[i] for i in idx)
+
+    if isinstance(loudest_by, basestring):
+        return cluster_tables[0]
+    return cluster_tables
@@ -27,6 +27,7 @@ from glue.ligolw import table
 from glue.ligolw import lsctables
 from glue.ligolw import utils
 from glue.ligolw import ligolw
+from pylal import ligolw_stream
 #
 # =============================================================================
 #
@@ -46,13 +47,25 @@ class ExtractSimInspiralTableLIGOLWContentHandler(ligolw.PartialLIGOLWContentHan
     ligolw.PartialLIGOLWContentHandler.__init__(self,document,filterfunc)
 
 
-def ReadSimInspiralFromFiles(fileList, verbose=False):
+def ReadSimInspiralFromFiles(fileList, verbose=False, columns=None, \
+    asarrays=False):
   """
   Read the simInspiral tables from a list of files
 
   @param fileList: list of input files
   @param verbose: print ligolw_add progress
+  @param columns: if given, stream the files and keep only these columns
+  @param asarrays: with columns, return a dictionary of numpy arrays, one
+  per column, rather than building a SimInspiralTable row by row
   """
+  if columns is not None and asarrays:
+    return ligolw_stream.read_columns(fileList, \
+        lsctables.SimInspiralTable.tableName, columns=columns, \
+        verbose=verbose)
+  if columns is not None:
+    return ligolw_stream.read_table(fileList, lsctables.SimInspiralTable, \
+        columns=columns, verbose=verbose)
+
   simInspiralTriggers = None
 
   lsctables.use_in(ExtractSimInspiralTableLIGOLWContentHandler)
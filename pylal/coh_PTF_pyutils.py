@@ -110,46 +110,363 @@ def get_bestnr( trig, q=4.0, n=3.0, null_thresh=(4.25,6), snr_threshold=6.,\
 
     return bestNR
 
+def _ifo_column_suffix(ifo):
+    """Return the suffix of the single-detector multi_inspiral columns for
+    the given ifo, e.g. 'h1' for H1 but 'l' for L1.
+    """
+    if ifo.lower()[0] == 'h':
+        return ifo.lower()
+    return ifo[0].lower()
+
+
+def get_det_response_array(ra, dec, end_time, end_time_ns=0, ifos=None):
+    """Return detector responses (F+, Fx) for arrays of sky locations (in
+    radians) and GPS times, as a dict of (fplus, fcross) array pairs keyed
+    by ifo. Polarization is set to zero, as in get_det_response.
+
+    The sidereal time is computed with LAL once per unique integer GPS
+    second and advanced at the sidereal rate for the fractional part, and
+    the responses are evaluated for all triggers at once from the
+    detector response tensors.
+    """
+    from lal import GreenwichMeanSiderealTime, LIGOTimeGPS
+    from pylal import inject
+    if ifos is None:
+        ifos = ['G1','H1','H2','L1','T1','V1']
+    ra = numpy.asarray(ra, dtype=numpy.float64)
+    dec = numpy.asarray(dec, dtype=numpy.float64)
+    end_time = numpy.asarray(end_time)
+    seconds = numpy.floor(end_time).astype(numpy.int64)
+    fraction = (end_time - seconds) + numpy.asarray(end_time_ns) * 1e-9
+
+    # sidereal time once per unique second
+    useconds, inverse = numpy.unique(seconds, return_inverse=True)
+    gmst = numpy.array([GreenwichMeanSiderealTime(LIGOTimeGPS(int(s)))
+                        for s in useconds])[inverse]
+    gmst += fraction * 2 * LAL_PI * 1.00273781191135448 / 86400.
+
+    # polarization basis vectors with psi = 0; see XLALComputeDetAMResponse
+    gha = gmst - ra
+    singha, cosgha = numpy.sin(gha), numpy.cos(gha)
+    sindec, cosdec = numpy.sin(dec), numpy.cos(dec)
+    X = numpy.array([-singha, -cosgha, numpy.zeros(len(gha))])
+    Y = numpy.array([-cosgha * sindec, singha * sindec, cosdec])
+
+    response = {}
+    for ifo in ifos:
+        D = numpy.asarray(inject.cached_detector_by_prefix[ifo].response,
+                          dtype=numpy.float64)
+        DX = numpy.dot(D, X)
+        DY = numpy.dot(D, Y)
+        response[ifo] = ((X * DX - Y * DY).sum(axis=0),
+                         (X * DY + Y * DX).sum(axis=0))
+    return response
+
+
+def get_multi_inspiral_columns(mi_table, ifos=None):
+    """Extract the columns used by get_bestnr_array from a
+    MultiInspiralTable, as a dict of arrays.
+    """
+    if ifos is None:
+        ifos = lsctables.instrument_set_from_ifos(mi_table[0].ifos)
+    names = ['snr', 'chisq', 'chisq_dof', 'bank_chisq', 'bank_chisq_dof',
+             'cont_chisq', 'cont_chisq_dof', 'ra', 'dec', 'end_time',
+             'end_time_ns']
+    for ifo in ifos:
+        names.append('snr_%s' % _ifo_column_suffix(ifo))
+        names.append('sigmasq_%s' % _ifo_column_suffix(ifo))
+    return dict((name, numpy.asarray(mi_table.get_column(name),
+                                     dtype=numpy.float64))
+                for name in names)
+
+
+def new_snr_array(snr, rchisq, q=4.0, n=3.0):
+    """Return the chisq re-weighted (new) SNR for arrays of SNR and reduced
+    chisq, as MultiInspiral.get_new_snr does for a single trigger.
+    """
+    snr = numpy.asarray(snr, dtype=numpy.float64)
+    rchisq = numpy.asarray(rchisq, dtype=numpy.float64)
+    newsnr = snr.copy()
+    high = rchisq > 1
+    newsnr[high] = snr[high] / ((1 + rchisq[high]**(q/n))/2)**(1./q)
+    return newsnr
+
+
+def get_bestnr_array(columns, ifos, q=4.0, n=3.0, null_thresh=(4.25,6),
+                     snr_threshold=6., sngl_snr_threshold=4.,
+                     chisq_threshold=None, null_grad_thresh=20.,
+                     null_grad_val=1./5.):
+    """
+    Calculate BestNR for a whole table of triggers at once, applying the
+    same signal based vetoes as get_bestnr.
+
+    @param columns
+        a dict of multi_inspiral column arrays, as returned by
+        get_multi_inspiral_columns
+    @param ifos
+        the instruments analysed
+
+    @returns
+        the BestNR array and a dict of boolean arrays ('snr', 'bank',
+        'auto', 'sngl', 'null') that are True for the triggers that pass
+        each veto. The 'null' mask uses the null_thresh[1] veto threshold,
+        graded above null_grad_thresh; the BestNR itself only uses
+        null_thresh[0] to down-weight triggers, as get_bestnr does.
+    """
+    if not chisq_threshold:
+        chisq_threshold = snr_threshold
+    ifos = sorted(map(str, ifos))
+    snr = columns['snr']
+    ntrig = len(snr)
+    masks = {}
+
+    # coherent SNR and chisq re-weighted SNR cuts
+    masks['snr'] = snr >= snr_threshold
+    masks['bank'] = new_snr_array(snr, columns['bank_chisq'] /
+                                  columns['bank_chisq_dof'], q, n)\
+                        >= chisq_threshold
+    masks['auto'] = new_snr_array(snr, columns['cont_chisq'] /
+                                  columns['cont_chisq_dof'], q, n)\
+                        >= chisq_threshold
+
+    # single detector SNR cut in the two most sensitive detectors
+    sngl_snr = numpy.array([columns['snr_%s' % _ifo_column_suffix(ifo)]
+                            for ifo in ifos]).reshape(len(ifos), ntrig)
+    masks['sngl'] = numpy.ones(ntrig, dtype=bool)
+    if len(ifos) > 1 and ntrig:
+        response = get_det_response_array(columns['ra'], columns['dec'],
+                                          columns['end_time'],
+                                          columns['end_time_ns'], ifos)
+        sens = numpy.array([columns['sigmasq_%s' % _ifo_column_suffix(ifo)] *
+                            (response[ifo][0]**2 + response[ifo][1]**2)
+                            for ifo in ifos])
+        # stable sort, so ties keep the same order as in get_bestnr
+        order = numpy.argsort(-sens, axis=0, kind='mergesort')[:2]
+        masks['sngl'] = (sngl_snr[order, numpy.arange(ntrig)] >=
+                         sngl_snr_threshold).all(axis=0)
+
+    # null SNR
+    null_snr_sq = (sngl_snr**2).sum(axis=0) - snr**2
+    null_snr = numpy.sqrt(numpy.where(null_snr_sq > 0, null_snr_sq, 0))
+    grade = numpy.where(snr > null_grad_thresh,
+                        (snr - null_grad_thresh) * null_grad_val, 0)
+    masks['null'] = null_snr < null_thresh[1] + grade
+
+    # chisq reduced (new) SNR, down-weighted by the null SNR
+    bestnr = new_snr_array(snr, columns['chisq'] /
+                           (2*columns['chisq_dof'] - 2), q, n)
+    if len(ifos) > 2:
+        excess = null_snr - (null_thresh[0] + grade)
+        bestnr = numpy.where(excess > 0, bestnr / (1 + excess), bestnr)
+
+    keep = masks['snr'] & masks['bank'] & masks['auto'] & masks['sngl']
+    bestnr = numpy.where(keep, bestnr, 0)
+
+    # If we got this far, the bestNR is non-zero. Verify that chisq actually
+    # was calculated for the triggers
+    missing = keep & (columns['chisq'] == 0)
+    if missing.any():
+        i = numpy.nonzero(missing)[0][0]
+        print >> sys.stderr,\
+            "Chisq not calculated for trigger with end time and snr:"
+        print >> sys.stderr, columns['end_time'][i] +\
+            columns['end_time_ns'][i]*1e-9, snr[i]
+        raise ValueError("Chisq has not been calculated for trigger.")
+
+    return bestnr, masks
+
+
+def get_bestnr_table(mi_table, **kwargs):
+    """Return the BestNR array and veto masks (see get_bestnr_array) for
+    all triggers in a MultiInspiralTable.
+    """
+    if len(mi_table) == 0:
+        return numpy.zeros(0), dict((veto, numpy.zeros(0, dtype=bool)) for
+                                    veto in ('snr','bank','auto','sngl','null'))
+    ifos = lsctables.instrument_set_from_ifos(mi_table[0].ifos)
+    return get_bestnr_array(get_multi_inspiral_columns(mi_table, ifos), ifos,
+                            **kwargs)
+
+
+def new_snr_chisq_array(snr, new_snr, chisq_dof, q=4.0, n=3.0):
+    """Returns the chisq values needed to weight an array of snr into
+    new_snr; the vectorized form of new_snr_chisq
+    """
+    chisqnorm = (numpy.asarray(snr, dtype=numpy.float64)/new_snr)**q
+    return numpy.where(chisqnorm <= 1, 1E-20,
+                       chisq_dof * numpy.maximum(2*chisqnorm - 1, 1)**(n/q))
+
+
+# in-memory cache of ChisqContours keyed on their parameters
+_contour_cache = {}
+
+
+class ChisqContours(object):
+    """Chisq versus SNR veto contours tabulated on a fixed SNR grid.
+
+    The contours depend only on their parameters, so they are built once
+    per parameter set and can be saved to and loaded from disk. Veto
+    thresholds for arrays of triggers are then looked up by linear
+    interpolation on the grid.
+    """
+    # version of the saved file format and of the contour construction;
+    # bump it whenever either changes so older files are rebuilt
+    format_version = 1
+
+    def __init__(self, q=4.0, n=3.0, null_thresh=6., null_grad_snr=20,\
+                 new_snr_thresh=6.0, new_snrs=(5.5,6,6.5,7,8,9,10,11),\
+                 null_grad_val=0.2, chisq_dof=60, bank_chisq_dof=40,\
+                 cont_chisq_dof=160, build=True):
+        self.key = (float(q), float(n), float(null_thresh),
+                    float(null_grad_snr), float(new_snr_thresh),
+                    tuple(map(float, new_snrs)), float(null_grad_val),
+                    chisq_dof, bank_chisq_dof, cont_chisq_dof)
+        self.new_snrs = numpy.asarray(new_snrs, dtype=numpy.float64)
+        self.new_snr_thresh = new_snr_thresh
+        self.colors = ["k-" if snr == new_snr_thresh else
+                       "y-" if snr == int(snr) else
+                       "y--" for snr in new_snrs]
+        if build:
+            self._build(q, n, null_thresh, null_grad_snr, null_grad_val,
+                        chisq_dof, bank_chisq_dof, cont_chisq_dof)
+
+    def _build(self, q, n, null_thresh, null_grad_snr, null_grad_val,
+               chisq_dof, bank_chisq_dof, cont_chisq_dof):
+        # get SNR values for contours
+        self.snr_vals = numpy.concatenate((numpy.arange(4,30,0.1),
+                                           numpy.arange(30,500,1)))
+
+        # contours for each new SNR along the first axis
+        snr = self.snr_vals[numpy.newaxis,:]
+        new_snr = self.new_snrs[:,numpy.newaxis]
+        self.bank_conts = new_snr_chisq_array(snr, new_snr, bank_chisq_dof, q, n)
+        self.auto_conts = new_snr_chisq_array(snr, new_snr, cont_chisq_dof, q, n)
+        self.chi_conts = new_snr_chisq_array(snr, new_snr, chisq_dof, q, n)
+        self.null_cont = numpy.where(self.snr_vals > null_grad_snr,
+                                     null_thresh + (self.snr_vals -
+                                                    null_grad_snr) *
+                                     null_grad_val,
+                                     null_thresh)
+
+    def filename(self, cache_dir):
+        """Return the path of the file for these contours in cache_dir.
+        """
+        import hashlib
+        return os.path.join(cache_dir, "coh_PTF_contours_%s.npz"
+                            % hashlib.md5(repr(self.key)).hexdigest())
+
+    def save(self, filename):
+        """Save the contours to filename, together with the format
+        version and parameters they were built with. The file is written
+        under a temporary name and renamed, so readers never see a
+        partly written file.
+        """
+        import tempfile
+        fd, tmpname = tempfile.mkstemp(suffix=".npz",
+                                       dir=os.path.dirname(filename) or ".")
+        try:
+            f = os.fdopen(fd, "wb")
+            try:
+                numpy.savez(f, format_version=self.format_version,
+                            key=repr(self.key), snr_vals=self.snr_vals,
+                            bank_conts=self.bank_conts,
+                            auto_conts=self.auto_conts,
+                            chi_conts=self.chi_conts,
+                            null_cont=self.null_cont)
+            finally:
+                f.close()
+            os.rename(tmpname, filename)
+        except:
+            if os.path.exists(tmpname):
+                os.remove(tmpname)
+            raise
+
+    def load(self, filename):
+        """Load the contours saved to filename. Raises ValueError if the
+        file was written with another format version or other parameters.
+        """
+        data = numpy.load(filename)
+        try:
+            if "format_version" not in data.files or\
+               int(data["format_version"]) != self.format_version or\
+               str(data["key"]) != repr(self.key):
+                raise ValueError("%s does not hold these contours" % filename)
+            for name in ("snr_vals", "bank_conts", "auto_conts", "chi_conts",
+                         "null_cont"):
+                setattr(self, name, data[name])
+        finally:
+            data.close()
+        return self
+
+    def as_tuple(self):
+        """Return the contours in the form returned by calculate_contours.
+        """
+        return self.bank_conts.copy(), self.auto_conts.copy(),\
+               self.chi_conts.copy(), self.null_cont.copy(),\
+               self.snr_vals.copy(), list(self.colors)
+
+    def chisq_threshold(self, snr, contour="chi", new_snr=None):
+        """Interpolate the chisq contour for new_snr (default: the new SNR
+        threshold) at an array of SNR values. contour is one of 'chi',
+        'bank' or 'auto'.
+        """
+        if new_snr is None:
+            new_snr = self.new_snr_thresh
+        i = numpy.nonzero(self.new_snrs == new_snr)[0]
+        if not len(i):
+            raise ValueError("no contour tabulated for new SNR %s" % new_snr)
+        conts = getattr(self, "%s_conts" % contour)[i[0]]
+        return numpy.interp(snr, self.snr_vals, conts)
+
+    def null_threshold(self, snr):
+        """Interpolate the null SNR threshold at an array of SNR values.
+        """
+        return numpy.interp(snr, self.snr_vals, self.null_cont)
+
+    def veto(self, snr, chisq, contour="chi", new_snr=None):
+        """Return a boolean array that is True for the triggers whose chisq
+        lies above the interpolated contour.
+        """
+        return numpy.asarray(chisq) > self.chisq_threshold(snr, contour,
+                                                          new_snr)
+
+
+def get_contours(cache_dir=None, **kwargs):
+    """Return the ChisqContours for the given parameters (see
+    ChisqContours), reusing those built earlier in this process or, if
+    cache_dir is given, saved to disk by an earlier run.
+    """
+    import zipfile
+    contours = ChisqContours(build=False, **kwargs)
+    if contours.key in _contour_cache:
+        return _contour_cache[contours.key]
+    filename = cache_dir and contours.filename(cache_dir)
+    try:
+        if not (filename and os.path.isfile(filename)):
+            raise IOError
+        contours.load(filename)
+    except (IOError, ValueError, zipfile.BadZipfile):
+        # no usable saved contours, build and save them
+        contours = ChisqContours(**kwargs)
+        if filename:
+            contours.save(filename)
+    _contour_cache[contours.key] = contours
+    return contours
+
+
 def calculate_contours(q=4.0, n=3.0, null_thresh=6., null_grad_snr=20,\
                        new_snr_thresh=6.0, new_snrs=[5.5,6,6.5,7,8,9,10,11],\
                        null_grad_val = 0.2, chisq_dof = 60,\
-                       bank_chisq_dof = 40, cont_chisq_dof = 160):
+                       bank_chisq_dof = 40, cont_chisq_dof = 160,\
+                       cache_dir = None):
     """Generate the plot contours for chisq variable plots
     """
-    # initialise chisq contour values and colours
-    num_vals  = len(new_snrs)
-    colors = ["k-" if snr == new_snr_thresh else
-              "y-" if snr == int(snr) else
-              "y--" for snr in new_snrs]
-
-    # get SNR values for contours
-    snr_low_vals  = numpy.arange(4,30,0.1)
-    snr_high_vals = numpy.arange(30,500,1)
-    snr_vals      = numpy.asarray(list(snr_low_vals) + list(snr_high_vals))
-
-    # initialise contours
-    bank_conts = numpy.zeros([len(new_snrs),len(snr_vals)],
-                             dtype=numpy.float64)
-    auto_conts = numpy.zeros([len(new_snrs),len(snr_vals)],
-                             dtype=numpy.float64)
-    chi_conts = numpy.zeros([len(new_snrs),len(snr_vals)],
-                            dtype=numpy.float64)
-    null_cont  = []
-
-    # loop over each and calculate chisq variable needed for SNR contour
-    for j,snr in enumerate(snr_vals):
-        for i,new_snr in enumerate(new_snrs):
-            bank_conts[i][j] = new_snr_chisq(snr, new_snr, bank_chisq_dof, q, n)
-            auto_conts[i][j] = new_snr_chisq(snr, new_snr, cont_chisq_dof, q, n)
-            chi_conts[i][j]  = new_snr_chisq(snr, new_snr, chisq_dof, q, n)
-
-        if snr > null_grad_snr:
-            null_cont.append(null_thresh + (snr-null_grad_snr)*null_grad_val)
-        else:
-            null_cont.append(null_thresh)
-    null_cont = numpy.asarray(null_cont)
-
-    return bank_conts,auto_conts,chi_conts,null_cont,snr_vals,colors
+    return get_contours(cache_dir=cache_dir, q=q, n=n,
+                        null_thresh=null_thresh, null_grad_snr=null_grad_snr,
+                        new_snr_thresh=new_snr_thresh, new_snrs=new_snrs,
+                        null_grad_val=null_grad_val, chisq_dof=chisq_dof,
+                        bank_chisq_dof=bank_chisq_dof,
+                        cont_chisq_dof=cont_chisq_dof).as_tuple()
 
 
 def plot_contours( axis, snr_vals, contours, colors ):
@@ -5,7 +5,7 @@
 # =============================================================================
 
 from __future__ import division
-import sys,os,re,math,datetime,glob,copy
+import sys,os,re,math,datetime,glob,copy,mmap,string,threading
 from socket import getfqdn
 
 from glue.ligolw import ligolw,table,lsctables,utils
@@ -570,6 +570,11 @@ def totrigfile(file,table,etg,header=True,columns=None):
 # Function to load triggers from xml
 # =============================================================================
 
+# loadcolumns is a class attribute of the lsctables table classes, hold this
+# while it is set so threads reading different columns do not see each
+# other's choice
+_loadcolumns_lock = threading.Lock()
+
 def fromtrigxml(file,tablename='sngl_inspiral:table',start=None,end=None,\
                 columns=None):
 
@@ -600,24 +605,37 @@ def fromtrigxml(file,tablename='sngl_inspiral:table',start=None,end=None,\
 
   span = segments.segment(start,end)
 
-  # set columns
+  # set tablename
+  if not tablename.endswith(':table'):
+    tablename = ':'.join([tablename,'table'])
+
+  # find table type whose columns to restrict
+  tabletype = None
   if columns!=None:
     if re.search('sngl_burst', tablename):
-      lsctables.SnglBurstTable.loadcolumns = columns
+      tabletype = lsctables.SnglBurstTable
     elif re.search('sngl_inspiral', tablename):
-      lsctables.SnglInspiralTable.loadcolumns = columns
-    if re.search('multi_burst', tablename):
-      lsctables.MultiBurstTable.loadcolumns = columns
+      tabletype = lsctables.SnglInspiralTable
+    elif re.search('multi_burst', tablename):
+      tabletype = lsctables.MultiBurstTable
     elif re.search('multi_inspiral', tablename):
-      lsctables.MultiInspiralTable.loadcolumns = columns
+      tabletype = lsctables.MultiInspiralTable
 
-  # set tablename
-  if not tablename.endswith(':table'):
-    tablename = ':'.join([tablename,'table'])
+  _loadcolumns_lock.acquire()
+  try:
+    # set columns
+    if tabletype is not None:
+      tabletype.loadcolumns = columns
+
+    # crack open xml file
+    xmldoc,digest = utils.load_fileobj(file,gz=file.name.endswith('gz'))
+    alltriggers = table.get_table(xmldoc,tablename)
 
-  # crack open xml file
-  xmldoc,digest = utils.load_fileobj(file,gz=file.name.endswith('gz'))
-  alltriggers = table.get_table(xmldoc,tablename)
+  finally:
+    # reset columns
+    if tabletype is not None:
+      tabletype.loadcolumns = None
+    _loadcolumns_lock.release()
 
   triggers = table.new_from_template(alltriggers)
   append = triggers.append
@@ -631,10 +649,6 @@ def fromtrigxml(file,tablename='sngl_inspiral:table',start=None,end=None,\
   # sort table in time
   triggers.sort(key=lambda trig: float(get_time(trig)))
 
-  # reset columns
-  if columns:
-    type(triggers).loadcolumns = None
-
   return triggers
 
 # =============================================================================
@@ -692,13 +706,31 @@ def fromtrigfile(file,etg,start=None,end=None,ifo=None,channel=None,\
 # =============================================================================
 
 def fromLALCache(cache, etg, start=None, end=None, columns=None,\
-                 virgo=False, verbose=False, snr=False):
+                 virgo=False, verbose=False, snr=False, nproc=1,\
+                 threads=False, queue_depth=None):
 
   """
     Extract triggers froa given ETG from all files in a glue.lal.Cache object.
     Returns a glue.ligolw.Table relevant to the given trigger generator etg.
+
+    If nproc is greater than one the cache entries are fanned out over a pool
+    of nproc worker processes (or threads if threads=True). Each worker
+    parses, time-filters and column-projects one file into column arrays, and
+    the chunks are merged into a single table in time order. At most
+    queue_depth files (default 2*nproc) are in flight at once, which bounds
+    the number of parsed files waiting to be collected, not the total memory:
+    the column arrays of every file are kept until the final merge, so that
+    grows with the number of triggers kept (after the snr cut, which is
+    applied to each file as it arrives). XML files are parsed one at a time
+    when threads=True, use processes to read many XML files in parallel.
   """
 
+  if nproc > 1:
+    return _fromLALCache_parallel(cache, etg, start=start, end=end,\
+                                  columns=columns, virgo=virgo,\
+                                  verbose=verbose, snr=snr, nproc=nproc,\
+                                  threads=threads, queue_depth=queue_depth)
+
   # set up counter
   if verbose:
     sys.stdout.write("Extracting %s triggers from %d files...     "\
@@ -732,6 +764,149 @@ def fromLALCache(cache, etg, start=None, end=None, columns=None,\
   if verbose: sys.stdout.write("\n")  
   return trigs
 
+def _load_columns(args):
+
+  """
+    Worker for _fromLALCache_parallel: read one trigger file and return a
+    dict of column arrays holding those triggers within [start, end).
+  """
+
+  path, etg, tablename, start, end, columns, virgo = args
+  if columns is not None:
+    columns = list(columns)
+
+  if re.search('(xml|xml.gz)\Z', path):
+    fh = open(path)
+    try:
+      trigs = fromtrigxml(fh, tablename=tablename, start=start, end=end,\
+                          columns=columns)
+    finally:
+      fh.close()
+    return dict((c, numpy.asarray(trigs.getColumnByName(c)))\
+                for c in trigs.columnnames)
+
+  fh = open(path)
+  try:
+    if re.search('omegaspectrum|omegadq', etg, re.I):
+      trigs = fromtrigfile(fh, etg=etg, start=start, end=end,\
+                           columns=columns, virgo=virgo)
+      return dict((c, numpy.asarray(trigs.getColumnByName(c)))\
+                  for c in trigs.columnnames)
+    elif re.search('omega', etg, re.I):
+      return fromomegafile(fh, start=start, end=end, columns=columns,\
+                           virgo=virgo, asarrays=True)
+    elif re.search('kw', etg, re.I):
+      return fromkwfile(fh, start=start, end=end, columns=columns,\
+                        asarrays=True)
+    elif re.search('hacr', etg, re.I):
+      return fromhacrfile(fh, start=start, end=end, columns=columns,\
+                          asarrays=True)
+    elif re.search('ihope', etg, re.I):
+      return fromihopefile(fh, start=start, end=end, columns=columns,\
+                           asarrays=True)
+  finally:
+    fh.close()
+
+  raise ValueError("etg=%s not recognised by fromLALCache." % etg)
+
+def _column_times(colmap):
+
+  """
+    Return the float trigger times held in the column dict colmap, or None if
+    it does not carry a recognised time column.
+  """
+
+  for tcol in ['peak_time', 'end_time', 'start_time']:
+    if tcol in colmap:
+      t = numpy.asarray(colmap[tcol], dtype=float)
+      if '%s_ns' % tcol in colmap:
+        t = t + numpy.asarray(colmap['%s_ns' % tcol], dtype=float)*1e-9
+      return t
+  return None
+
+def _fromLALCache_parallel(cache, etg, start=None, end=None, columns=None,\
+                           virgo=False, verbose=False, snr=False, nproc=2,\
+                           threads=False, queue_depth=None):
+
+  """
+    Parallel implementation of fromLALCache, see that function for details.
+  """
+
+  import multiprocessing
+  from multiprocessing import pool as mp_pool
+
+  trigs = SnglTriggerTable(etg, columns=columns)
+  rowtype = type(SnglTrigger(etg))
+
+  if not queue_depth:
+    queue_depth = 2*nproc
+
+  if verbose:
+    sys.stdout.write("Extracting %s triggers from %d files on %d %s...     "\
+                     % (etg, len(cache), nproc,\
+                        threads and 'threads' or 'processes'))
+    sys.stdout.flush()
+    delete = '\b\b\b'
+    num = len(cache)/100
+
+  if threads:
+    workers = mp_pool.ThreadPool(nproc)
+  else:
+    workers = multiprocessing.Pool(nproc)
+
+  tasks = [(e.path, etg, trigs.tableName, start, end, columns, virgo)\
+           for e in cache]
+  chunks  = []
+  pending = []
+  done    = 0
+  try:
+    for i,task in enumerate(tasks):
+      pending.append(workers.apply_async(_load_columns, (task,)))
+      # keep at most queue_depth files in flight, draining at the end
+      while pending and (len(pending) >= queue_depth or i == len(tasks)-1):
+        chunk = pending.pop(0).get()
+        # apply the SNR threshold now so rejected triggers are not held
+        if chunk and snr and 'snr' in chunk:
+          keep = numpy.asarray(chunk['snr']) > snr
+          chunk = dict((c, numpy.asarray(chunk[c])[keep]) for c in chunk)
+        if chunk:
+          chunks.append(chunk)
+        done += 1
+        if verbose and len(cache)>1:
+          progress = int(done/num)
+          sys.stdout.write('%s%.2d%%' % (delete, progress))
+          sys.stdout.flush()
+    workers.close()
+  except:
+    workers.terminate()
+    raise
+  finally:
+    workers.join()
+
+  if verbose: sys.stdout.write("\n")
+
+  if not chunks:
+    return trigs
+
+  # merge chunks, keeping only columns common to all of them
+  cols = set(chunks[0].keys())
+  for chunk in chunks[1:]:
+    cols &= set(chunk.keys())
+  colmap = dict((c, numpy.concatenate([numpy.asarray(chunk[c])\
+                                       for chunk in chunks])) for c in cols)
+  numtrigs = len(colmap.values()[0]) if colmap else 0
+
+  # order in time, stably so equal times keep cache order
+  times = _column_times(colmap)
+  if times is not None:
+    order = numpy.argsort(times, kind='mergesort')
+  else:
+    order = numpy.arange(numtrigs)
+  for c in colmap:
+    colmap[c] = colmap[c][order]
+
+  return _table_from_columns(trigs, rowtype, colmap, len(order))
+
 # =============================================================================
 # Generate a daily ihope cache 
 # =============================================================================
@@ -1311,6 +1486,143 @@ def autocorr(triggers,column='time',timeStep=0.02,timeRange=60):
 
   return delayHistFFT, freqBins, delayHist, histEdges
 
+# =============================================================================
+# Vectorised windowed coincidence
+# =============================================================================
+
+def coinc_mask(time1, time2, windows=1, timeshifts=0):
+
+  """
+    Returns a boolean array marking those entries of time1 that lie within
+    +-window of an entry of time2 shifted by timeshift, for every
+    combination of the given windows and timeshifts.
+
+    The return array has shape (len(windows), len(timeshifts), len(time1)),
+    with element [i,j,k] True if time1[k] is coincident with time2 for
+    windows[i] and timeshifts[j]. Windows are closed, i.e. triggers exactly
+    window seconds apart are coincident.
+
+    time2 is sorted once and each trigger in time1 is located with a pair
+    of binary searches, so the cost is O(N1 log N2) per (window, shift)
+    pair, all evaluated in compiled numpy code.
+
+    Arguments:
+
+      time1 : [ float ]
+        array of trigger times to test for coincidence
+      time2 : [ float ]
+        array of trigger times against which to test
+
+    Keyword arguments:
+
+      windows : [ float ]
+        half-width(s) of the coincidence window
+      timeshifts : [ float ]
+        offset(s) added to time2 before testing
+  """
+
+  time1 = numpy.asarray(time1, dtype=float)
+  time2 = numpy.sort(numpy.asarray(time2, dtype=float))
+  windows = numpy.atleast_1d(numpy.asarray(windows, dtype=float))
+  timeshifts = numpy.atleast_1d(numpy.asarray(timeshifts, dtype=float))
+
+  # t1 is coincident iff some t2 lies in [t1-shift-dt, t1-shift+dt]
+  shifted = time1[numpy.newaxis,numpy.newaxis,:]\
+            - timeshifts[numpy.newaxis,:,numpy.newaxis]
+  lo = numpy.searchsorted(time2,\
+                          shifted - windows[:,numpy.newaxis,numpy.newaxis],\
+                          side='left')
+  hi = numpy.searchsorted(time2,\
+                          shifted + windows[:,numpy.newaxis,numpy.newaxis],\
+                          side='right')
+
+  return hi > lo
+
+def coinc_counts(time1, time2, windows=1, timeshifts=0):
+
+  """
+    Returns an array of shape (len(windows), len(timeshifts)) holding the
+    number of entries in time1 coincident with time2 for each window and
+    timeshift. See coinc_mask for details.
+  """
+
+  return coinc_mask(time1, time2, windows=windows, timeshifts=timeshifts)\
+             .sum(axis=-1)
+
+def poisson_significance(ncoinc, mu):
+
+  """
+    Returns the Poisson significance -log10(P(n >= ncoinc | mu)) of ncoinc
+    coincidences given an expected number mu, element-wise for array inputs.
+    Where the incomplete gamma function underflows the asymptotic form
+    (ref. hveto_significance.m) is used, and zero coincidences give zero
+    significance.
+  """
+
+  ncoinc = numpy.asarray(ncoinc, dtype=float)
+  mu = numpy.asarray(mu, dtype=float)
+  ncoinc, mu = numpy.broadcast_arrays(ncoinc, mu)
+
+  significance = numpy.zeros(ncoinc.shape)
+  valid = ncoinc >= 1
+  if not valid.any():
+    return significance
+
+  g = special.gammainc(ncoinc[valid], mu[valid])
+  sig = numpy.empty(g.shape)
+  small = g == 0
+  sig[~small] = -numpy.log10(g[~small])
+  n = ncoinc[valid][small]
+  m = mu[valid][small]
+  sig[small] = -n * numpy.log10(m) + m * math.log10(math.exp(1)) +\
+               special.gammaln(n + 1) / math.log(10)
+  significance[valid] = sig
+
+  return significance
+
+def coinc_significance_array(time1, time2, windows=1, timeshifts=0,\
+                             livetime=None):
+
+  """
+    Returns (counts, significance), each of shape
+    (len(windows), len(timeshifts)), giving the number of time1 entries
+    coincident with time2 and the Poisson significance of that number, for
+    every window and timeshift in one pass. This is the vectorised form of
+    coinc_significance_times, suitable for ranking many auxiliary channels
+    over a grid of windows.
+
+    Arguments:
+
+      time1 : [ float ]
+        array of GW trigger times
+      time2 : [ float ]
+        array of auxiliary trigger times
+
+    Keyword arguments:
+
+      windows : [ float ]
+        half-width(s) of the coincidence window
+      timeshifts : [ float ]
+        offset(s) added to time2 before testing
+      livetime : float
+        analysed livetime, defaults to the span of time1
+  """
+
+  time1 = numpy.asarray(time1, dtype=float)
+  time2 = numpy.asarray(time2, dtype=float)
+  windows = numpy.atleast_1d(numpy.asarray(windows, dtype=float))
+
+  if not livetime:
+    livetime = time1.max() - time1.min()
+
+  counts = coinc_counts(time1, time2, windows=windows, timeshifts=timeshifts)
+
+  # mean of Poisson distribution for each window
+  mu = len(time1) * 2.0 * windows / float(livetime) * len(time2)
+  mu = numpy.repeat(mu[:,numpy.newaxis], counts.shape[1], axis=1)
+
+  return counts, poisson_significance(counts, mu)
+
 # =============================================================================
 # Get coincidences between two tables
 # =============================================================================
@@ -1325,13 +1637,14 @@ def get_coincs(table1, table2, dt=1, returnsegs=False, timeshift=0):
   t1 = get_column(table1, 'time')
   t2 = get_column(table2, 'time')
 
-  coincsegs  = segments.segmentlist(segments.segment(t-dt+timeshift, t+dt+timeshift) for t in t2)\
-                   .coalesce()
-  coincsegs.sort()
+  mask = coinc_mask(t1, t2, windows=dt, timeshifts=timeshift)[0,0]
   coinctrigs = table.new_from_template(table1)
-  coinctrigs.extend(t for i,t in enumerate(table1) if t1[i] in coincsegs)
+  coinctrigs.extend(t for i,t in enumerate(table1) if mask[i])
 
   if returnsegs:
+    coincsegs  = segments.segmentlist(segments.segment(t-dt+timeshift, t+dt+timeshift) for t in t2)\
+                     .coalesce()
+    coincsegs.sort()
     return coinctrigs,coincsegs
   else:
     return coinctrigs
@@ -1347,17 +1660,6 @@ def get_number_coincs(table1, table2, dt=1, timeshift=0, tabletype='trigger'):
     an entry in table2.
   """
 
-  # t1 = get_column(table1, 'time')
-  # t2 = get_column(table2, 'time')
-
-  # coincsegs  = segments.segmentlist(segments.segment(t-dt+timeshift, t+dt+timeshift) for t in t2)\
-  #                  .coalesce()
-  # coincsegs.sort()
-  # coinctrigs = table.new_from_template(table1)
-  # coinctrigs.extend(t for i,t in enumerate(table1) if t1[i] in coincsegs)
-
-  # return len(coinctrigs)
-
   if tabletype == 'trigger':
     time1 = get_column(table1, 'time')
     time2 = get_column(table2, 'time')
@@ -1367,20 +1669,7 @@ def get_number_coincs(table1, table2, dt=1, timeshift=0, tabletype='trigger'):
   else:
     raise ValueError("Unrecognized table type for coincidence number: %s" % tabletype)
 
-  time1.sort()
-  time2.sort()
-
-  i2 = 0
-  ncoinc = 0
-  for i1,t1 in enumerate(time1):
-    while  i2 < len(time2) and t1 > time2[i2]+timeshift+dt:
-      i2 = i2 + 1
-    if i2 >= len(time2):
-      break
-    if t1 >= time2[i2]+timeshift-dt:
-      ncoinc = ncoinc + 1
-
-  return ncoinc
+  return int(coinc_counts(time1, time2, windows=dt, timeshifts=timeshift)[0,0])
 
 # ==============================================================================
 # Calculate poisson significance of time coincidences
@@ -1388,37 +1677,11 @@ def get_number_coincs(table1, table2, dt=1, timeshift=0, tabletype='trigger'):
 
 def coinc_significance_times(gwtrigtime, auxtrigtime, window=1, livetime=None):
 
+  counts, significance = coinc_significance_array(gwtrigtime, auxtrigtime,\
+                                                  windows=window,\
+                                                  livetime=livetime)
 
-  # get livetime
-  if not livetime:
-    start    = min(gwtrigtime)
-    end      = max(gwtrigtime)
-    livetime = end-start
-
-  # calculate probability of a GW trigger falling within the window
-  gwprob = len(gwtrigtime) * 2.0 * float(window) / float(livetime)
-
-  # calculate mean of Poisson distribution
-  mu = gwprob * len(auxtrigtime)
-
-  # get coincidences
-  ncoinc = get_number_coincs(gwtrigtime, auxtrigtime, dt=window, tabletype='time')
-
-  g = special.gammainc(ncoinc, mu)
-
-  # if no coincidences, set significance to zero
-  if ncoinc<1:
-    significance = 0
-  # if significance would blow up, use other formula (ref. hveto_significance.m)
-  elif g == 0:
-    significance = -ncoinc * math.log10(mu) + \
-                   mu * math.log10(math.exp(1)) +\
-                   special.gammaln(ncoinc + 1) / math.log(10)
-  # otherwise use the standard formula
-  else:
-    significance = -math.log(g, 10)
-  
-  return significance
+  return float(significance[0,0])
 
 
 # ==============================================================================
@@ -1428,44 +1691,18 @@ def coinc_significance_times(gwtrigtime, auxtrigtime, window=1, livetime=None):
 def coinc_significance(gwtriggers, auxtriggers, window=1, livetime=None,\
                        returnsegs=False):
 
-  get_time = def_get_time(gwtriggers.tableName)
-  aux_get_time = def_get_time(auxtriggers.tableName)
-
-  # get livetime
-  if not livetime:
-    start    = min([get_time(t) for t in gwtriggers])
-    end      = max([get_time(t) for t in gwtriggers])
-    livetime = end-start
+  gwtrigtime  = get_column(gwtriggers, 'time')
+  auxtrigtime = get_column(auxtriggers, 'time')
 
-  # calculate probability of a GW trigger falling within the window
-  gwprob = len(gwtriggers) * 2.0 * float(window) / float(livetime)
-
-  # calculate mean of Poisson distribution
-  mu = gwprob * len(auxtriggers)
-
-  # get coincidences
-  if returnsegs:
-    coinctriggers,coincsegs = get_coincs(gwtriggers, auxtriggers, dt=window,\
-                                           returnsegs=True)
-    ncoinc = len(coinctriggers)
-  else:
-    ncoinc = get_number_coincs(gwtriggers, auxtriggers, dt=window)
-
-  g = special.gammainc(ncoinc, mu)
-
-  # if no coincidences, set significance to zero
-  if ncoinc<1:
-    significance = 0
-  # if significance would blow up, use other formula (ref. hveto_significance.m)
-  elif g == 0:
-    significance = -ncoinc * math.log10(mu) + \
-                   mu * math.log10(math.exp(1)) +\
-                   special.gammaln(ncoinc + 1) / math.log(10)
-  # otherwise use the standard formula
-  else:
-    significance = -math.log(g, 10)
+  counts, significance = coinc_significance_array(gwtrigtime, auxtrigtime,\
+                                                  windows=window,\
+                                                  livetime=livetime)
+  significance = float(significance[0,0])
 
   if returnsegs:
+    coincsegs  = segments.segmentlist(segments.segment(t-window, t+window)\
+                                      for t in auxtrigtime).coalesce()
+    coincsegs.sort()
     return significance,coincsegs
   else:
     return significance
@@ -1567,7 +1804,7 @@ def vetoed(self, seglist):
 # =============================================================================
 
 def fromomegafile(fname, start=None, end=None, ifo=None, channel=None,\
-                  columns=None, virgo=False):
+                  columns=None, virgo=False, use_mmap=False, asarrays=False):
 
   """
     Load triggers from an Omega format text file into a SnglBurstTable object.
@@ -1580,7 +1817,7 @@ def fromomegafile(fname, start=None, end=None, ifo=None, channel=None,\
     Arguments :
 
       fname : file or str
-        file object or filename path to read with numpy.loadtext
+        file object or filename path to read with loadcolumns
 
     Keyword arguments :
 
@@ -1594,6 +1831,10 @@ def fromomegafile(fname, start=None, end=None, ifo=None, channel=None,\
         name of channel to fill in table
       columns : iterable
         list of columnnames to populate in table
+      use_mmap : bool
+        read the file through mmap
+      asarrays : bool
+        return a dict of column arrays rather than building table rows
   """
 
   # set columns
@@ -1603,12 +1844,10 @@ def fromomegafile(fname, start=None, end=None, ifo=None, channel=None,\
       start = 0
     if not end:
       end   = numpy.inf
-    span = segments.segment(start, end)
     if 'peak_time' not in columns: columns.append('peak_time')
     if 'peak_time_ns' not in columns: columns.append('peak_time_ns')
-    check_time = True
   else:
-    check_time = False
+    start = end = None
 
   if 'snr' in columns and not 'amplitude' in columns:
     columns.append('amplitude')
@@ -1622,13 +1861,15 @@ def fromomegafile(fname, start=None, end=None, ifo=None, channel=None,\
   else:
     fh = open(fname, 'r')
 
-  dat = loadtxt(fh)
+  # peak time is the third column of Virgo files, the first otherwise
+  dat = loadcolumns(fh, timecolumn=virgo and 2 or 0, start=start, end=end,\
+                    use_mmap=use_mmap)
 
   if not hasattr(fname, 'readline'):
     fh.close()
 
-  if numpy.shape(dat) == (0,):
-    return out
+  if dat.size == 0:
+    return asarrays and dict() or out
 
   if virgo:
     start, stop, peak, freq, bandwidth, cln, cle, snr = dat
@@ -1656,26 +1897,20 @@ def fromomegafile(fname, start=None, end=None, ifo=None, channel=None,\
   attr_map = dict()
 
   if 'start_time' in columns or 'start_time_ns' in columns:
-    start = map(LIGOTimeGPS, peak - duration/2)
     attr_map['start_time'], attr_map['start_time_ns'] =\
-        zip(*[(s.seconds, s.nanoseconds) for s in start])
+        _split_gps(peak - duration/2)
   if 'stop_time' in columns or 'stop_time_ns' in columns:
-    stop = map(LIGOTimeGPS, peak + duration/2)
     attr_map['stop_time'], attr_map['stop_time_ns'] =\
-        zip(*[(s.seconds, s.nanoseconds) for s in stop])
+        _split_gps(peak + duration/2)
   if 'peak_time' in columns or 'peak_time_ns' in columns:
-    peak = map(LIGOTimeGPS, peak)
-    attr_map['peak_time'], attr_map['peak_time_ns'] =\
-        zip(*[(s.seconds, s.nanoseconds) for s in peak])
+    attr_map['peak_time'], attr_map['peak_time_ns'] = _split_gps(peak)
 
   if 'ms_start_time' in columns or 'ms_start_time_ns' in columns:
-    ms_start = map(LIGOTimeGPS, peak-duration/2)
     attr_map['ms_start_time'], attr_map['ms_start_time_ns'] =\
-        zip(*[(s.seconds, s.nanoseconds) for s in ms_start])
+        _split_gps(peak-duration/2)
   if 'ms_stop_time' in columns or 'ms_stop_time_ns' in columns:
-    ms_stop = map(LIGOTimeGPS, peak+duration/2)
     attr_map['ms_stop_time'], attr_map['ms_stop_time_ns'] =\
-        zip(*[(s.seconds, s.nanoseconds) for s in ms_stop])
+        _split_gps(peak+duration/2)
 
   if 'central_freq' in columns:   attr_map['central_freq']   = freq
   if 'peak_frequency' in columns: attr_map['peak_frequency'] = av_freq
@@ -1711,18 +1946,13 @@ def fromomegafile(fname, start=None, end=None, ifo=None, channel=None,\
     else:
       attr_map['param_three_value'] = [numpy.NaN] * numtrigs
 
-  cols   = attr_map.keys()
-  append = out.append
-  for i in range(numtrigs):
-    t = lsctables.SnglBurst()
-    for c in cols: setattr(t, c, attr_map[c][i])
-    if not check_time or (check_time and float(t.get_peak()) in span):
-      append(t)
-  
-  return out
+  if asarrays:
+    return attr_map
+
+  return _table_from_columns(out, lsctables.SnglBurst, attr_map, numtrigs)
 
 def fromkwfile(fname, start=None, end=None, ifo=None, channel=None,\
-               columns=None):
+               columns=None, use_mmap=False, asarrays=False):
 
   """
     Load triggers from a KW format text file into a SnglBurstTable object.
@@ -1735,7 +1965,7 @@ def fromkwfile(fname, start=None, end=None, ifo=None, channel=None,\
     Arguments :
 
       fname : file or str
-        file object or filename path to read with numpy.loadtext
+        file object or filename path to read with loadcolumns
 
     Keyword arguments :
 
@@ -1749,6 +1979,10 @@ def fromkwfile(fname, start=None, end=None, ifo=None, channel=None,\
         name of channel to fill in table
       columns : iterable
         list of columnnames to populate in table
+      use_mmap : bool
+        read the file through mmap
+      asarrays : bool
+        return a dict of column arrays rather than building table rows
   """
 
   # set columns
@@ -1758,12 +1992,10 @@ def fromkwfile(fname, start=None, end=None, ifo=None, channel=None,\
       start = 0
     if not end:
       end   = numpy.inf
-    span = segments.segment(start, end)
     if 'peak_time' not in columns: columns.append('peak_time')
     if 'peak_time_ns' not in columns: columns.append('peak_time_ns')
-    check_time = True
   else:
-    check_time = False
+    start = end = None
 
   # generate table
   out = SnglTriggerTable('kw', columns=columns)
@@ -1774,15 +2006,16 @@ def fromkwfile(fname, start=None, end=None, ifo=None, channel=None,\
   else:
     fh = open(fname, 'r')
 
-  # load data from file
-  dat = loadtxt(fh, usecols=[0,1,2,3,4,5,6,7])
+  # load data from file, filtering on the peak time column
+  dat = loadcolumns(fh, usecols=[0,1,2,3,4,5,6,7], timecolumn=2, start=start,\
+                    end=end, use_mmap=use_mmap)
 
   # close file if we opened it
   if not hasattr(fname, 'readline'):
     fh.close()
 
-  if numpy.shape(dat) == (0,):
-    return out
+  if dat.size == 0:
+    return asarrays and dict() or out
 
   if len(dat)==8:
     st, stop, peak, freq, energy, amplitude, n_pix, sig = dat
@@ -1798,26 +2031,16 @@ def fromkwfile(fname, start=None, end=None, ifo=None, channel=None,\
   if 'ms_duration' in columns:    attr_map['ms_duration']    = stop-st
 
   if 'start_time' in columns or 'start_time_ns' in columns:
-    start = map(LIGOTimeGPS, st)
-    attr_map['start_time'], attr_map['start_time_ns'] =\
-        zip(*[(s.seconds, s.nanoseconds) for s in start])
+    attr_map['start_time'], attr_map['start_time_ns'] = _split_gps(st)
   if 'stop_time' in columns or 'stop_time_ns' in columns:
-    stop = map(LIGOTimeGPS, stop)
-    attr_map['stop_time'], attr_map['stop_time_ns'] =\
-        zip(*[(s.seconds, s.nanoseconds) for s in stop])
+    attr_map['stop_time'], attr_map['stop_time_ns'] = _split_gps(stop)
   if 'peak_time' in columns or 'peak_time_ns' in columns:
-    peak = map(LIGOTimeGPS, peak)
-    attr_map['peak_time'], attr_map['peak_time_ns'] =\
-        zip(*[(s.seconds, s.nanoseconds) for s in peak])
+    attr_map['peak_time'], attr_map['peak_time_ns'] = _split_gps(peak)
 
   if 'ms_start_time' in columns or 'ms_start_time_ns' in columns:
-    ms_start = map(LIGOTimeGPS, st)
-    attr_map['ms_start_time'], attr_map['ms_start_time_ns'] =\
-        zip(*[(s.seconds, s.nanoseconds) for s in ms_start])
+    attr_map['ms_start_time'], attr_map['ms_start_time_ns'] = _split_gps(st)
   if 'ms_stop_time' in columns or 'ms_stop_time_ns' in columns:
-    ms_stop = map(LIGOTimeGPS, stop)
-    attr_map['ms_stop_time'], attr_map['ms_stop_time_ns'] =\
-        zip(*[(s.seconds, s.nanoseconds) for s in ms_stop])
+    attr_map['ms_stop_time'], attr_map['ms_stop_time_ns'] = _split_gps(stop)
 
   if 'central_freq' in columns:   attr_map['central_freq']   = freq
   if 'peak_frequency' in columns: attr_map['peak_frequency'] = freq
@@ -1843,19 +2066,11 @@ def fromkwfile(fname, start=None, end=None, ifo=None, channel=None,\
     attr_map['param_two_value'] = sig
   """
 
-  cols   = attr_map.keys()
-  append = out.append
-  for i in range(numtrigs):
-    t = lsctables.SnglBurst()
-    for c in cols: setattr(t, c, attr_map[c][i])
-    if ifo!=None:
-      t.ifo = ifo
-    if channel!=None:
-      t.channel = channel
-    if not check_time or (check_time and t.get_peak() in span):
-      append(t)
-  
-  return out
+  if asarrays:
+    return attr_map
+
+  return _table_from_columns(out, lsctables.SnglBurst, attr_map, numtrigs,\
+                             ifo=ifo, channel=channel)
 
 def fromomegaspectrumfile(fname, start=None, end=None, ifo=None, channel=None,\
                           columns=None):
@@ -2090,7 +2305,7 @@ def fromomegadqfile(fname, start=None, end=None, ifo=None, channel=None,\
   return out
 
 def fromhacrfile(fname, start=None, end=None, ifo=None, channel=None,\
-                 columns=None):
+                 columns=None, use_mmap=False, asarrays=False):
 
   """
     Load triggers from a HACR format text file into a SnglBurstTable object.
@@ -2103,7 +2318,7 @@ def fromhacrfile(fname, start=None, end=None, ifo=None, channel=None,\
     Arguments :
 
       fname : file or str
-        file object or filename path to read with numpy.loadtext
+        file object or filename path to read with loadcolumns
 
     Keyword arguments :
 
@@ -2117,6 +2332,10 @@ def fromhacrfile(fname, start=None, end=None, ifo=None, channel=None,\
         name of channel to fill in table
       columns : iterable
         list of columnnames to populate in table
+      use_mmap : bool
+        read the file through mmap
+      asarrays : bool
+        return a dict of column arrays rather than building table rows
   """
 
   # set columns
@@ -2126,12 +2345,10 @@ def fromhacrfile(fname, start=None, end=None, ifo=None, channel=None,\
       start = 0
     if not end:
       end   = numpy.inf
-    span = segments.segment(start, end)
     if 'peak_time' not in columns: columns.append('peak_time')
     if 'peak_time_ns' not in columns: columns.append('peak_time_ns')
-    check_time = True
   else:
-    check_time = False
+    start = end = None
 
   # generate table
   out = SnglTriggerTable('hacr', columns=columns)
@@ -2142,18 +2359,16 @@ def fromhacrfile(fname, start=None, end=None, ifo=None, channel=None,\
   else:
     fh = open(fname, 'r')
       
-  # load data from file
-  dat = loadtxt(fh)
+  # load data from file, filtering on peak time plus offset
+  dat = loadcolumns(fh, timecolumn=lambda d: d[:,0]+d[:,1], start=start,\
+                    end=end, use_mmap=use_mmap)
 
   # close file if we opened it
   if not hasattr(fname, 'readline'):
     fh.close()
 
-  if numpy.shape(dat) == (0,):
-    return out
-  elif numpy.shape(dat) == (8,):
-    peak_time, peak_time_offset, freq, bandwidth, duration, n_pix, snr,\
-    totPower = map(lambda n: numpy.asarray([n]), dat)
+  if dat.size == 0:
+    return asarrays and dict() or out
   elif len(dat)==8:
     peak_time, peak_time_offset, freq, bandwidth, duration, n_pix, snr,\
     totPower = dat
@@ -2163,43 +2378,24 @@ def fromhacrfile(fname, start=None, end=None, ifo=None, channel=None,\
 
   numtrigs = len(peak_time)
 
-  if columns==None: columns = lsctables.SnglBurst.__slots__   
-  if start or end:
-    if not start:
-      start = 0
-    if not end:
-      end   = numpy.inf
-    span = segments.segment(start, end)
-    if 'peak_time' not in columns: columns.append('peak_time')
-    if 'peak_time_ns' not in columns: columns.append('peak_time_ns')
-    check_time = True
-  else:
-    check_time = False
-
   attr_map = dict()
 
   peak = peak_time+peak_time_offset
   if 'start_time' in columns or 'start_time_ns' in columns:
-    start = map(LIGOTimeGPS, peak-duration/2)
     attr_map['start_time'], attr_map['start_time_ns'] =\
-        zip(*[(s.seconds, s.nanoseconds) for s in start])
+        _split_gps(peak-duration/2)
   if 'stop_time' in columns or 'stop_time_ns' in columns:
-    stop = map(LIGOTimeGPS, peak+duration/2)
     attr_map['stop_time'], attr_map['stop_time_ns'] =\
-        zip(*[(s.seconds, s.nanoseconds) for s in stop])
+        _split_gps(peak+duration/2)
   if 'peak_time' in columns or 'peak_time_ns' in columns:
-    peak = map(LIGOTimeGPS, peak)
-    attr_map['peak_time'], attr_map['peak_time_ns'] =\
-        zip(*[(s.seconds, s.nanoseconds) for s in peak])
+    attr_map['peak_time'], attr_map['peak_time_ns'] = _split_gps(peak)
 
   if 'ms_start_time' in columns or 'ms_start_time_ns' in columns:
-    ms_start = map(LIGOTimeGPS, peak-duration/2)
     attr_map['ms_start_time'], attr_map['ms_start_time_ns'] =\
-        zip(*[(s.seconds, s.nanoseconds) for s in ms_start])
+        _split_gps(peak-duration/2)
   if 'ms_stop_time' in columns or 'ms_stop_time_ns' in columns:
-    ms_stop = map(LIGOTimeGPS, peak+duration/2)
     attr_map['ms_stop_time'], attr_map['ms_stop_time_ns'] =\
-        zip(*[(s.seconds, s.nanoseconds) for s in ms_stop])
+        _split_gps(peak+duration/2)
 
   if 'duration' in columns:       attr_map['duration']       = duration
   if 'ms_duration' in columns:    attr_map['ms_duration']    = duration
@@ -2228,22 +2424,14 @@ def fromhacrfile(fname, start=None, end=None, ifo=None, channel=None,\
     attr_map['param_three_name'] = ['totPower'] * numtrigs
     attr_map['param_three_value'] = totPower
 
-  cols   = attr_map.keys()
-  append = out.append
-  for i in range(numtrigs):
-    t = lsctables.SnglBurst()
-    for c in cols: setattr(t, c, attr_map[c][i])
-    if ifo!=None:
-      t.ifo = ifo
-    if channel!=None:
-      t.channel = channel
-    if not check_time or (check_time and t.get_peak() in span):
-      append(t)
-  
-  return out
+  if asarrays:
+    return attr_map
+
+  return _table_from_columns(out, lsctables.SnglBurst, attr_map, numtrigs,\
+                             ifo=ifo, channel=channel)
 
 def fromihopefile(fname, start=None, end=None, ifo=None, channel=None,\
-                  columns=None):
+                  columns=None, use_mmap=False, asarrays=False):
 
   """
     Load triggers from an iHope format CSV file into a SnglInspiralTable object.
@@ -2256,7 +2444,7 @@ def fromihopefile(fname, start=None, end=None, ifo=None, channel=None,\
     Arguments :
 
       fname : file or str
-        file object or filename path to read with numpy.loadtext
+        file object or filename path to read with loadcolumns
 
     Keyword arguments :
 
@@ -2270,6 +2458,10 @@ def fromihopefile(fname, start=None, end=None, ifo=None, channel=None,\
         name of channel to fill in table
       columns : iterable
         list of columnnames to populate in table
+      use_mmap : bool
+        read the file through mmap
+      asarrays : bool
+        return a dict of column arrays rather than building table rows
   """
 
   # get columns
@@ -2285,14 +2477,14 @@ def fromihopefile(fname, start=None, end=None, ifo=None, channel=None,\
       start = 0
     if not end:
       end   = numpy.inf
-    span = segments.segment(start, end)
     if 'end_time' not in columns: columns.append('end_time')
     if 'end_time_ns' not in columns: columns.append('end_time_ns')
-    check_time = True
   else:
-    check_time = False
+    start = end = None
 
-  usecols = [t for t in def_cols if def_cols[t] in columns]
+  # the ifo column is text, it is filled from the ifo argument instead
+  usecols = [t for t in def_cols if def_cols[t] in columns\
+             and def_cols[t] != 'ifo']
   
   # force filename not file object
   if hasattr(fname, 'readline'):
@@ -2300,37 +2492,35 @@ def fromihopefile(fname, start=None, end=None, ifo=None, channel=None,\
   else:
     fh = open(fname, 'r')
 
-  # load data from file
-  dat = loadtxt(fh, usecols)
+  # load data from file, end_time and end_time_ns lead usecols when filtering
+  dat = loadcolumns(fh, usecols=usecols,\
+                    timecolumn=lambda d: d[:,0]+d[:,1]*1e-9, start=start,\
+                    end=end, use_mmap=use_mmap)
 
   # close file if we opened it
-  if not hasattr(fname, 'readlin'):
+  if not hasattr(fname, 'readline'):
     fh.close()
 
-  if usecols:
-    numtrigs = len(dat[0])
+  if usecols and dat.size:
+    numtrigs = dat.shape[1]
   else:
     numtrigs = 0
 
+  attr_map = dict()
+  for c,j in enumerate(usecols[:len(dat)]):
+    if re.search('time', def_cols[j]):
+      attr_map[def_cols[j]] = dat[c].astype(int)
+    else:
+      attr_map[def_cols[j]] = dat[c]
+
+  if asarrays:
+    return attr_map
+
   # generate table
   out = SnglTriggerTable('ihope', columns=columns)
 
-  cols   = numpy.arange(len(dat))
-  append = out.append
-  for i in range(numtrigs):
-    t = lsctables.SnglInspiral()
-    for c in cols:
-      setattr(t, def_cols[usecols[c]],\
-              int(data[c][i]) if re.search('time', def_cols[usecols[c]])\
-              else data[c][i])
-    if ifo!=None:
-      t.ifo = ifo
-    if channel!=None:
-      t.channel = channel
-    if not check_time or (check_time and t.get_peak() in span):
-      append(t)
-  
-  return out
+  return _table_from_columns(out, lsctables.SnglInspiral, attr_map, numtrigs,\
+                             ifo=ifo, channel=channel)
 
 # ==============================================================================
 # Time shift trigger table
@@ -2367,20 +2557,263 @@ def loadtxt(fh, usecols=None):
     Stripped down version of numpy.loadtxt to work with empty files.
   """
 
-  _comment = re.compile('[#%]')
-  _delim   = re.compile('[\t\,\s]+')
+  dat = loadcolumns(fh, usecols=usecols)
+  if dat.size == 0:
+    return numpy.array([], float)
+  return numpy.squeeze(dat)
+
+# size of each block of text handed to the numpy tokenizer
+_chunksize = 1 << 22
+_comment = re.compile('[#%]')
+_commas  = string.maketrans(',', ' ')
+
+def _iter_blocks(fh, use_mmap=False, chunksize=_chunksize):
+
+  """
+    Yield blocks of whole lines of text from the file object fh, each of
+    roughly chunksize bytes, optionally reading through an mmap of the
+    underlying file.
+  """
+
+  # arbitrary iterables of lines are handed back in one block
+  if not hasattr(fh, 'read'):
+    yield ''.join(fh)
+    return
+
+  buf = None
+  if use_mmap and hasattr(fh, 'fileno'):
+    try:
+      buf = mmap.mmap(fh.fileno(), 0, access=mmap.ACCESS_READ)
+    except (ValueError, EnvironmentError):
+      # empty files and pipes cannot be mapped
+      buf = None
+
+  if buf is not None:
+    try:
+      pos = 0
+      size = len(buf)
+      while pos < size:
+        stop = buf.find('\n', min(pos+chunksize, size)-1)
+        stop = stop < 0 and size or stop+1
+        yield buf[pos:stop]
+        pos = stop
+    finally:
+      buf.close()
+    return
+
+  tail = ''
+  while True:
+    block = fh.read(chunksize)
+    if not block:
+      break
+    block = tail + block
+    cut = block.rfind('\n') + 1
+    if cut == 0:
+      tail = block
+      continue
+    tail = block[cut:]
+    yield block[:cut]
+  if tail:
+    yield tail
+
+_patterns = {}
+
+def _field_pattern(j):
+
+  """
+    Return a regular expression matching the start of a line up to and
+    including its j-th (zero-based) whitespace separated field, with the
+    fields before it captured as group 1.
+  """
+
+  key = ('field', j)
+  if key not in _patterns:
+    _patterns[key] = re.compile(r'^([ \t]*(?:\S+[ \t]+){%d})\S+[ \t]*' % j,\
+                                re.M)
+  return _patterns[key]
+
+def _row_pattern(width):
+
+  """
+    Return a regular expression matching a whole line of exactly width
+    whitespace separated fields.
+  """
+
+  key = ('row', width)
+  if key not in _patterns:
+    _patterns[key] = re.compile(r'^[ \t]*\S+(?:[ \t]+\S+){%d}[ \t\r]*$'\
+                                % (width-1), re.M)
+  return _patterns[key]
+
+def _text_columns(text):
+
+  """
+    Return the set of indices of the fields of the first line of text that
+    are not numbers.
+  """
+
+  textcols = set()
+  for j,val in enumerate(text.split('\n', 1)[0].split()):
+    try:
+      float(val)
+    except ValueError:
+      textcols.add(j)
+  return textcols
+
+def _parse_block(text, ncols, usecols=None, name=None):
+
+  """
+    Parse a block of delimited numeric text into a 2-D float array, returning
+    (array, ncols). The whole block is handed to numpy's compiled string
+    tokenizer, with any text columns (not in usecols) cut out of each line;
+    blocks containing comments, blank lines or rows with the wrong number of
+    columns fall back to line-by-line parsing, skipping bad rows as loadtxt
+    always has.
+  """
+
+  text = text.translate(_commas)
+
+  if ncols is None:
+    for line in text.split('\n'):
+      if line.strip() and not _comment.match(line):
+        ncols = len(line.split())
+        break
+    else:
+      return None, ncols
+
+  if '#' not in text and '%' not in text:
+    # text columns (e.g. the ifo column of ihope files) would stop the
+    # tokenizer, so cut them out of every line first
+    textcols = _text_columns(text)
+    if usecols is None or not textcols.intersection(usecols):
+      numeric = text
+      for j in sorted(textcols, reverse=True):
+        numeric = _field_pattern(j).sub(r'\1', numeric)
+      width = ncols - len(textcols)
+      nlines = numeric.count('\n') + (not numeric.endswith('\n'))
+      # every line must hold exactly width fields, otherwise a short row
+      # next to a long one would be reshaped out of alignment
+      if len(_row_pattern(width).findall(numeric)) == nlines:
+        vals = numpy.fromstring(numeric, dtype=float, sep=' ')
+        if vals.size == nlines*width:
+          vals = vals.reshape((nlines, width))
+          if usecols is not None:
+            vals = vals[:,[j - len([k for k in textcols if k < j])\
+                           for j in usecols]]
+          return vals, ncols
+
+  # slow path
   output = []
-  nVals = 0
-  for i,line in enumerate(fh):
-    if _comment.match(line): continue
-    vals = _delim.split(line.rstrip())
-    if nVals>0 and len(vals) != nVals: 
-      print "Warning, line %d of file %s was skipped, uncorrect column number" % (i, fh)
+  for i,line in enumerate(text.split('\n')):
+    if not line.strip() or _comment.match(line): continue
+    vals = line.split()
+    if len(vals) != ncols:
+      print "Warning, line %d of file %s was skipped, uncorrect column number" % (i, name)
       continue
-    nVals = len(vals)
     if usecols is not None:
       output.append(tuple(map(float, [vals[j] for j in usecols])))
     else:
       output.append(tuple(map(float, vals)))
-  return numpy.squeeze(numpy.array(output, float)).T
+  width = usecols is not None and len(usecols) or ncols
+  return numpy.array(output, float).reshape((len(output), width)), ncols
+
+def loadcolumns(fh, usecols=None, timecolumn=None, start=None, end=None,\
+                use_mmap=False, chunksize=_chunksize):
+
+  """
+    Read delimited numeric trigger text from the file object fh into a 2-D
+    array of shape (ncolumns, ntriggers), streaming the file in blocks
+    through numpy's compiled tokenizer. Lines starting with '#' or '%' are
+    skipped, and columns may be separated by any mix of whitespace and commas.
+
+    If start or end is given, rows whose time lies outside [start, end) are
+    dropped block by block as the file is parsed, so they never reach the
+    output.
 
+    Arguments:
+
+      fh : file
+        file object (or iterable of lines) to read
+
+    Keyword arguments:
+
+      usecols : [ int ]
+        list of column indices to return
+      timecolumn : [ int | callable ]
+        index (after usecols) of the time column used for start/end
+        filtering, or a function taking a block of shape (nrows, ncols) and
+        returning its times
+      start : float
+        minimum time for returned rows
+      end : float
+        maximum time for returned rows
+      use_mmap : bool
+        read the file through mmap rather than buffered reads
+      chunksize : int
+        approximate number of bytes parsed per block
+  """
+
+  check_time = (start is not None or end is not None) and timecolumn is not None
+  if check_time:
+    if start is None: start = -numpy.inf
+    if end is None: end = numpy.inf
+    if callable(timecolumn):
+      get_time = timecolumn
+    else:
+      get_time = lambda d: d[:,timecolumn]
+
+  name = getattr(fh, 'name', fh)
+  ncols = None
+  out = []
+  for block in _iter_blocks(fh, use_mmap=use_mmap, chunksize=chunksize):
+    dat, ncols = _parse_block(block, ncols, usecols=usecols, name=name)
+    if dat is None or not len(dat):
+      continue
+    if check_time:
+      t = get_time(dat)
+      dat = dat[(t >= start) & (t < end)]
+    out.append(dat)
+
+  if ncols is None:
+    return numpy.empty((0,0))
+  if not out:
+    width = usecols is not None and len(usecols) or ncols
+    return numpy.empty((width,0))
+  return numpy.concatenate(out).T
+
+def _split_gps(times):
+
+  """
+    Split an array of float GPS times into integer seconds and nanoseconds
+    arrays, rounding to the nearest nanosecond as LIGOTimeGPS does.
+  """
+
+  times = numpy.asarray(times, dtype=float)
+  sec = numpy.floor(times)
+  ns = numpy.rint((times - sec) * 1e9)
+  carry = ns >= 1e9
+  sec[carry] += 1
+  ns[carry] -= 1e9
+  return sec.astype(int), ns.astype(int)
+
+def _table_from_columns(out, rowtype, attr_map, numtrigs, ifo=None,\
+                        channel=None):
+
+  """
+    Append numtrigs rows of type rowtype to the table out, filling each
+    attribute from the arrays in attr_map.
+  """
+
+  cols = attr_map.keys()
+  vals = [numpy.asarray(attr_map[c]).tolist() for c in cols]
+  append = out.append
+  for i in xrange(numtrigs):
+    t = rowtype()
+    for c,v in zip(cols, vals): setattr(t, c, v[i])
+    if ifo!=None:
+      t.ifo = ifo
+    if channel!=None:
+      t.channel = channel
+    append(t)
+
+  return out
@@ -14,13 +14,17 @@
 # with this program; if not, write to the Free Software Foundation, Inc.,
 # 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
+import itertools
+import multiprocessing
 import sys
+from glue.ligolw import ilwd
 from glue.ligolw import lsctables
 from glue.ligolw import dbtables
 from glue import segments
 from glue import segmentsUtils
 from glue.ligolw import table
 from pylal import rate
+from pylal import segmentindex
 import numpy
 import math
 import copy
@@ -55,10 +59,24 @@ def time_within_segments(geocent_end_time, geocent_end_time_ns, zero_lag_segment
 	"""
 	if zero_lag_segments is None:
 		return True
+	elif isinstance(zero_lag_segments, segmentindex.SegmentIndex):
+		return zero_lag_segments.contains_time(geocent_end_time, geocent_end_time_ns)
 	else:
 		return lsctables.LIGOTimeGPS(geocent_end_time, geocent_end_time_ns) in zero_lag_segments
 
 
+def times_within_segments(geocent_end_times, geocent_end_times_ns, zero_lag_segments = None):
+	"""
+	Vectorized time_within_segments: return a boolean array that is True
+	for the injections made in the given segmentlist or SegmentIndex.
+	"""
+	if zero_lag_segments is None:
+		return numpy.ones(len(geocent_end_times), dtype = bool)
+	if not isinstance(zero_lag_segments, segmentindex.SegmentIndex):
+		zero_lag_segments = segmentindex.SegmentIndex.from_segmentlist(zero_lag_segments)
+	return zero_lag_segments.contains(geocent_end_times, geocent_end_times_ns)
+
+
 def get_min_far_inspiral_injections(connection, segments = None, table_name = "coinc_inspiral"):
 	"""
 	This function returns the found injections from a database and the
@@ -79,6 +97,10 @@ def get_min_far_inspiral_injections(connection, segments = None, table_name = "c
 	else:
 		raise ValueError("table must be in " + " ".join(allowed_analysis_table_names()))
 
+	# index the segments once rather than building a LIGOTimeGPS per row
+	if segments is not None and not isinstance(segments, segmentindex.SegmentIndex):
+		segments = segmentindex.SegmentIndex.from_segmentlist(segments)
+
 	def injection_was_made(end_time, end_time_ns, segments = segments):
 		return time_within_segments(end_time, end_time_ns, segments)
 
@@ -133,6 +155,10 @@ def get_max_snr_inspiral_injections(connection, segments = None, table_name = "c
 		raise ValueError("table must be in " + " ".join(allowed_analysis_table_names()))
 
 
+	# index the segments once rather than building a LIGOTimeGPS per row
+	if segments is not None and not isinstance(segments, segmentindex.SegmentIndex):
+		segments = segmentindex.SegmentIndex.from_segmentlist(segments)
+
 	def injection_was_made(end_time, end_time_ns, segments = segments):
 		return time_within_segments(end_time, end_time_ns, segments)
 
@@ -229,6 +255,9 @@ def get_event_fars(connection, table_name, segments = None):
 	return the false alarm rate of the most rare zero-lag coinc by instruments
 	"""
 
+	if segments is not None and not isinstance(segments, segmentindex.SegmentIndex):
+		segments = segmentindex.SegmentIndex.from_segmentlist(segments)
+
 	def event_in_requested_segments(end_time, end_time_ns, segments = segments):
 		return time_within_segments(end_time, end_time_ns, segments)
 
@@ -251,20 +280,73 @@ def get_event_fars(connection, table_name, segments = None):
 		yield (inst, far, ts)
 
 
-def compute_search_efficiency_in_bins(found, total, ndbins, sim_to_bins_function = lambda sim: (sim.distance,)):
+def bins_to_indices(bins, values):
+	"""
+	Vectorized bins[x]: convert an array of co-ordinates to an array of
+	bin indices for a 1-dimensional rate.Bins instance.  Linear,
+	logarithmic and irregular bins are handled with array arithmetic;
+	other binnings fall back to looking up each value.  As with
+	bins[x], IndexError is raised for values outside the bins.
+	"""
+	values = numpy.asarray(values, dtype = "double")
+	if isinstance(bins, rate.LinearBins):
+		idx = numpy.floor((values - bins.min) / bins.delta)
+	elif isinstance(bins, rate.LogarithmicBins):
+		with numpy.errstate(divide = "ignore", invalid = "ignore"):
+			idx = numpy.floor((numpy.log(values) - math.log(bins.min)) / bins.delta)
+	elif isinstance(bins, rate.IrregularBins):
+		idx = numpy.searchsorted(bins.boundaries, values, side = "right") - 1
+	else:
+		return numpy.array([bins[x] for x in values], dtype = "intp")
+	out_of_range = ~((bins.min <= values) & (values <= bins.max))
+	if out_of_range.any():
+		raise IndexError(values[out_of_range][0])
+	# special "measure zero" corner case
+	idx[values == bins.max] = len(bins) - 1
+	# guard against round-off at the upper boundary
+	return numpy.clip(idx, 0, len(bins) - 1).astype("intp")
+
+
+def sims_to_coords(sims, sim_to_bins_function):
+	"""
+	Evaluate sim_to_bins_function for each sim and return the results as
+	an (N, ndim) array.  If sims is already an array it is assumed to hold
+	the co-ordinates and is returned unchanged.
+	"""
+	if isinstance(sims, numpy.ndarray):
+		return sims
+	return numpy.array([sim_to_bins_function(sim) for sim in sims], dtype = "double")
+
+
+def coords_to_flat_indices(ndbins, coords):
+	"""
+	Convert an (N, ndim) array of co-ordinates to the flat indices of the
+	corresponding bins in an array of shape ndbins.shape.
+	"""
+	coords = numpy.asarray(coords, dtype = "double").reshape(-1, len(ndbins))
+	return numpy.ravel_multi_index(tuple(bins_to_indices(bins, coords[:,i]) for i, bins in enumerate(ndbins)), ndbins.shape)
+
+
+def compute_search_efficiency_in_bins(found, total, ndbins, sim_to_bins_function = lambda sim: (sim.distance,), found_weights = None, total_weights = None):
 	"""
 	This program creates the search efficiency in the provided ndbins.  The
 	first dimension of ndbins must be the distance.  You also must provide a
 	function that maps a sim inspiral row to the correct tuple to index the ndbins.
+
+	found and total may also be given as (N, ndim) arrays of co-ordinates
+	(see sims_to_coords), in which case sim_to_bins_function is not used.
+	The optional weight arrays give the weight of each found and total
+	injection, e.g. for bootstrap resampling.
 	"""
 
 	input = rate.BinnedRatios(ndbins)
+	size = input.numerator.array.size
 
-	# increment the numerator with the missed injections
-	[input.incnumerator(sim_to_bins_function(sim)) for sim in found]
-
-	# increment the denominator with the total injections
-	[input.incdenominator(sim_to_bins_function(sim)) for sim in total]
+	# bin the found and total injections in one pass each
+	found_idx = coords_to_flat_indices(ndbins, sims_to_coords(found, sim_to_bins_function))
+	total_idx = coords_to_flat_indices(ndbins, sims_to_coords(total, sim_to_bins_function))
+	input.numerator.array += numpy.bincount(found_idx, weights = found_weights, minlength = size).reshape(ndbins.shape)
+	input.denominator.array += numpy.bincount(total_idx, weights = total_weights, minlength = size).reshape(ndbins.shape)
 
 	# regularize by setting denoms to 1 to avoid nans
 	input.regularize()
@@ -272,22 +354,23 @@ def compute_search_efficiency_in_bins(found, total, ndbins, sim_to_bins_function
 	# pull out the efficiency array, it is the ratio
 	eff = rate.BinnedArray(rate.NDBins(ndbins), array = input.ratio())
 
-        # compute binomial uncertainties in each bin
-        err_arr = numpy.sqrt(eff.array * (1-eff.array)/input.denominator.array)
+	# compute binomial uncertainties in each bin
+	err_arr = numpy.sqrt(eff.array * (1-eff.array)/input.denominator.array)
 	err = rate.BinnedArray(rate.NDBins(ndbins), array = err_arr)
 
 	return eff, err
 
 
-def compute_search_volume_in_bins(found, total, ndbins, sim_to_bins_function):
+def compute_search_volume_in_bins(found, total, ndbins, sim_to_bins_function, found_weights = None, total_weights = None):
 	"""
 	This program creates the search volume in the provided ndbins.  The
 	first dimension of ndbins must be the distance over which to integrate.  You
 	also must provide a function that maps a sim inspiral row to the correct tuple
-	to index the ndbins.
+	to index the ndbins.  See compute_search_efficiency_in_bins for the
+	other accepted arguments.
 	"""
 
-	eff, err = compute_search_efficiency_in_bins(found, total, ndbins, sim_to_bins_function)
+	eff, err = compute_search_efficiency_in_bins(found, total, ndbins, sim_to_bins_function, found_weights = found_weights, total_weights = total_weights)
 	dx = ndbins[0].upper() - ndbins[0].lower()
 	r = ndbins[0].centres()
 
@@ -304,12 +387,37 @@ def compute_search_volume_in_bins(found, total, ndbins, sim_to_bins_function):
 	return vol, errors
 
 
+def bootstrap_search_volume_in_bins(found, total, ndbins, sim_to_bins_function, nsamples = 100, random_state = None):
+	"""
+	Estimate the search volume in the provided ndbins by resampling the
+	injections nsamples times.  found must be a subset of total; the two
+	are matched by simulation_id.  Each injection is given a Poisson(1)
+	weight per sample, which is equivalent to resampling with replacement
+	for large injection sets and lets each sample be binned with bincount
+	instead of rebuilding the sims.  Returns an array of shape
+	(nsamples,) + ndbins.shape[1:].
+	"""
+	random_state = random_state or numpy.random
+	position = dict((sim.simulation_id, i) for i, sim in enumerate(total))
+	found_in_total = numpy.array([position[sim.simulation_id] for sim in found], dtype = "intp")
+	total = sims_to_coords(total, sim_to_bins_function)
+	found = total[found_in_total]
+
+	vols = []
+	for i in range(nsamples):
+		weights = random_state.poisson(1., len(total)).astype("double")
+		vol, errors = compute_search_volume_in_bins(found, total, ndbins, sim_to_bins_function, found_weights = weights[found_in_total], total_weights = weights)
+		vols.append(vol.array)
+	return numpy.array(vols)
+
+
 def guess_nd_bins(sims, bin_dict = {"distance": (200, rate.LinearBins)}):
 	"""
 	Given a dictionary of bin counts and bin objects keyed by sim
 	attribute, come up with a sensible NDBins scheme
 	"""
-	return rate.NDBins([bintup[1](min([getattr(sim, attr) for sim in sims]), max([getattr(sim, attr) for sim in sims]) + sys.float_info.min, bintup[0]) for attr, bintup in bin_dict.items()])
+	columns = dict((attr, numpy.fromiter((getattr(sim, attr) for sim in sims), dtype = "double")) for attr in bin_dict)
+	return rate.NDBins([bintup[1](columns[attr].min(), columns[attr].max() + sys.float_info.min, bintup[0]) for attr, bintup in bin_dict.items()])
 
 
 def guess_distance_mass1_mass2_bins_from_sims(sims, mass1bins = 11, mass2bins = 11, distbins = 200):
@@ -470,12 +578,116 @@ def symmetrize_sims(sims, col1, col2):
 			setattr(sim, col2, c1)
 	return sims
 
+# metadata tables needed by get_segments();  the analysis and simulation
+# tables are read directly with SQL so need not be reconstructed as XML
+SEGMENT_METADATA_TABLES = ("process", "process_params", "search_summary", "segment", "segment_definer", "segment_summary")
+
+# (name, type) of the sim_inspiral columns carried in a database summary
+SIM_INSPIRAL_COLUMNS = sorted(lsctables.SimInspiralTable.validcolumns.items())
+
+
+def sim_to_tuple(sim):
+	"""
+	Convert a sim_inspiral row to a tuple of plain python values, in the
+	order of SIM_INSPIRAL_COLUMNS, that can be cheaply pickled.
+	"""
+	values = []
+	for name, type in SIM_INSPIRAL_COLUMNS:
+		value = getattr(sim, name, None)
+		if value is not None and type == "ilwd:char":
+			value = str(value)
+		values.append(value)
+	return tuple(values)
+
+
+def sim_from_tuple(values):
+	"""
+	Inverse of sim_to_tuple().
+	"""
+	sim = lsctables.SimInspiral()
+	for (name, type), value in zip(SIM_INSPIRAL_COLUMNS, values):
+		if value is None:
+			continue
+		if type == "ilwd:char":
+			value = ilwd.ilwdchar(value)
+		setattr(sim, name, value)
+	return sim
+
+
+def summarize_database(filename, live_time_program = None, veto_segments_name = None, data_segments_name = "datasegments", tmp_path = None, verbose = False):
+	"""
+	Gather the information DataBaseSummary needs from one database and
+	return it as a dictionary of picklable objects, so that databases can
+	be summarized in worker processes.  Only the segment metadata tables
+	are reconstructed as an XML document.  Injections are returned as
+	tuples (see sim_to_tuple()).
+	"""
+	if verbose:
+		print >> sys.stderr, "Gathering stats from: %s...." % (filename,)
+	working_filename = dbtables.get_connection_filename(filename, tmp_path = tmp_path, verbose = verbose)
+	connection = sqlite3.connect(working_filename)
+	table_names = [name for (name,) in connection.cursor().execute('SELECT name FROM sqlite_master WHERE type == "table"')]
+	xmldoc = dbtables.get_xml(connection, table_names = [name for name in table_names if name in SEGMENT_METADATA_TABLES])
+
+	# look for the relevant table for analyses
+	analysis_tables = [name for name in allowed_analysis_table_names() if name in table_names]
+	if len(analysis_tables) > 1:
+		raise ValueError("detected more than one table type out of " + " ".join(allowed_analysis_table_names()))
+	summary = {
+		"filename": filename,
+		"table_name": analysis_tables and analysis_tables[0] or None,
+		# look for a sim inspiral table.  This is IMR work we have to have one of these :)
+		"sim": dbtables.lsctables.SimInspiralTable.tableName in table_names
+	}
+	table_name = summary["table_name"]
+
+	# the non simulation databases are where we get information about segments
+	if not summary["sim"]:
+		summary["numslides"] = connection.cursor().execute('SELECT count(DISTINCT(time_slide_id)) FROM time_slide').fetchone()[0]
+		summary["instruments"] = get_instruments_from_coinc_event_table(connection)
+		summary["segments"] = get_segments(connection, xmldoc, table_name, live_time_program, veto_segments_name, data_segments_name = data_segments_name)
+		summary["zerolag_fars"] = {}
+		summary["ts_fars"] = {}
+		# get the far thresholds for the loudest events in these databases
+		for (instruments_set, far, ts) in get_event_fars(connection, table_name):
+			summary[ts and "ts_fars" or "zerolag_fars"].setdefault(instruments_set, []).append(far)
+	# get the injections
+	else:
+		# We need to know the segments in this file to determine which injections are found
+		summary["injection_segments"] = get_segments(connection, xmldoc, table_name, live_time_program, veto_segments_name, data_segments_name = data_segments_name)
+		summary["injection_instruments"] = []
+		summary["injections"] = []
+		injection_segment_index = segmentindex.segmentindexdict(summary["injection_segments"])
+		distinct_instruments = connection.cursor().execute('SELECT DISTINCT(instruments) FROM coinc_event WHERE instruments!=""').fetchall()
+		for instruments, in distinct_instruments:
+			instruments_set = frozenset(lsctables.instrument_set_from_ifos(instruments))
+			summary["injection_instruments"].append(instruments_set)
+			segments_to_consider_for_these_injections = segmentindex.SegmentIndex.intersection_all(injection_segment_index[ifo] for ifo in instruments_set) - segmentindex.SegmentIndex.union_all(injection_segment_index[ifo] for ifo in set(injection_segment_index) - instruments_set)
+			found, total, missed = get_min_far_inspiral_injections(connection, segments = segments_to_consider_for_these_injections, table_name = table_name)
+			if verbose:
+				print >> sys.stderr, "%s total injections: %d; Found injections %d: Missed injections %d" % (instruments, len(total), len(found), len(missed))
+			summary["injections"].append((instruments_set, [(far, sim_to_tuple(sim)) for far, sim in found], map(sim_to_tuple, total), map(sim_to_tuple, missed)))
+
+	# All done
+	connection.close()
+	dbtables.discard_connection_filename(filename, working_filename, verbose = verbose)
+	return summary
+
+
+def _summarize_database(args):
+	# multiprocessing workers take a single argument
+	return summarize_database(*args)
+
+
 class DataBaseSummary(object):
 	"""
-	This class stores summary information gathered across the databases
+	This class stores summary information gathered across the databases.
+	With nproc > 1 the databases are summarized in that many worker
+	processes; the summaries are merged in the order of filelist, so the
+	result does not depend on nproc.
 	"""
 
-	def __init__(self, filelist, live_time_program = None, veto_segments_name = None, data_segments_name = "datasegments", tmp_path = None, verbose = False):
+	def __init__(self, filelist, live_time_program = None, veto_segments_name = None, data_segments_name = "datasegments", tmp_path = None, verbose = False, nproc = 1):
 
 		self.segments = segments.segmentlistdict()
 		self.instruments = set()
@@ -486,69 +698,22 @@ class DataBaseSummary(object):
 		self.zerolag_fars_by_instrument_set = {}
 		self.ts_fars_by_instrument_set = {}
 		self.numslides = set()
+		for table_name in allowed_analysis_table_names():
+			setattr(self, table_name, None)
+
+		args = [(f, live_time_program, veto_segments_name, data_segments_name, tmp_path, verbose) for f in filelist]
+		if nproc > 1:
+			pool = multiprocessing.Pool(nproc)
+			summaries = pool.imap(_summarize_database, args)
+		else:
+			pool = None
+			summaries = itertools.imap(_summarize_database, args)
+		for summary in summaries:
+			self.add_summary(summary)
+		if pool is not None:
+			pool.close()
+			pool.join()
 
-		for f in filelist:
-			if verbose:
-				print >> sys.stderr, "Gathering stats from: %s...." % (f,)
-			working_filename = dbtables.get_connection_filename(f, tmp_path = tmp_path, verbose = verbose)
-			connection = sqlite3.connect(working_filename)
-			xmldoc = dbtables.get_xml(connection)
-
-			sim = False
-
-			# look for a sim inspiral table.  This is IMR work we have to have one of these :)
-			try:
-				sim_inspiral_table = table.get_table(xmldoc, dbtables.lsctables.SimInspiralTable.tableName)
-				sim = True
-			except ValueError:
-				pass
-
-			# look for the relevant table for analyses
-			for table_name in allowed_analysis_table_names():
-				try:
-					setattr(self, table_name, table.get_table(xmldoc, table_name))
-					if self.table_name is None or self.table_name == table_name:
-						self.table_name = table_name
-					else:
-						raise ValueError("detected more than one table type out of " + " ".join(allowed_analysis_table_names()))
-				except ValueError:
-					setattr(self, table_name, None)
-
-			# the non simulation databases are where we get information about segments
-			if not sim:
-				self.numslides.add(connection.cursor().execute('SELECT count(DISTINCT(time_slide_id)) FROM time_slide').fetchone()[0])
-				[self.instruments.add(ifos) for ifos in get_instruments_from_coinc_event_table(connection)]
-				# save a reference to the segments for this file, needed to figure out the missed and found injections
-				self.this_segments = get_segments(connection, xmldoc, self.table_name, live_time_program, veto_segments_name, data_segments_name = data_segments_name)
-				# FIXME we don't really have any reason to use playground segments, but I put this here as a reminder
-				# self.this_playground_segments = segmentsUtils.S2playground(self.this_segments.extent_all())
-				self.segments += self.this_segments
-
-				# get the far thresholds for the loudest events in these databases
-				for (instruments_set, far, ts) in get_event_fars(connection, self.table_name):
-					if not ts:
-						self.zerolag_fars_by_instrument_set.setdefault(instruments_set, []).append(far)
-					else:
-						self.ts_fars_by_instrument_set.setdefault(instruments_set, []).append(far)
-			# get the injections
-			else:
-				# We need to know the segments in this file to determine which injections are found
-				self.this_injection_segments = get_segments(connection, xmldoc, self.table_name, live_time_program, veto_segments_name, data_segments_name = data_segments_name)
-				self.this_injection_instruments = []
-				distinct_instruments = connection.cursor().execute('SELECT DISTINCT(instruments) FROM coinc_event WHERE instruments!=""').fetchall()
-				for instruments, in distinct_instruments:
-					instruments_set = frozenset(lsctables.instrument_set_from_ifos(instruments))
-					self.this_injection_instruments.append(instruments_set)
-					segments_to_consider_for_these_injections = self.this_injection_segments.intersection(instruments_set) - self.this_injection_segments.union(set(self.this_injection_segments.keys()) - instruments_set)
-					found, total, missed = get_min_far_inspiral_injections(connection, segments = segments_to_consider_for_these_injections, table_name = self.table_name)
-					if verbose:
-						print >> sys.stderr, "%s total injections: %d; Found injections %d: Missed injections %d" % (instruments, len(total), len(found), len(missed))
-					self.found_injections_by_instrument_set.setdefault(instruments_set, []).extend(found)
-					self.total_injections_by_instrument_set.setdefault(instruments_set, []).extend(total)
-					self.missed_injections_by_instrument_set.setdefault(instruments_set, []).extend(missed)
-
-			# All done
-			dbtables.discard_connection_filename(f, working_filename, verbose = verbose)
 		if len(self.numslides) > 1:
 			raise ValueError('number of slides differs between input files')
 		elif self.numslides:
@@ -559,3 +724,33 @@ class DataBaseSummary(object):
 		# FIXME
 		# Things left to do
 		# 1) summarize the far threshold over the entire dataset
+
+	def add_summary(self, summary):
+		"""
+		Merge the output of summarize_database() for one database.
+		"""
+		if summary["table_name"] is not None:
+			if self.table_name is None or self.table_name == summary["table_name"]:
+				self.table_name = summary["table_name"]
+			else:
+				raise ValueError("detected more than one table type out of " + " ".join(allowed_analysis_table_names()))
+
+		if not summary["sim"]:
+			self.numslides.add(summary["numslides"])
+			self.instruments.update(summary["instruments"])
+			# save a reference to the segments for this file, needed to figure out the missed and found injections
+			self.this_segments = summary["segments"]
+			# FIXME we don't really have any reason to use playground segments, but I put this here as a reminder
+			# self.this_playground_segments = segmentsUtils.S2playground(self.this_segments.extent_all())
+			self.segments += self.this_segments
+			for instruments_set, fars in summary["zerolag_fars"].items():
+				self.zerolag_fars_by_instrument_set.setdefault(instruments_set, []).extend(fars)
+			for instruments_set, fars in summary["ts_fars"].items():
+				self.ts_fars_by_instrument_set.setdefault(instruments_set, []).extend(fars)
+		else:
+			self.this_injection_segments = summary["injection_segments"]
+			self.this_injection_instruments = summary["injection_instruments"]
+			for instruments_set, found, total, missed in summary["injections"]:
+				self.found_injections_by_instrument_set.setdefault(instruments_set, []).extend((far, sim_from_tuple(sim)) for far, sim in found)
+				self.total_injections_by_instrument_set.setdefault(instruments_set, []).extend(map(sim_from_tuple, total))
+				self.missed_injections_by_instrument_set.setdefault(instruments_set, []).extend(map(sim_from_tuple, missed))
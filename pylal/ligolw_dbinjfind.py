@@ -1,10 +1,14 @@
 import sys
+import math
+
+import numpy
 
 from glue.ligolw import lsctables
 from glue.ligolw import ilwd
 
 from pylal import ligolw_sqlutils as sqlutils
 from pylal import ligolw_dataUtils as dataUtils
+from pylal import tools
 
 def make_rec_sngls_table( connection, recovery_table ):
     """
@@ -27,7 +31,198 @@ def make_rec_sngls_table( connection, recovery_table ):
     connection.cursor().execute(sqlquery)
 
 
-def dbinjfind( connection, simulation_table, recovery_table, match_criteria, rough_match = None, rejection_criteria = [], rough_rejection = None, verbose = False ):
+#
+#   In-process sim -> trigger matching
+#
+
+def _fetch_columns( connection, sqlquery ):
+    """
+    Runs sqlquery and returns the column names and a list of numpy arrays,
+    one per column, holding the result.
+    """
+    cursor = connection.cursor()
+    cursor.execute( sqlquery )
+    names = [desc[0] for desc in cursor.description]
+    rows = cursor.fetchall()
+    if rows:
+        data = [numpy.array(col) for col in zip(*rows)]
+    else:
+        data = [numpy.array([]) for name in names]
+    return names, data
+
+def _criterion_values( criterion, names, data, RowClass ):
+    """
+    Evaluates a match criterion once per row, returning a float array. The
+    criterion is first evaluated on the column arrays with numpy; if that
+    fails (e.g., it calls a method of the row class) it is evaluated on one
+    DataRow per row.
+    """
+    nrows = len(data[0]) if data else 0
+    namespace = dict([ [name, getattr(numpy, name)] for name in dir(math) if not name.startswith('__') and hasattr(numpy, name) ])
+    namespace.update( zip(names, data) )
+    try:
+        vals = eval( criterion, {"__builtins__":None}, namespace )
+        return numpy.asarray(vals, dtype = float) * numpy.ones(nrows)
+    except Exception:
+        vals = numpy.empty(nrows)
+        for i, row in enumerate(zip(*data)):
+            thisRow = RowClass()
+            thisRow.store( zip(names, row) )
+            vals[i] = thisRow.get_value( criterion )
+        return vals
+
+def _window_pairs( simKey, recKey, window ):
+    """
+    Returns arrays of sim and rec indices of all pairs for which
+    abs(recKey - simKey) <= window. The rec keys are sorted once and each
+    sim's candidate range is found by binary search.
+    """
+    order = numpy.argsort( recKey, kind = 'mergesort' )
+    sortedKey = recKey[order]
+    lo = numpy.searchsorted( sortedKey, simKey - window, side = 'left' )
+    hi = numpy.searchsorted( sortedKey, simKey + window, side = 'right' )
+    counts = numpy.maximum( hi - lo, 0 )
+    simIdx = numpy.repeat( numpy.arange(len(simKey)), counts )
+    # position of each pair within its sim's range, offset to that range
+    offsets = numpy.repeat( lo - (numpy.cumsum(counts) - counts), counts )
+    recIdx = order[ numpy.arange(counts.sum()) + offsets ]
+    return simIdx, recIdx
+
+def match_injections( connection, simulation_table, match_criteria, rough_match = None, SimDataRow = None, RecDataRow = None, verbose = False, max_pairs = 10000000 ):
+    """
+    Finds sim -> rec_sngls matches without running the comparison as SQLite
+    functions on a join. The simulation table and rec_sngls are read into
+    column arrays once; candidate pairs are drawn per injection process from
+    a sorted rough-match key (or all pairs from the same process if no rough
+    match is given) and each match criterion is applied to all candidates at
+    once. The injections of a process are taken in chunks small enough that
+    at most max_pairs candidate pairs are held at a time. Returns arrays of
+    (simulation_id, event_id) for the matches.
+
+    @match_criteria: list of (simFunc, snglFunc, window) tuples, as for
+     dbinjfind
+    @rough_match: optional (simColumn, recColumn, window) tuple
+    @max_pairs: the most candidate pairs to hold at once
+    """
+    simNames, simData = _fetch_columns( connection, 'SELECT * FROM %s' % simulation_table )
+    recNames, recData = _fetch_columns( connection, 'SELECT * FROM rec_sngls' )
+    simCol = dict( zip(simNames, simData) )
+    recCol = dict( zip(recNames, recData) )
+    nsim = len(simCol['simulation_id']) if 'simulation_id' in simCol else 0
+    nrec = len(recCol['event_id']) if 'event_id' in recCol else 0
+    if nsim == 0 or nrec == 0:
+        return numpy.array([]), numpy.array([])
+
+    if verbose:
+        print >> sys.stdout, "\tloaded %i injections and %i eligible events" % (nsim, nrec)
+
+    # candidate pairs must come from the same injection job
+    procs, procCode = numpy.unique( numpy.concatenate([simCol['process_id'], recCol['sim_proc_id']]), return_inverse = True )
+    simProc = procCode[:nsim]
+    recProc = procCode[nsim:]
+
+    # the values of each criterion, computed once for all rows; the sim
+    # side of a time criterion depends on the event's site, so is kept per
+    # site
+    sites = numpy.array([ifo.lower()[0] if ifo else '' for ifo in recCol['ifo']]) if 'ifo' in recCol else None
+    criteria = []
+    for simFunc, snglFunc, window in match_criteria:
+        if simFunc == 'eThinca':
+            criteria.append( (simFunc, None, None, window) )
+            continue
+        if simFunc in ('startTime', 'endTime'):
+            stem = simFunc == 'startTime' and 'start_time' or 'end_time'
+            a = dict( (site, numpy.asarray(simCol['%s_%s' % (site, stem)], dtype = float) + 1e-9 * numpy.asarray(simCol['%s_%s_ns' % (site, stem)], dtype = float)) for site in numpy.unique(sites) if '%s_%s' % (site, stem) in simCol )
+        else:
+            a = _criterion_values( simFunc, simNames, simData, SimDataRow )
+        if snglFunc in ('startTime', 'endTime'):
+            stem = snglFunc == 'startTime' and 'start_time' or 'end_time'
+            b = numpy.asarray(recCol[stem], dtype = float) + 1e-9 * numpy.asarray(recCol['%s_ns' % stem], dtype = float)
+        else:
+            b = _criterion_values( snglFunc, recNames, recData, RecDataRow )
+        criteria.append( (simFunc, a, b, window) )
+
+    # rows converted for LAL, kept across chunks
+    simRows = {}
+    recRows = {}
+    def getRow( cache, i, RowClass, names, data, idcol ):
+        if i not in cache:
+            row = RowClass()
+            row.store( zip(names, [col[i] for col in data]) )
+            # lal expects the ids to be integers
+            setattr( row, idcol, 0 )
+            cache[i] = row
+        return cache[i]
+
+    def apply_criteria( simIdx, recIdx ):
+        for simFunc, a, b, window in criteria:
+            if not len(simIdx):
+                break
+            if simFunc == 'eThinca':
+                # one LAL call per candidate pair, on rows built once per
+                # event;  the pairs are passed sorted by injection so each
+                # sim row is converted for LAL only once
+                order = numpy.argsort( simIdx, kind = 'mergesort' )
+                ethinca = numpy.empty( len(simIdx) )
+                ethinca[order] = tools.XLALEThincaParameterForInjectionPairs( [getRow(simRows, s, SimDataRow, simNames, simData, 'simulation_id') for s in simIdx[order]], [getRow(recRows, r, RecDataRow, recNames, recData, 'event_id') for r in recIdx[order]] )
+                keep = ethinca <= window
+            else:
+                if isinstance(a, dict):
+                    pairSites = sites[recIdx]
+                    simVals = numpy.empty( len(simIdx) )
+                    for site in numpy.unique( pairSites ):
+                        thisSite = pairSites == site
+                        simVals[thisSite] = a[site][simIdx[thisSite]]
+                else:
+                    simVals = a[simIdx]
+                keep = numpy.abs( simVals - b[recIdx] ) <= window
+            simIdx = simIdx[keep]
+            recIdx = recIdx[keep]
+        return simIdx, recIdx
+
+    simIdx = []
+    recIdx = []
+    npairs = 0
+    for code in numpy.unique(simProc):
+        theseSims = numpy.nonzero( simProc == code )[0]
+        theseRecs = numpy.nonzero( recProc == code )[0]
+        if not len(theseRecs):
+            continue
+        # without a rough match every sim is paired with every rec, so
+        # take the sims in chunks to bound the number of pairs held
+        chunk = max( 1, max_pairs // len(theseRecs) )
+        for first in xrange(0, len(theseSims), chunk):
+            chunkSims = theseSims[first:first+chunk]
+            if rough_match is not None:
+                simRough, recRough, winRough = rough_match
+                s, r = _window_pairs( numpy.asarray(simCol[simRough], dtype = float)[chunkSims], numpy.asarray(recCol[recRough], dtype = float)[theseRecs], winRough )
+                s, r = chunkSims[s], theseRecs[r]
+            else:
+                s = numpy.repeat( chunkSims, len(theseRecs) )
+                r = numpy.tile( theseRecs, len(chunkSims) )
+            npairs += len(s)
+            s, r = apply_criteria( s, r )
+            simIdx.append( s )
+            recIdx.append( r )
+
+    if verbose:
+        print >> sys.stdout, "\t%i candidate pairs" % npairs
+
+    if not simIdx:
+        return numpy.array([]), numpy.array([])
+    simIdx = numpy.concatenate( simIdx )
+    recIdx = numpy.concatenate( recIdx )
+
+    return simCol['simulation_id'][simIdx], recCol['event_id'][recIdx]
+
+
+def dbinjfind( connection, simulation_table, recovery_table, match_criteria, rough_match = None, rejection_criteria = [], rough_rejection = None, verbose = False, in_process = False ):
+    """
+    Finds injections in the recovery table, storing the (sim_id, event_id)
+    maps in the temporary table found_inj. If in_process is True, the
+    sim-sngl matches are found by match_injections rather than by a join on
+    SQLite comparison functions.
+    """
 
     # validate simulation_table and recovery_table
     simulation_table = sqlutils.validate_option( simulation_table )
@@ -118,6 +313,16 @@ def dbinjfind( connection, simulation_table, recovery_table, match_criteria, rou
     
     if verbose:
         print >> sys.stdout, "Applying match criteria to find sim-sngl maps..."
+
+    if in_process:
+        if rough_match is not None:
+            rough_match = (simRough, recRough, winRough)
+        simIds, eventIds = match_injections( connection, simulation_table, match_criteria, rough_match = rough_match, SimDataRow = SimDataRow, RecDataRow = RecDataRow, verbose = verbose )
+        connection.cursor().execute( "CREATE TEMP TABLE found_inj (sim_id, event_id)" )
+        connection.cursor().executemany( "INSERT INTO found_inj (sim_id, event_id) VALUES (?, ?)", zip(simIds.tolist(), eventIds.tolist()) )
+        connection.commit()
+        return
+
     # cycle over the match criteria, creating a function in the database for each
     match_tests = []
     for n,(simFunc, snglFunc, window) in enumerate(match_criteria):
@@ -36,7 +36,7 @@ again using the standard coincidence infrastructure.
 """
 
 
-import bisect
+import numpy
 import sys
 
 
@@ -50,6 +50,7 @@ from glue.text_progress_bar import ProgressBar
 from pylal import git_version
 from pylal import ligolw_thinca
 from pylal import SimInspiralUtils
+from pylal import tools
 from pylal.xlal import tools as xlaltools
 from pylal.xlal.datatypes.ligotimegps import LIGOTimeGPS
 
@@ -218,22 +219,51 @@ class DocContents(object):
 			except KeyError:
 				pass
 		del index
-		# construct a sngl-->coincs look-up table
-		self.coincs = dict((event.event_id, set()) for events in self.sngls.values() for event in events)
-		for row in self.coincmaptable:
-			if row.event_id in self.coincs and row.coinc_event_id in self.sngls:
-				self.coincs[row.event_id].add(row.coinc_event_id)
 		# create a coinc_event_id to offset vector look-up table
 		self.coincoffsets = dict((row.coinc_event_id, self.offsetvectors[row.time_slide_id]) for row in self.coinctable if row.coinc_def_id == ii_coinc_def_id)
 
 		#
-		# sort sngl_inspiral table by end time, and sort the coincs
-		# list by the end time of the first (earliest) event in
-		# each coinc (recall that the event tuple for each coinc
-		# has been time-ordered)
+		# sort sngl_inspiral table by end time, and record the end
+		# times as an array of integer nanoseconds for window
+		# searches
+		#
+
+		self.snglinspiraltable.sort(key = lambda row: (row.end_time, row.end_time_ns))
+		self.end_times = numpy.fromiter((row.end_time * 1000000000 + row.end_time_ns for row in self.snglinspiraltable), dtype = "int64", count = len(self.snglinspiraltable))
+
+		#
+		# construct a sngl-->coincs look-up table in compressed
+		# sparse row form:  the coincs (indexes into
+		# self.coinc_event_ids) containing the sngl at position i
+		# in the time-ordered sngl_inspiral table are
+		# self.coinc_indices[self.coinc_indptr[i]:self.coinc_indptr[i+1]].
+		# because the sngls are time-ordered, the coincs of all
+		# sngls in a time window are a single contiguous slice.
 		#
 
-		self.snglinspiraltable.sort(lambda a, b: cmp(a.end_time, b.end_time) or cmp(a.end_time_ns, b.end_time_ns))
+		self.coinc_event_ids = sorted(self.sngls)
+		coinc_position = dict((coinc_event_id, n) for n, coinc_event_id in enumerate(self.coinc_event_ids))
+		event_position = dict((row.event_id, n) for n, row in enumerate(self.snglinspiraltable))
+		events, coincs = [], []
+		for coinc_event_id, sngls in self.sngls.items():
+			for event in sngls:
+				events.append(event_position[event.event_id])
+				coincs.append(coinc_position[coinc_event_id])
+		events = numpy.array(events, dtype = "intp")
+		order = numpy.argsort(events, kind = "mergesort")
+		self.coinc_indices = numpy.array(coincs, dtype = "intp")[order]
+		self.coinc_indptr = numpy.concatenate(([0], numpy.cumsum(numpy.bincount(events, minlength = len(self.snglinspiraltable)) if len(events) else numpy.zeros(len(self.snglinspiraltable), dtype = "intp")))).astype("intp")
+		# and the transpose:  the positions in the time-ordered
+		# sngl_inspiral table of the sngls taking part in coinc n
+		# are self.coinc_sngl_positions[self.coinc_sngl_indptr[n]:self.coinc_sngl_indptr[n+1]]
+		coincs = numpy.array(coincs, dtype = "intp")
+		order = numpy.argsort(coincs, kind = "mergesort")
+		self.coinc_sngl_positions = events[order]
+		self.coinc_sngl_indptr = numpy.concatenate(([0], numpy.cumsum(numpy.bincount(coincs, minlength = len(self.coinc_event_ids)) if len(coincs) else numpy.zeros(len(self.coinc_event_ids), dtype = "intp")))).astype("intp")
+		del coinc_position, event_position, events, coincs, order
+
+		# cache of sngl_inspiral columns as arrays, see sngl_column()
+		self._sngl_columns = {}
 
 		#
 		# set the window for inspirals_near_endtime().  this window
@@ -242,15 +272,81 @@ class DocContents(object):
 		# this it is *impossible* for them to match one another.
 		#
 
-                self.end_time_bisect_window = LIGOTimeGPS(end_time_bisect_window)
+		self.end_time_bisect_window = LIGOTimeGPS(end_time_bisect_window)
+		self.end_time_window_ns = self.end_time_bisect_window.seconds * 1000000000 + self.end_time_bisect_window.nanoseconds
 
 
+	def indexes_near_endtimes(self, times):
+		"""
+		Return the arrays (lo, hi) such that the inspiral events at
+		positions lo[i]:hi[i] of the time-ordered sngl_inspiral
+		table are those whose peak times are within
+		self.end_time_bisect_window of times[i], where times is an
+		array of integer GPS nanoseconds.
+		"""
+		times = numpy.asarray(times, dtype = "int64")
+		return numpy.searchsorted(self.end_times, times - self.end_time_window_ns, side = "left"), numpy.searchsorted(self.end_times, times + self.end_time_window_ns, side = "right")
+
+	def sim_indexes_near_endtime(self):
+		"""
+		Return the arrays (lo, hi) of indexes_near_endtimes() for
+		the end times of all sim_inspiral rows, in table order.
+		"""
+		times = numpy.fromiter((sim.geocent_end_time * 1000000000 + sim.geocent_end_time_ns for sim in self.siminspiraltable), dtype = "int64", count = len(self.siminspiraltable))
+		return self.indexes_near_endtimes(times)
+
 	def inspirals_near_endtime(self, t):
 		"""
 		Return a list of the inspiral events whose peak times are
 		within self.end_time_bisect_window of t.
 		"""
-		return self.snglinspiraltable[bisect.bisect_left(self.snglinspiraltable, t - self.end_time_bisect_window):bisect.bisect_right(self.snglinspiraltable, t + self.end_time_bisect_window)]
+		lo, hi = self.indexes_near_endtimes(t.seconds * 1000000000 + t.nanoseconds)
+		return self.snglinspiraltable[lo:hi]
+
+	def coincs_in_range(self, lo, hi):
+		"""
+		Return a list of the (coinc_event_id, event list) tuples in
+		which at least one of the inspiral events at positions
+		lo:hi of the time-ordered sngl_inspiral table takes part.
+		"""
+		return [(self.coinc_event_ids[n], self.sngls[self.coinc_event_ids[n]]) for n in numpy.unique(self.coinc_indices[self.coinc_indptr[lo]:self.coinc_indptr[hi]])]
+
+	def coinc_sngl_positions_in_range(self, lo, hi):
+		"""
+		Return the tuple (coinc_indexes, positions, indptr) for the
+		coincs in which at least one of the inspiral events at
+		positions lo:hi of the time-ordered sngl_inspiral table
+		takes part.  coinc_indexes are indexes into
+		self.coinc_event_ids, and the sngls of the coinc
+		coinc_indexes[i] are at positions[indptr[i]:indptr[i+1]] of
+		the time-ordered sngl_inspiral table.
+		"""
+		coinc_indexes = numpy.unique(self.coinc_indices[self.coinc_indptr[lo]:self.coinc_indptr[hi]])
+		starts = self.coinc_sngl_indptr[coinc_indexes]
+		counts = self.coinc_sngl_indptr[coinc_indexes + 1] - starts
+		indptr = numpy.concatenate(([0], numpy.cumsum(counts))).astype("intp")
+		# gather each coinc's run of positions
+		offsets = numpy.arange(indptr[-1], dtype = "intp") - numpy.repeat(indptr[:-1] - starts, counts)
+		return coinc_indexes, self.coinc_sngl_positions[offsets], indptr
+
+	def sngl_column(self, name):
+		"""
+		Return the named column of the time-ordered sngl_inspiral
+		table as an array.  The special name "site" gives the
+		one-letter site prefix of each trigger's instrument.
+		Arrays are computed once and cached, so the table must not
+		be re-ordered or modified while they are in use.
+		"""
+		try:
+			return self._sngl_columns[name]
+		except KeyError:
+			pass
+		if name == "site":
+			column = numpy.array([row.ifo[0] for row in self.snglinspiraltable])
+		else:
+			column = numpy.array([getattr(row, name) for row in self.snglinspiraltable])
+		self._sngl_columns[name] = column
+		return column
 
 	def coincs_near_endtime(self, t):
 		"""
@@ -262,10 +358,8 @@ class DocContents(object):
 		# offsets that should be applied to the coinc, but for now
 		# injections are done at zero lag so this isn't a problem
 		# yet
-		coinc_event_ids = set()
-		for event in self.inspirals_near_endtime(t):
-			coinc_event_ids |= self.coincs[event.event_id]
-		return [(coinc_event_id, self.sngls[coinc_event_id]) for coinc_event_id in coinc_event_ids]
+		lo, hi = self.indexes_near_endtimes(t.seconds * 1000000000 + t.nanoseconds)
+		return self.coincs_in_range(lo, hi)
 
 	def sort_triggers_by_id(self):
 		"""
@@ -273,6 +367,7 @@ class DocContents(object):
 		for output).
 		"""
 		self.snglinspiraltable.sort(lambda a, b: cmp(a.event_id, b.event_id))
+		self._sngl_columns.clear()
 
 	def new_coinc(self, coinc_def_id):
 		"""
@@ -316,6 +411,117 @@ def append_process(xmldoc, match_algorithm, comment):
 	return process
 
 
+#
+# =============================================================================
+#
+#                             Comparison Functions
+#
+# =============================================================================
+#
+
+
+#
+# a comparefunc is called as comparefunc(sim, inspiral) and returns True
+# if the inspiral event does *not* match the injection.  the classes
+# below implement the standard tests, and in addition to being callable
+# provide a .batch(sim, contents, positions) method that tests sim
+# against the inspiral events at an array of positions in the
+# time-ordered sngl_inspiral table in one go, returning an array of
+# booleans with the same meaning.  any other callable can still be used
+# as a comparefunc, it is simply evaluated one event at a time.
+#
+
+
+def compare_positions(comparefunc, sim, contents, positions):
+	"""
+	Return a boolean array that is True where the inspiral events at
+	positions (an array of indexes into the time-ordered sngl_inspiral
+	table) do not match sim according to comparefunc.
+	"""
+	if hasattr(comparefunc, "batch"):
+		return numpy.asarray(comparefunc.batch(sim, contents, positions), dtype = bool)
+	rows = contents.snglinspiraltable
+	return numpy.fromiter((comparefunc(sim, rows[i]) for i in positions), dtype = bool, count = len(positions))
+
+
+class EndTimeCompare(object):
+	"""
+	Reject inspiral events whose end time differs by more than window
+	seconds from the injection's end time at the event's site.
+	"""
+	def __init__(self, window):
+		self.window = LIGOTimeGPS(window)
+		self.window_ns = self.window.seconds * 1000000000 + self.window.nanoseconds
+
+	def __call__(self, sim, inspiral):
+		site = inspiral.ifo[0].lower()
+		t = LIGOTimeGPS(getattr(sim, "%s_end_time" % site), getattr(sim, "%s_end_time_ns" % site))
+		return abs(inspiral.get_end() - t) > self.window
+
+	def batch(self, sim, contents, positions):
+		sites = contents.sngl_column("site")[positions]
+		sim_times = numpy.empty(len(positions), dtype = "int64")
+		for site in numpy.unique(sites):
+			s = site.lower()
+			sim_times[sites == site] = getattr(sim, "%s_end_time" % s) * 1000000000 + getattr(sim, "%s_end_time_ns" % s)
+		return abs(contents.end_times[positions] - sim_times) > self.window_ns
+
+
+class ChirpMassCompare(object):
+	"""
+	Reject inspiral events whose chirp mass differs from the
+	injection's by more than the fraction delta of the injection's.
+	"""
+	def __init__(self, delta):
+		self.delta = delta
+
+	def __call__(self, sim, inspiral):
+		return abs(inspiral.mchirp - sim.mchirp) > self.delta * sim.mchirp
+
+	def batch(self, sim, contents, positions):
+		return abs(contents.sngl_column("mchirp")[positions] - sim.mchirp) > self.delta * sim.mchirp
+
+
+class EThincaCompare(object):
+	"""
+	Reject inspiral events whose e-thinca parameter with respect to
+	the injection, from XLALEThincaParameterForInjection(), exceeds
+	ethinca.
+	"""
+	def __init__(self, ethinca):
+		self.ethinca = ethinca
+
+	def __call__(self, sim, inspiral):
+		return tools.XLALEThincaParameterForInjection(sim, inspiral) > self.ethinca
+
+	def batch(self, sim, contents, positions):
+		rows = contents.snglinspiraltable
+		return numpy.array(tools.XLALEThincaParameterForInjectionBatch(sim, [rows[i] for i in positions])) > self.ethinca
+
+
+class AnyCompare(object):
+	"""
+	Reject inspiral events rejected by any of the given comparefuncs.
+	Later tests are only applied to events passing the earlier ones,
+	so put the cheapest tests first.
+	"""
+	def __init__(self, *comparefuncs):
+		self.comparefuncs = comparefuncs
+
+	def __call__(self, sim, inspiral):
+		return any(comparefunc(sim, inspiral) for comparefunc in self.comparefuncs)
+
+	def batch(self, sim, contents, positions):
+		positions = numpy.asarray(positions, dtype = "intp")
+		mismatch = numpy.zeros(len(positions), dtype = bool)
+		for comparefunc in self.comparefuncs:
+			remaining = numpy.flatnonzero(~mismatch)
+			if not len(remaining):
+				break
+			mismatch[remaining] = compare_positions(comparefunc, sim, contents, positions[remaining])
+		return mismatch
+
+
 #
 # =============================================================================
 #
@@ -325,11 +531,20 @@ def append_process(xmldoc, match_algorithm, comment):
 #
 
 
-def find_sngl_inspiral_matches(contents, sim, comparefunc):
+def find_sngl_inspiral_matches(contents, sim, comparefunc, window = None):
 	"""
-	Scan the inspiral table for triggers matching sim.
+	Scan the inspiral table for triggers matching sim.  window is an
+	optional (lo, hi) range of positions in the time-ordered
+	sngl_inspiral table to scan, as returned by
+	contents.sim_indexes_near_endtime();  by default it is found from
+	sim's end time.
 	"""
-	return [inspiral for inspiral in contents.inspirals_near_endtime(sim.get_end()) if not comparefunc(sim, inspiral)]
+	if window is None:
+		end = sim.get_end()
+		window = contents.indexes_near_endtimes(end.seconds * 1000000000 + end.nanoseconds)
+	lo, hi = window
+	mismatch = compare_positions(comparefunc, sim, contents, numpy.arange(lo, hi, dtype = "intp"))
+	return [contents.snglinspiraltable[lo + i] for i in numpy.flatnonzero(~mismatch)]
 
 
 def add_sim_inspiral_coinc(contents, sim, inspirals):
@@ -395,6 +610,26 @@ def find_near_coinc_matches(coincs, sim, comparefunc):
 	return set(coinc_event_id for coinc_event_id, inspirals in coincs if not all(comparefunc(sim, inspiral) for inspiral in inspirals))
 
 
+def count_coinc_mismatches(contents, sim, comparefunc, window):
+	"""
+	For the inspiral<-->inspiral coincs having at least one inspiral
+	event at positions window[0]:window[1] of the time-ordered
+	sngl_inspiral table, return the tuple (coinc_event_ids,
+	nmismatched, nevents) giving, for each coinc, the number of its
+	inspiral events that do not match sim and the total number of its
+	inspiral events.  Each inspiral event is compared to sim once, no
+	matter how many coincs it takes part in.
+	"""
+	coinc_indexes, positions, indptr = contents.coinc_sngl_positions_in_range(*window)
+	if not len(coinc_indexes):
+		return [], numpy.zeros(0, dtype = "intp"), numpy.zeros(0, dtype = "intp")
+	unique_positions, inverse = numpy.unique(positions, return_inverse = True)
+	mismatch = compare_positions(comparefunc, sim, contents, unique_positions)[inverse]
+	# every coinc has at least one event so the runs are never empty
+	nmismatched = numpy.add.reduceat(mismatch.astype("intp"), indptr[:-1])
+	return [contents.coinc_event_ids[n] for n in coinc_indexes], nmismatched, numpy.diff(indptr)
+
+
 def add_sim_coinc_coinc(contents, sim, coinc_event_ids, coinc_def_id):
 	"""
 	Create a coinc_event in the coinc table, and add arcs in the
@@ -446,11 +681,12 @@ def ligolw_inspinjfind(xmldoc, process, search, snglcomparefunc, nearcoinccompar
 	# Find sim_inspiral <--> sngl_inspiral coincidences.
 	#
 
+	sim_windows = zip(*contents.sim_indexes_near_endtime())
 	progressbar = ProgressBar(max = len(contents.siminspiraltable), textwidth = 35, text = sbdef.description) if verbose else None
-	for sim in contents.siminspiraltable:
+	for sim, window in zip(contents.siminspiraltable, sim_windows):
 		if progressbar is not None:
 			progressbar.increment()
-		inspirals = find_sngl_inspiral_matches(contents, sim, snglcomparefunc)
+		inspirals = find_sngl_inspiral_matches(contents, sim, snglcomparefunc, window = window)
 		if inspirals:
 			add_sim_inspiral_coinc(contents, sim, inspirals)
 	del progressbar
@@ -461,12 +697,15 @@ def ligolw_inspinjfind(xmldoc, process, search, snglcomparefunc, nearcoinccompar
 
 	if contents.scn_coinc_def_id:
 		progressbar = ProgressBar(max = len(contents.siminspiraltable), textwidth = 35, text = scndef.description) if verbose else None
-		for sim in contents.siminspiraltable:
+		for sim, window in zip(contents.siminspiraltable, sim_windows):
 			if progressbar is not None:
 				progressbar.increment()
-			coincs = contents.coincs_near_endtime(sim.get_end())
-			exact_coinc_event_ids = find_exact_coinc_matches(coincs, sim, snglcomparefunc)
-			near_coinc_event_ids = find_near_coinc_matches(coincs, sim, nearcoinccomparefunc)
+			# exact:  no inspiral event fails to match sim
+			coinc_event_ids, nmismatched, nevents = count_coinc_mismatches(contents, sim, snglcomparefunc, window)
+			exact_coinc_event_ids = set(coinc_event_id for coinc_event_id, n in zip(coinc_event_ids, nmismatched) if n == 0)
+			# near:  at least one inspiral event matches sim
+			coinc_event_ids, nmismatched, nevents = count_coinc_mismatches(contents, sim, nearcoinccomparefunc, window)
+			near_coinc_event_ids = set(coinc_event_id for coinc_event_id, n, m in zip(coinc_event_ids, nmismatched, nevents) if n < m)
 			assert exact_coinc_event_ids.issubset(near_coinc_event_ids)
 			if exact_coinc_event_ids:
 				add_sim_coinc_coinc(contents, sim, exact_coinc_event_ids, contents.sce_coinc_def_id)
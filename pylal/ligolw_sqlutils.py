@@ -17,14 +17,19 @@ import re
 import os
 import bisect
 import copy
+import itertools
 import time
 import pdb
 
+import numpy
+
 from glue.ligolw import dbtables
 from glue.ligolw import lsctables
 from glue.ligolw import ilwd
 from glue import git_version
 
+from pylal import segmentindex
+
 __author__ = "Collin Capano <cdcapano@physics.syr.edu>"
 __version__ = git_version.verbose_msg
 
@@ -541,6 +546,90 @@ def get_column_names_from_table( connection, table_name ):
     
     return column_names
 
+def _numpy_type( values ):
+    """
+    Returns the numpy type used to store a column of values returned by
+    sqlite: float64 if all of them are numbers, else object. Integers are
+    stored as float64 too, since sqlite may return an integer for one row
+    and a real for the next in the same column.
+    """
+    for value in values:
+        if not isinstance(value, (int, long, float)):
+            return object
+    return numpy.float64
+
+def get_arrays_from_query( connection, sqlquery, params = (), dtype = None, chunksize = 100000 ):
+    """
+    Runs sqlquery and returns the results as a numpy record array, with one
+    field per result column named as in the query. Rows are pulled from the
+    cursor in blocks of chunksize and copied straight into typed arrays, so
+    no list of the full result set is ever built. If dtype is given and
+    is the same numeric type for every column, the rows are streamed into
+    one flat array with numpy.fromiter.
+
+    @connection: connection to a sqlite database
+    @sqlquery: the SELECT statement to run
+    @params: parameters to bind to the query
+    @dtype: a numpy dtype or list of types, one per column. If None, the
+     types are taken from the first block of rows: columns holding only
+     numbers become float64, and all others (text and NULL) object. Use an
+     explicit dtype to get integer columns. NULLs in a float64 column
+     after the first block are returned as nan.
+    """
+    cursor = connection.cursor()
+    cursor.execute( sqlquery, params )
+    names = [ desc[0] for desc in cursor.description ]
+    rows = cursor.fetchmany( chunksize )
+    inferred = dtype is None
+    if inferred:
+        if rows:
+            dtype = [ _numpy_type(column) for column in zip(*rows) ]
+        else:
+            dtype = [ object ] * len(names)
+    if not isinstance(dtype, list):
+        dtype = [ dtype ] * len(names)
+    dtype = numpy.dtype( zip(names, dtype) )
+
+    if not inferred and len(set( dtype[ii] for ii in range(len(names)) )) == 1 and dtype[0] != numpy.dtype(object):
+        # homogeneous numeric results: stream values into a flat array
+        values = itertools.chain( itertools.chain.from_iterable(rows), itertools.chain.from_iterable(cursor) )
+        flat = numpy.fromiter( values, dtype = dtype[0] )
+        cursor.close()
+        return flat.view( dtype ).view( numpy.recarray )
+
+    chunks = []
+    while rows:
+        chunks.append( numpy.array(rows, dtype = dtype) )
+        rows = cursor.fetchmany( chunksize )
+    cursor.close()
+    if not chunks:
+        return numpy.zeros( 0, dtype = dtype ).view( numpy.recarray )
+    return numpy.concatenate( chunks ).view( numpy.recarray )
+
+def insert_arrays( connection, table_name, columns, chunksize = 100000 ):
+    """
+    Inserts rows into table_name from a dictionary of equal-length column
+    arrays keyed by column name. All rows are inserted with a single
+    prepared statement. As with the other functions here, committing (or
+    rolling back) the transaction is left to the caller.
+
+    @connection: connection to a sqlite database
+    @table_name: table to insert the rows into
+    @columns: dictionary of column name -> array (or list) of values
+    """
+    table_name = validate_option( table_name )
+    names = columns.keys()
+    sqlquery = ''.join([ 'INSERT INTO ', table_name, ' (', ', '.join([ validate_option(name) for name in names ]), ') VALUES (', ', '.join(['?'] * len(names)), ')' ])
+    values = [ numpy.asarray(columns[name]) for name in names ]
+    nrows = len(values[0]) if values else 0
+    cursor = connection.cursor()
+    try:
+        for start in xrange(0, nrows, chunksize):
+            # tolist converts to python scalars in compiled code, which sqlite can bind
+            cursor.executemany( sqlquery, zip(*[ col[start:start+chunksize].tolist() for col in values ]) )
+    finally:
+        cursor.close()
+
 def get_user_created_indices( connection, table_names ):
     """
     Get all index names and associated SQL CREATE statements associated with
@@ -825,6 +914,120 @@ class Summaries:
             (len( self.max_bkg_fars[(esid, ifo_group)] ) - bisect.bisect_left( self.max_bkg_fars[(esid,ifo_group)], ufar ))*ufar \
             + sum([self.max_bkg_fars[(esid,ifo_group)][ii] for ii in range(bisect.bisect_left( self.max_bkg_fars[(esid,ifo_group)], ufar))])
 
+def _group_indices( *columns ):
+    """
+    Groups the rows of the given equal-length columns by their combined
+    values. Returns a list of (key, indices) tuples, where key is the tuple
+    of column values shared by the rows at indices. Grouping is done with a
+    single stable sort, so indices are in their original order.
+    """
+    columns = [numpy.asarray(col) for col in columns]
+    nrows = len(columns[0])
+    if nrows == 0:
+        return []
+    codes = numpy.zeros(nrows, dtype = numpy.int64)
+    for col in columns:
+        uniq, inv = numpy.unique(col, return_inverse = True)
+        codes = codes * len(uniq) + inv
+    order = numpy.argsort(codes, kind = 'mergesort')
+    bounds = numpy.nonzero(numpy.diff(codes[order]))[0] + 1
+    starts = numpy.concatenate(([0], bounds))
+    stops = numpy.concatenate((bounds, [nrows]))
+    groups = []
+    for start, stop in zip(starts, stops):
+        idx = order[start:stop]
+        groups.append( (tuple(col[idx[0]] for col in columns), idx) )
+    return groups
+
+class ArraySummaries:
+    """
+    A vectorized counterpart to Summaries for computing uncombined and
+    combined fars of many triggers at once.
+
+    Durations, zero-lag ids and max_bkg_fars are small and are taken from a
+    Summaries instance, which must have had calc_bkg_durs called. The
+    background stats, which are large, are ingested here as arrays with
+    add_to_bkg_stats. sort_bkg_stats then groups them by category and by
+    slide with one sort each, after which calc_ufars and calc_cfars return
+    the fars of whole arrays of triggers. The results are the same as
+    calling Summaries.calc_ufar_by_max/min and Summaries.calc_cfar on each
+    trigger, except that categories with no background give a far of zero
+    rather than raising a KeyError.
+    """
+    def __init__(self, summaries):
+        self.summaries = summaries
+        self._bkg_columns = []
+        self.bkg_stats = {}
+        self.sngl_slide_stats = {}
+        self._max_bkg_fars = None
+
+    def add_to_bkg_stats(self, experiment_ids, experiment_summ_ids, ifos, param_groups, stats):
+        """
+        Adds arrays of triggers to the background. Triggers in zero-lag
+        experiment_summ_ids are dropped, as in Summaries.add_to_bkg_stats.
+        """
+        experiment_summ_ids = numpy.asarray(experiment_summ_ids)
+        zero_lag = [esid for esids in self.summaries.zero_lag_ids.values() for esid in esids]
+        keep = ~numpy.in1d(experiment_summ_ids, numpy.asarray(zero_lag, dtype = experiment_summ_ids.dtype)) if zero_lag else numpy.ones(len(experiment_summ_ids), dtype = bool)
+        self._bkg_columns.append( [numpy.asarray(experiment_ids)[keep], experiment_summ_ids[keep], numpy.asarray(ifos)[keep], numpy.asarray(param_groups)[keep], numpy.asarray(stats, dtype = float)[keep]] )
+
+    def sort_bkg_stats(self):
+        """
+        Groups the background stats into sorted arrays keyed by
+        (experiment_id, ifos, param_group) in bkg_stats and by
+        (experiment_id, experiment_summ_id, ifos, param_group) in
+        sngl_slide_stats.
+        """
+        if not self._bkg_columns:
+            return
+        eids, esids, ifos, pgs, stats = [numpy.concatenate(cols) for cols in zip(*self._bkg_columns)]
+        self.bkg_stats = dict( (key, numpy.sort(stats[idx])) for key, idx in _group_indices(eids, ifos, pgs) )
+        self.sngl_slide_stats = dict( (key, numpy.sort(stats[idx])) for key, idx in _group_indices(eids, esids, ifos, pgs) )
+
+    def calc_ufars(self, experiment_ids, experiment_summ_ids, ifos, param_groups, stats, rank_by = 'max'):
+        """
+        Returns an array of the uncombined fars of the given triggers. If
+        rank_by is 'max', fars are computed as in Summaries.calc_ufar_by_max,
+        otherwise as in Summaries.calc_ufar_by_min.
+        """
+        stats = numpy.asarray(stats, dtype = float)
+        ufars = numpy.zeros(len(stats))
+        empty = numpy.array([])
+        for (eid, esid, ifo, pg), idx in _group_indices(experiment_ids, experiment_summ_ids, ifos, param_groups):
+            bkg = self.bkg_stats.get( (eid, ifo, pg), empty )
+            slide = self.sngl_slide_stats.get( (eid, esid, ifo, pg), empty )
+            these = stats[idx]
+            if rank_by == 'max':
+                count = (len(bkg) - numpy.searchsorted(bkg, these, side = 'left')) - (len(slide) - numpy.searchsorted(slide, these, side = 'left'))
+            else:
+                count = numpy.searchsorted(bkg, these, side = 'right') - numpy.searchsorted(slide, these, side = 'right')
+            ufars[idx] = count / float(self.summaries.bkg_durs[esid])
+        if rank_by != 'max':
+            ufars[stats == 0.] = 0.
+        return ufars
+
+    def calc_cfars(self, experiment_summ_ids, ifo_groups, ufars):
+        """
+        Returns an array of the combined fars of the given uncombined fars,
+        as in Summaries.calc_cfar. The max_bkg_fars of each
+        (experiment_summ_id, ifo_group) are sorted and prefix-summed once, so
+        each combined far costs one binary search rather than a sum over the
+        inactive categories.
+        """
+        if self._max_bkg_fars is None:
+            self._max_bkg_fars = {}
+            for key, fars in self.summaries.max_bkg_fars.items():
+                fars = numpy.sort(numpy.asarray(fars, dtype = float))
+                self._max_bkg_fars[key] = (fars, numpy.concatenate(([0.], numpy.cumsum(fars))))
+        ufars = numpy.asarray(ufars, dtype = float)
+        cfars = numpy.zeros(len(ufars))
+        for (esid, ifo_group), idx in _group_indices(experiment_summ_ids, ifo_groups):
+            fars, cumfars = self._max_bkg_fars[(esid, ifo_group)]
+            these = ufars[idx]
+            inactive = numpy.searchsorted(fars, these, side = 'left')
+            cfars[idx] = (len(fars) - inactive) * these + cumfars[inactive]
+        return cfars
+
 class rank_stats:
     """
     Class to return a rank for stats.
@@ -836,6 +1039,7 @@ class rank_stats:
         @rank_by: should be either "ASC" or "DESC"
         """
         self.stats = []
+        self.num_null = 0
         self.table = table
         self.ranking_stat = ranking_stat
         self.rank_by = rank_by
@@ -861,14 +1065,43 @@ class rank_stats:
             """, filter, """
             ORDER BY """, self.ranking_stat, ' ', self.rank_by, """
             """, limit ])
-        self.stats = [stat[0] for stat in connection.cursor().execute(sqlquery).fetchall()]
-        self.stats.sort()
+        stats = get_arrays_from_query( connection, sqlquery, dtype = object )
+        stats = stats[stats.dtype.names[0]]
+        # NULL stats sort below all others, as None does in a python list;
+        # only their number is kept
+        null = numpy.equal( stats, None )
+        self.num_null = int( null.sum() )
+        self.stats = numpy.sort( stats[~null].astype(numpy.float64) )
 
     def get_rank( self, this_stat ):
+        if this_stat is None:
+            below, upto = 0, self.num_null
+        else:
+            below = self.num_null + int(numpy.searchsorted(self.stats, this_stat, side = 'left'))
+            upto = self.num_null + int(numpy.searchsorted(self.stats, this_stat, side = 'right'))
+        if self.rank_by == "ASC":
+            return below + 1
+        else:
+            return self.num_null + len(self.stats) - upto + 1
+
+    def get_ranks( self, stats ):
+        """
+        Returns the ranks of an array of stats, as get_rank would for each.
+        Stats may be None (NULL) if stats is an object array.
+        """
+        stats = numpy.asarray( stats )
+        if stats.dtype == object:
+            null = numpy.equal( stats, None )
+            values = numpy.where( null, 0., stats ).astype( numpy.float64 )
+        else:
+            null = numpy.zeros( stats.shape, dtype = bool )
+            values = stats
+        below = numpy.where( null, 0, self.num_null + numpy.searchsorted(self.stats, values, side = 'left') )
+        upto = numpy.where( null, self.num_null, self.num_null + numpy.searchsorted(self.stats, values, side = 'right') )
         if self.rank_by == "ASC":
-            return bisect.bisect_left(self.stats, this_stat) + 1
+            return below + 1
         else:
-            return len(self.stats) - bisect.bisect_right(self.stats, this_stat) + 1
+            return self.num_null + len(self.stats) - upto + 1
 
 
 def get_col_type(table_name, col_name, default = 'lstring'):
@@ -2621,12 +2854,20 @@ class segdict_from_segment:
                if ifo not in self.snglinst_segdict:
                 self.snglinst_segdict[ifo] = segments.segmentlist()
                 self.snglinst_segdict[ifo].append( segments.segment(LIGOTimeGPS(start_time, 0),LIGOTimeGPS(end_time,0)) )
+        self.snglinst_segindex = segmentindex.segmentindexdict( self.snglinst_segdict )
 
     def is_in_sngl_segdict( self, instrument, gpstime, gpstime_ns ):
         """
         Checks if a gpstime is in the given instrument time.
         """
-        return LIGOTimeGPS(gpstime, gpstime_ns) in self.snglinst_segdict[instrument]
+        return self.snglinst_segindex[instrument].contains_time( gpstime, gpstime_ns )
+
+    def are_in_sngl_segdict( self, instrument, gpstimes, gpstimes_ns ):
+        """
+        Vectorized is_in_sngl_segdict: returns a boolean array that is True
+        for the gpstimes that are in the given instrument time.
+        """
+        return self.snglinst_segindex[instrument].contains( gpstimes, gpstimes_ns )
         
 
 def simplify_segments_tbls(connection, verbose=False, debug=False):
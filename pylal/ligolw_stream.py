@@ -0,0 +1,400 @@
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+
+#
+# =============================================================================
+#
+#                                   Preamble
+#
+# =============================================================================
+#
+
+
+"""
+Streaming, column-projecting reader for LIGO Light Weight XML tables.
+
+The documents are fed through expat a block at a time (gzip-compressed
+files are decompressed as they are read) and the Stream text of the
+requested table is split into tokens with the csv module's compiled
+tokenizer.  Only the requested columns are kept, and they are converted a
+block at a time into typed numpy arrays, so memory use is set by the size
+of the selected columns rather than by the size or number of documents and
+no row objects are built unless asked for.
+
+Example:
+
+>>> data = read_columns(filenames, "sim_inspiral", ["geocent_end_time", "geocent_end_time_ns", "mchirp"])
+>>> data["mchirp"].mean()
+"""
+
+
+import csv
+import gzip
+import itertools
+import sys
+from xml.parsers import expat
+
+
+import numpy
+
+
+from glue.ligolw import ilwd
+from glue.ligolw import lsctables
+from glue.ligolw import table
+
+
+# size of the blocks read from each file
+BLOCKSIZE = 1 << 20
+
+# amount of Stream text gathered before it is tokenized
+FLUSHSIZE = 1 << 18
+
+
+# numpy types of the LIGO_LW column types;  anything else (lstring,
+# ilwd:char, blob, ...) is kept as an array of Python strings
+_dtypes = {
+	"real_4": numpy.float32,
+	"real_8": numpy.float64,
+	"float": numpy.float32,
+	"double": numpy.float64,
+	"int_2s": numpy.int16,
+	"int_2u": numpy.uint16,
+	"int_4s": numpy.int32,
+	"int_4u": numpy.uint32,
+	"int_8s": numpy.int64,
+	"int_8u": numpy.uint64,
+	"int": numpy.int32,
+	"short": numpy.int16,
+	"long": numpy.int64
+}
+
+
+#
+# =============================================================================
+#
+#                                Stream Parsing
+#
+# =============================================================================
+#
+
+
+def _convert(tokens, coltype):
+	"""
+	Convert a list of token strings to an array of the column's type.
+	Empty (null) tokens become NaN in real-valued columns and 0 in
+	integer-valued columns.
+	"""
+	dtype = _dtypes.get(coltype)
+	if dtype is None:
+		return numpy.array(tokens, dtype = object)
+	if "" in tokens:
+		null = numpy.dtype(dtype).kind == "f" and "nan" or "0"
+		tokens = [token or null for token in tokens]
+	if numpy.dtype(dtype).kind == "f":
+		return numpy.array(tokens, dtype = "S").astype(dtype)
+	# integers may be written in exponent or decimal form
+	try:
+		return numpy.array(tokens, dtype = "S").astype(dtype)
+	except ValueError:
+		return numpy.array(tokens, dtype = "S").astype(numpy.float64).astype(dtype)
+
+
+class TableBuffer(object):
+	"""
+	Accumulates the columns of one table, named tablename, as its Stream
+	text is parsed.  If columns is given only those columns are kept.  If
+	selection is given it is called with the dictionary of column arrays
+	of each block of rows and must return a boolean array marking the rows
+	to keep.
+	"""
+	def __init__(self, tablename, columns = None, selection = None):
+		self.tablename = table.StripTableName(tablename)
+		if columns is None:
+			self.wanted = None
+		else:
+			self.wanted = [table.StripColumnName(name) for name in columns]
+		self.selection = selection
+		self.names = None
+		self.types = {}
+		self.blocks = []
+		self.end_table()
+
+	def start_table(self):
+		self._columns = []
+
+	def add_column(self, name, coltype):
+		self._columns.append((table.StripColumnName(name), coltype))
+
+	def start_stream(self, delimiter):
+		self._delimiter = delimiter
+		names = [colname for colname, coltype in self._columns]
+		if self.wanted is not None:
+			missing = set(self.wanted) - set(names)
+			if missing:
+				raise ValueError("table %s has no column(s) %s" % (self.tablename, ", ".join(sorted(missing))))
+			names = self.wanted
+		if self.names is None:
+			self.names = names
+			self.types = dict(self._columns)
+		elif set(self.names) != set(names):
+			raise ValueError("table %s has different columns in different documents" % self.tablename)
+		self._positions = [[colname for colname, coltype in self._columns].index(colname) for colname in self.names]
+
+	def characters(self, data):
+		self._text.append(data)
+		self._size += len(data)
+		if self._size >= FLUSHSIZE:
+			self._flush()
+
+	def end_stream(self):
+		self._flush(final = True)
+
+	def end_table(self):
+		self._columns = []
+		self._text = []
+		self._size = 0
+		self._carry = []
+
+	def _flush(self, final = False):
+		"""
+		Tokenize the text received so far, up to the last delimiter that
+		ends a line, and convert the complete rows it contains.
+		"""
+		text = "".join(self._text)
+		if final:
+			head, tail = text.strip(), ""
+		else:
+			cut = text.rfind("\n")
+			head, tail = text[:max(cut, 0)].strip(), text[max(cut, 0):]
+			if not head.endswith(self._delimiter):
+				# a token continues on the next line, wait for more text
+				self._text = [text]
+				return
+			# drop the delimiter that separates this text from the next
+			head = head[:-len(self._delimiter)]
+		self._text = tail and [tail] or []
+		self._size = len(tail)
+		if not head:
+			return
+
+		if isinstance(head, unicode):
+			head = head.encode("utf-8")
+		tokens = self._carry + [token.strip() for token in csv.reader([head.replace("\n", " ")], delimiter = self._delimiter, quotechar = "\"", escapechar = "\\", doublequote = False, skipinitialspace = True).next()]
+		ncols = len(self._columns)
+		if final and len(tokens) % ncols == 1 and not tokens[-1]:
+			# the last row was followed by a delimiter
+			del tokens[-1]
+		nrows = len(tokens) // ncols
+		self._carry = tokens[nrows * ncols:]
+		if final and self._carry:
+			raise ValueError("table %s: Stream ends part way through a row" % self.tablename)
+		if not nrows:
+			return
+
+		block = dict((colname, _convert(tokens[position:nrows * ncols:ncols], self.types[colname])) for colname, position in zip(self.names, self._positions))
+		if self.selection is not None:
+			keep = numpy.asarray(self.selection(block), dtype = bool)
+			block = dict((colname, column[keep]) for colname, column in block.items())
+		self.blocks.append(block)
+
+	def columns(self):
+		"""
+		Return a dictionary of the accumulated column arrays.
+		"""
+		names = self.names or self.wanted or []
+		if not self.blocks:
+			return dict((colname, _convert([], self.types.get(colname))) for colname in names)
+		data = dict((colname, numpy.concatenate([block[colname] for block in self.blocks])) for colname in names)
+		# the blocks are joined only here, once all documents are read;
+		# keep the result so a second call does not repeat the work
+		self.blocks = [data]
+		return data
+
+
+class StreamReader(object):
+	"""
+	Incremental reader for LIGO_LW documents.  Register the tables to be
+	read with add_table(), then feed each document to parse() a block at a
+	time, calling next_document() before each new document.  The tables
+	are read in a single pass over the document.
+	"""
+	def __init__(self):
+		self.buffers = {}
+		self.next_document()
+
+	def add_table(self, tablename, columns = None, selection = None):
+		"""
+		Read the table named tablename.  See TableBuffer for the meaning
+		of columns and selection.  Returns the TableBuffer.
+		"""
+		buf = self.buffers[table.StripTableName(tablename)] = TableBuffer(tablename, columns = columns, selection = selection)
+		return buf
+
+	def next_document(self):
+		"""
+		Prepare to read the next document.
+		"""
+		self.parser = expat.ParserCreate()
+		self.parser.buffer_text = True
+		self.parser.StartElementHandler = self._start_element
+		self.parser.EndElementHandler = self._end_element
+		self.parser.CharacterDataHandler = self._characters
+		self._table = None
+		self._in_stream = False
+		for buf in self.buffers.values():
+			buf.end_table()
+
+	def _start_element(self, name, attrs):
+		if name == "Table":
+			self._table = self.buffers.get(table.StripTableName(attrs.get("Name", "")))
+			if self._table is not None:
+				self._table.start_table()
+		elif self._table is None:
+			pass
+		elif name == "Column":
+			self._table.add_column(attrs["Name"], attrs["Type"])
+		elif name == "Stream":
+			self._in_stream = True
+			self._table.start_stream(str(attrs.get("Delimiter", ",")))
+
+	def _end_element(self, name):
+		if self._table is None:
+			return
+		if name == "Stream":
+			self._table.end_stream()
+			self._in_stream = False
+		elif name == "Table":
+			self._table.end_table()
+			self._table = None
+
+	def _characters(self, data):
+		if self._in_stream:
+			self._table.characters(data)
+
+	def parse(self, data, final = False):
+		self.parser.Parse(data, final)
+
+	def columns(self, tablename):
+		"""
+		Return a dictionary of the column arrays accumulated for the table
+		named tablename.
+		"""
+		return self.buffers[table.StripTableName(tablename)].columns()
+
+
+def open_document(filename):
+	"""
+	Open filename for reading, decompressing it as it is read if it is
+	gzip-compressed.  None or "" means stdin.
+	"""
+	if not filename:
+		return sys.stdin
+	fileobj = open(filename, "rb")
+	magic = fileobj.read(2)
+	fileobj.seek(0)
+	if magic == "\x1f\x8b":
+		return gzip.GzipFile(fileobj = fileobj, mode = "rb")
+	return fileobj
+
+
+#
+# =============================================================================
+#
+#                                    Input
+#
+# =============================================================================
+#
+
+
+def read_tables(filenames, tables, blocksize = BLOCKSIZE, verbose = False):
+	"""
+	Read several tables from each of the LIGO_LW documents in filenames in
+	a single pass.  tables maps each table name to the list of columns to
+	keep, or None for all of them.  Returns a dictionary mapping each
+	table name to a dictionary of column arrays holding the table's rows
+	from all the documents, as for read_columns().
+	"""
+	reader = StreamReader()
+	for tablename, columns in tables.items():
+		reader.add_table(tablename, columns = columns)
+	_read_documents(reader, filenames, blocksize, verbose)
+	return dict((tablename, reader.columns(tablename)) for tablename in tables)
+
+
+def read_columns(filenames, tablename, columns = None, selection = None, blocksize = BLOCKSIZE, verbose = False):
+	"""
+	Read the table named tablename from each of the LIGO_LW documents in
+	filenames and return a dictionary mapping column name to a numpy
+	array holding that column's values from all the documents.  If
+	columns is given only those columns are read.  If selection is given
+	it is called with each block of rows, as a dictionary of column
+	arrays, and must return a boolean array selecting the rows to keep.
+	Documents without the table contribute no rows.  The blocks of rows
+	from all the documents are joined into one array per column only
+	once, after the last document has been read.
+	"""
+	reader = StreamReader()
+	reader.add_table(tablename, columns = columns, selection = selection)
+	_read_documents(reader, filenames, blocksize, verbose)
+	return reader.columns(tablename)
+
+
+def _read_documents(reader, filenames, blocksize, verbose):
+	for n, filename in enumerate(filenames):
+		if verbose:
+			print >>sys.stderr, "%d/%d: reading %s ..." % (n + 1, len(filenames), filename or "stdin")
+		fileobj = open_document(filename)
+		try:
+			reader.next_document()
+			for data in iter(lambda: fileobj.read(blocksize), ""):
+				reader.parse(data)
+			reader.parse("", True)
+		finally:
+			if fileobj is not sys.stdin:
+				fileobj.close()
+
+
+def table_from_columns(tableclass, data):
+	"""
+	Build an instance of the lsctables table class tableclass holding
+	only the columns in data, as returned by read_columns().  Columns of
+	ilwd:char type are converted to ilwd objects.
+	"""
+	names = list(data)
+	tbl = lsctables.New(tableclass, columns = names)
+	coltypes = dict((table.StripColumnName(name), coltype) for name, coltype in tableclass.validcolumns.items())
+	columns = []
+	for name in names:
+		column = data[name].tolist()
+		if coltypes.get(name) == "ilwd:char":
+			column = [ilwd.ilwdchar(value) for value in column]
+		columns.append(column)
+	for values in itertools.izip(*columns):
+		row = tbl.RowType()
+		for name, value in zip(names, values):
+			setattr(row, name, value)
+		tbl.append(row)
+	return tbl
+
+
+def read_table(filenames, tableclass, columns = None, selection = None, verbose = False):
+	"""
+	Read the table of lsctables class tableclass from each of the
+	documents in filenames, keeping only the columns listed in columns
+	and the rows accepted by selection (see read_columns()), and return
+	them as a single table.  This builds one row object per row;  use
+	read_columns() instead to get the columns as numpy arrays.
+	"""
+	return table_from_columns(tableclass, read_columns(filenames, tableclass.tableName, columns = columns, selection = selection, verbose = verbose))
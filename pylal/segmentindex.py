@@ -0,0 +1,301 @@
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+
+#
+# =============================================================================
+#
+#                                   Preamble
+#
+# =============================================================================
+#
+
+
+"""
+Array-based segment lists for fast time lookups.
+
+A SegmentIndex stores a coalesced list of half-open [start, end) segments as
+two sorted int64 arrays of GPS nanoseconds.  Testing whether many times lie
+in the segments is then a single numpy.searchsorted pass, and the union,
+intersection and difference of two indexes is a single merge of their
+boundaries.  Membership follows glue.segments, where a time t is in
+segment(a, b) if a <= t < b.
+"""
+
+
+import bisect
+import numpy
+
+
+from glue import segments
+from glue.ligolw import lsctables
+
+
+# bounds used in place of +/- infinity
+INT64_MAX = numpy.iinfo(numpy.int64).max
+INT64_MIN = numpy.iinfo(numpy.int64).min
+
+
+#
+# =============================================================================
+#
+#                                  Utilities
+#
+# =============================================================================
+#
+
+
+def to_ns(t):
+	"""
+	Convert a GPS time (LIGOTimeGPS, int, float or glue.segments infinity)
+	to integer nanoseconds.
+	"""
+	if t is segments.PosInfinity or t == segments.PosInfinity:
+		return INT64_MAX
+	if t is segments.NegInfinity or t == segments.NegInfinity:
+		return INT64_MIN
+	if hasattr(t, "seconds") and hasattr(t, "nanoseconds"):
+		return int(t.seconds) * 1000000000 + int(t.nanoseconds)
+	if isinstance(t, (int, long)):
+		return int(t) * 1000000000
+	return int(round(float(t) * 1e9))
+
+
+def times_to_ns(times_s, times_ns = None):
+	"""
+	Convert arrays of GPS seconds (integer or float) and, optionally,
+	nanoseconds to an int64 array of GPS nanoseconds.
+	"""
+	times_s = numpy.asarray(times_s)
+	if times_s.dtype.kind in "iu":
+		out = times_s.astype(numpy.int64) * 1000000000
+	else:
+		sec = numpy.floor(times_s)
+		out = sec.astype(numpy.int64) * 1000000000 + numpy.round((times_s - sec) * 1e9).astype(numpy.int64)
+	if times_ns is not None:
+		out = out + numpy.asarray(times_ns, dtype = numpy.int64)
+	return out
+
+
+def _merge(a, b, inside):
+	"""
+	Sweep the boundaries of two SegmentIndex objects and return the
+	SegmentIndex of the times for which inside(state) is true, where state
+	is 1 inside a only, 2 inside b only and 3 inside both.
+	"""
+	times = numpy.concatenate((a.starts, a.ends, b.starts, b.ends))
+	steps = numpy.concatenate((numpy.ones(len(a), dtype = numpy.int64), -numpy.ones(len(a), dtype = numpy.int64), numpy.ones(len(b), dtype = numpy.int64) * 2, -numpy.ones(len(b), dtype = numpy.int64) * 2))
+	return SegmentIndex._from_boundaries(times, steps, inside)
+
+
+#
+# =============================================================================
+#
+#                                 SegmentIndex
+#
+# =============================================================================
+#
+
+
+class SegmentIndex(object):
+	"""
+	A coalesced segment list stored as sorted int64 nanosecond boundary
+	arrays.
+
+	Example:
+
+	>>> idx = SegmentIndex([0, 10], [5, 20])
+	>>> idx.contains([0, 4, 5, 19, 20])
+	array([ True,  True, False,  True, False], dtype=bool)
+	"""
+	def __init__(self, starts_s = (), ends_s = (), starts_ns = None, ends_ns = None, coalesce = True):
+		starts = times_to_ns(starts_s, starts_ns)
+		ends = times_to_ns(ends_s, ends_ns)
+		if starts.shape != ends.shape:
+			raise ValueError("starts and ends must have the same length")
+		if coalesce:
+			keep = starts < ends
+			starts, ends = starts[keep], ends[keep]
+			times = numpy.concatenate((starts, ends))
+			steps = numpy.concatenate((numpy.ones(len(starts), dtype = numpy.int64), -numpy.ones(len(ends), dtype = numpy.int64)))
+			starts, ends = self._sweep(times, steps, lambda state: state > 0)
+		self.starts = starts
+		self.ends = ends
+		self._lists = None
+
+	@staticmethod
+	def _sweep(times, steps, inside):
+		"""
+		Return the start and end arrays of the intervals over which
+		inside(running sum of steps) holds.  Boundaries at equal times are
+		applied together so touching segments are merged.
+		"""
+		order = numpy.argsort(times, kind = "mergesort")
+		times = times[order]
+		state = numpy.cumsum(steps[order])
+		# keep only the state after the last boundary at each time
+		last = numpy.ones(len(times), dtype = bool)
+		last[:-1] = times[1:] != times[:-1]
+		times = times[last]
+		now = inside(state[last])
+		before = numpy.zeros(len(now), dtype = bool)
+		before[1:] = now[:-1]
+		return times[now & ~before], times[before & ~now]
+
+	@classmethod
+	def _from_boundaries(cls, times, steps, inside):
+		new = cls(coalesce = False)
+		new.starts, new.ends = cls._sweep(times, steps, inside)
+		return new
+
+	@classmethod
+	def from_segmentlist(cls, seglist):
+		"""
+		Build a SegmentIndex from a glue.segments.segmentlist (or any
+		iterable of (start, end) pairs).
+		"""
+		new = cls(coalesce = False)
+		starts = numpy.array([to_ns(seg[0]) for seg in seglist], dtype = numpy.int64)
+		ends = numpy.array([to_ns(seg[1]) for seg in seglist], dtype = numpy.int64)
+		keep = starts < ends
+		steps = numpy.concatenate((numpy.ones(keep.sum(), dtype = numpy.int64), -numpy.ones(keep.sum(), dtype = numpy.int64)))
+		new.starts, new.ends = cls._sweep(numpy.concatenate((starts[keep], ends[keep])), steps, lambda state: state > 0)
+		return new
+
+	def to_segmentlist(self):
+		"""
+		Return the segments as a glue.segments.segmentlist of LIGOTimeGPS.
+		"""
+		def gps(t):
+			if t == INT64_MAX:
+				return segments.PosInfinity
+			if t == INT64_MIN:
+				return segments.NegInfinity
+			return lsctables.LIGOTimeGPS(int(t // 1000000000), int(t % 1000000000))
+		return segments.segmentlist(segments.segment(gps(a), gps(b)) for a, b in zip(self.starts, self.ends))
+
+	def __len__(self):
+		return len(self.starts)
+
+	def __iter__(self):
+		return iter(zip(self.starts, self.ends))
+
+	def __repr__(self):
+		return "SegmentIndex(%d segments)" % len(self)
+
+	def abs(self):
+		"""
+		Return the total duration of the segments in nanoseconds.
+		"""
+		return int((self.ends - self.starts).sum())
+
+	def extent(self):
+		"""
+		Return the (start, end) in nanoseconds spanned by the segments.
+		"""
+		if not len(self):
+			raise ValueError("empty list")
+		return int(self.starts[0]), int(self.ends[-1])
+
+	def contains(self, times_s, times_ns = None):
+		"""
+		Return a boolean array that is True where the GPS times (seconds
+		and optional nanoseconds) lie within the segments.
+		"""
+		return self.contains_ns(times_to_ns(times_s, times_ns))
+
+	def contains_ns(self, times):
+		"""
+		Like contains() but takes an int64 array of GPS nanoseconds.
+		"""
+		times = numpy.asarray(times, dtype = numpy.int64)
+		if not len(self):
+			return numpy.zeros(times.shape, dtype = bool)
+		idx = numpy.searchsorted(self.starts, times, side = "right") - 1
+		inside = idx >= 0
+		inside &= times < self.ends[numpy.maximum(idx, 0)]
+		return inside
+
+	def contains_time(self, seconds, nanoseconds = 0):
+		"""
+		Return True if the single GPS time seconds + nanoseconds lies
+		within the segments.  Uses bisect on cached Python lists so it is
+		cheap enough to call once per row, e.g. from an SQLite function.
+		"""
+		return self._contains_int(int(seconds) * 1000000000 + int(nanoseconds))
+
+	def _contains_int(self, t):
+		if self._lists is None:
+			self._lists = self.starts.tolist(), self.ends.tolist()
+		starts, ends = self._lists
+		i = bisect.bisect_right(starts, t) - 1
+		return i >= 0 and t < ends[i]
+
+	def __contains__(self, t):
+		return self._contains_int(to_ns(t))
+
+	def __or__(self, other):
+		return _merge(self, other, lambda state: state > 0)
+
+	def __and__(self, other):
+		return _merge(self, other, lambda state: state == 3)
+
+	def __sub__(self, other):
+		return _merge(self, other, lambda state: state == 1)
+
+	def __invert__(self):
+		return SegmentIndex.everything() - self
+
+	@classmethod
+	def everything(cls):
+		"""
+		Return a SegmentIndex spanning all of time.
+		"""
+		new = cls(coalesce = False)
+		new.starts = numpy.array([INT64_MIN], dtype = numpy.int64)
+		new.ends = numpy.array([INT64_MAX], dtype = numpy.int64)
+		return new
+
+	@classmethod
+	def union_all(cls, indexes):
+		"""
+		Return the union of an iterable of SegmentIndex objects.
+		"""
+		indexes = list(indexes)
+		if not indexes:
+			return cls()
+		times = numpy.concatenate([idx.starts for idx in indexes] + [idx.ends for idx in indexes])
+		steps = numpy.concatenate([numpy.ones(len(idx), dtype = numpy.int64) for idx in indexes] + [-numpy.ones(len(idx), dtype = numpy.int64) for idx in indexes])
+		return cls._from_boundaries(times, steps, lambda state: state > 0)
+
+	@classmethod
+	def intersection_all(cls, indexes):
+		"""
+		Return the intersection of a non-empty iterable of SegmentIndex
+		objects.
+		"""
+		indexes = list(indexes)
+		if not indexes:
+			raise ValueError("cannot intersect an empty collection")
+		times = numpy.concatenate([idx.starts for idx in indexes] + [idx.ends for idx in indexes])
+		steps = numpy.concatenate([numpy.ones(len(idx), dtype = numpy.int64) for idx in indexes] + [-numpy.ones(len(idx), dtype = numpy.int64) for idx in indexes])
+		return cls._from_boundaries(times, steps, lambda state: state == len(indexes))
+
+
+def segmentindexdict(segdict):
+	"""
+	Convert a glue.segments.segmentlistdict to a dictionary of
+	SegmentIndex objects keyed by instrument.
+	"""
+	return dict((key, SegmentIndex.from_segmentlist(seglist)) for key, seglist in segdict.items())
@@ -33,6 +33,7 @@ rather than importing _spawaveform directly.
 
 
 import math
+import numpy
 
 
 import lal
@@ -69,6 +70,10 @@ def imrchirptime(m1, m2, fLower, chi, a_hat = 0.98, e_folds = 10):
 
 	from (7-9) of LIGO-P1300156.  
 
+	The arguments may be numpy arrays, in which case they are broadcast
+	against one another and an array of durations is returned, so the
+	durations of a whole bank are found in one call.
+
 	@param m1 Mass 1
 	@param m2 Mass 2
 	@param fLower the starting frequency
@@ -78,12 +83,15 @@ def imrchirptime(m1, m2, fLower, chi, a_hat = 0.98, e_folds = 10):
 	"""
 
 	assert (a_hat < 0.9999999999999999) # demand spin less than 1 (or approximately the closest floating point representation of 1)
-	fFinal = imrffinal(m1, m2, chi, 'ringdown')
-	assert (fFinal > fLower) # demand that the low frequency comes before the ringdown frequency
-	tau = 2 * (m1+m2) * 5e-6 * (0.7 + 1.4187 * (1-a_hat)**-0.4990) / (1.5251 - 1.1568 * (1-a_hat)**0.1292)
-	inspiral_time = chirptime(m1, m2, 7, fLower, fFinal, chi)
-	if inspiral_time < 0:
-		raise ValueError("Inspiral time is negative: m1 = %e, m2 = %e, flow = %e, chi = %e" % (m1, m2, fLower, chi)) # demand positive inspiral times
+	fFinal = imr_ring(m1, m2, chi)
+	assert numpy.all(fFinal > fLower) # demand that the low frequency comes before the ringdown frequency
+	tau = 2 * (numpy.asarray(m1) + m2) * 5e-6 * (0.7 + 1.4187 * (1-a_hat)**-0.4990) / (1.5251 - 1.1568 * (1-a_hat)**0.1292)
+	inspiral_time = chirp_time_between_f1_and_f2(m1, m2, fLower, fFinal, 7, chi)
+	if numpy.any(inspiral_time < 0):
+		# report the first offending template
+		args = [a.ravel() for a in numpy.broadcast_arrays(m1, m2, fLower, chi, inspiral_time)]
+		i = numpy.flatnonzero(args[4] < 0)[0]
+		raise ValueError("Inspiral time is negative: m1 = %e, m2 = %e, flow = %e, chi = %e" % tuple(a[i] for a in args[:4])) # demand positive inspiral times
 	return inspiral_time + e_folds * tau
 
 
@@ -96,7 +104,8 @@ def eta(m1, m2):
 
 def chirpmass(m1, m2):
 	"""
-	Compute the chirp mass in seconds.
+	Compute the chirp mass in seconds.  Like eta(), ms2taus() and
+	taus2ms() this accepts numpy arrays as well as scalars.
 	"""
 	return lal.MTSUN_SI * (m1+m2) * eta(m1, m2)**.6
 
@@ -123,3 +132,105 @@ def taus2ms(tau0, tau3, f0 = 40.0):
 	m2 = M - m1
 
 	return m1 / lal.MTSUN_SI, m2 / lal.MTSUN_SI
+
+
+#
+# =============================================================================
+#
+#                               IIR Filter Banks
+#
+# =============================================================================
+#
+
+
+def pack_iir_sets(iir_sets):
+	"""
+	Concatenate a sequence of (a1, b0, delay) IIR sets, as returned by
+	iir(), into the flat (a1, b0, delay, indptr) arrays taken by the
+	bank-level functions iirfilter(), iirresponses() and
+	iirinnerproducts().  The filters of set t are at positions
+	indptr[t]:indptr[t+1].
+	"""
+	iir_sets = list(iir_sets)
+	lengths = [len(a1) for a1, b0, delay in iir_sets]
+	indptr = numpy.concatenate(([0], numpy.cumsum(lengths, dtype = "intp"))).astype("intp")
+	a1 = numpy.concatenate([numpy.zeros(0, dtype = "complex128")] + [numpy.asarray(a1, dtype = "complex128") for a1, b0, delay in iir_sets])
+	b0 = numpy.concatenate([numpy.zeros(0, dtype = "complex128")] + [numpy.asarray(b0, dtype = "complex128") for a1, b0, delay in iir_sets])
+	delay = numpy.concatenate([numpy.zeros(0, dtype = "intc")] + [numpy.asarray(delay, dtype = "intc") for a1, b0, delay in iir_sets])
+	return a1, b0, delay, indptr
+
+
+def iirbankresponse(iir_sets, length, out = None):
+	"""
+	Return the truncated impulse responses of a sequence of (a1, b0,
+	delay) IIR sets as a complex128 array of shape (len(iir_sets),
+	length).  If out is given it must be a C-contiguous array of that
+	shape and type, and the responses are written into it directly.
+	"""
+	a1, b0, delay, indptr = pack_iir_sets(iir_sets)
+	if out is None:
+		out = numpy.empty((len(indptr) - 1, length), dtype = "complex128")
+	return iirresponses(a1, b0, delay, indptr, out)
+
+
+def iirbankinnerproduct(iir_sets, psd, nthreads = 0):
+	"""
+	Return an array of the inner products, as computed by
+	iirinnerproduct(), of each of a sequence of (a1, b0, delay) IIR
+	sets with itself weighted by psd.  The sets are shared among
+	nthreads threads, by default one per CPU.
+	"""
+	a1, b0, delay, indptr = pack_iir_sets(iir_sets)
+	return iirinnerproducts(a1, b0, delay, indptr, psd, nthreads)
+
+
+class IIRFilterBank(object):
+	"""
+	Streaming filter for a bank of templates, each approximated by a
+	set of single pole IIR filters as constructed by iir().  Data are
+	fed in blocks of any length with filter(), and the filter state is
+	carried from one block to the next so consecutive blocks give the
+	same output as filtering their concatenation.
+
+	Example:
+
+	>>> bank = IIRFilterBank([iir(amp, phase, eps, alpha, beta, padding) for amp, phase in templates])
+	>>> for block in blocks:
+	...	snr = bank.filter(block)	# shape (len(templates), len(block))
+	"""
+	def __init__(self, iir_sets, norms = None):
+		"""
+		iir_sets is a sequence of (a1, b0, delay) tuples, one for
+		each template.  If norms is given, template t's output is
+		scaled by norms[t], e.g. 1 / sqrt(iirinnerproduct(...)) to
+		obtain SNR time series;  the scale is folded into the b0
+		coefficients so it costs nothing while filtering.
+		"""
+		self.a1, self.b0, self.delay, self.indptr = pack_iir_sets(iir_sets)
+		if norms is not None:
+			self.b0 *= numpy.repeat(numpy.asarray(norms, dtype = "float64"), numpy.diff(self.indptr))
+		self.reset()
+
+	def __len__(self):
+		return len(self.indptr) - 1
+
+	def reset(self):
+		"""
+		Clear the filter state, as if no data had been filtered.
+		"""
+		self.y = numpy.zeros(len(self.a1), dtype = "complex128")
+		self.history = numpy.zeros((self.delay.max() if len(self.delay) else 0) + 1, dtype = "float64")
+		self.head = 0
+
+	def filter(self, data, out = None):
+		"""
+		Filter the next block of data and return the outputs of the
+		templates as a complex128 array of shape (len(self),
+		len(data)).  out, if given, must be a C-contiguous array of
+		that shape and type and is filled and returned.
+		"""
+		data = numpy.ascontiguousarray(data, dtype = "float64")
+		if out is None:
+			out = numpy.empty((len(self), len(data)), dtype = "complex128")
+		self.head = iirfilter(self.a1, self.b0, self.delay, self.indptr, self.y, self.history, self.head, data, out)
+		return out
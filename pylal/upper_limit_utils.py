@@ -32,28 +32,72 @@ def margLikelihoodMonteCarlo(VTs, lambs, mu, mcerrs=None):
     return likely
 
 
-def margLikelihood(VTs, lambs, mu, calerr=0, mcerrs=None):
+def logMargLikelihoodMonteCarlo(VTs, lambs, mu, mcerrs=None):
     '''
-    This function marginalizes the loudest event likelihood over unknown
-    Monte Carlo and calibration errors. The vector VTs is the sensitive
-    volumes for independent searches and lambs is the vector of loudest
-    event likelihood. The statistical errors are assumed to be independent
-    between each experiment while the calibration errors are applied
-    the same in each experiment.
+    Log-space, vectorized version of margLikelihoodMonteCarlo. VTs may
+    carry leading axes (e.g. calibration samples) in front of the
+    experiment axis; the result has shape mu.shape + VTs.shape[:-1], so
+    every combination of rate and leading index is evaluated in one pass.
+    Summing logs over experiments avoids the underflow of the product
+    of likelihoods for large mu*VT.
+    '''
+    VTs = numpy.asarray(VTs, dtype=float)
+    lambs = numpy.asarray(lambs, dtype=float)
+    if mcerrs is None:
+        mcerrs = numpy.zeros(VTs.shape[-1])
+    mcerrs = numpy.asarray(mcerrs, dtype=float)
+
+    # broadcast to mu x (leading axes) x experiments
+    mu = numpy.asarray(mu, dtype=float)
+    mu = mu.reshape(mu.shape + (1,)*VTs.ndim)
+    muv = mu*VTs
+
+    # eqn (11) of Biswas et al. where the efficiency is perfectly measured,
+    # eqn (24) where the Monte Carlo error is marginalized over
+    perfect = (mcerrs == 0)
+    k = numpy.where(perfect, 1., (VTs/numpy.where(perfect, 1., mcerrs))**2)
+    loglikely = numpy.where(perfect,
+        numpy.log1p(muv*lambs) - muv,
+        numpy.log1p(muv*(1/k+lambs)) - (k+1)*numpy.log1p(muv/k))
+
+    return loglikely.sum(axis=-1)
+
+
+def logMargLikelihood(VTs, lambs, mu, calerr=0, mcerrs=None, ncal=100):
+    '''
+    Log of margLikelihood. The likelihood is evaluated on a (mu x
+    calibration error x experiment) grid in log space and the calibration
+    errors are marginalized with a log-sum-exp, so no intermediate
+    product can underflow.
     '''
     if calerr == 0:
-        return margLikelihoodMonteCarlo(VTs,lambs,mu,mcerrs)
+        return logMargLikelihoodMonteCarlo(VTs, lambs, mu, mcerrs)
 
     std = calerr
     mean = 0 # median volume = 1
 
-    fracerrs = numpy.linspace(0.33,3,1e2) # assume we got the volume to a factor of three or better
-    errdist = numpy.exp(-(numpy.log(fracerrs)-mean)**2/(2*std**2))/(fracerrs*std) # log-normal pdf
-    errdist /= errdist.sum() #normalize
+    fracerrs = numpy.linspace(0.33,3,ncal) # assume we got the volume to a factor of three or better
+    logerrdist = -(numpy.log(fracerrs)-mean)**2/(2*std**2) - numpy.log(fracerrs*std) # log-normal pdf
+    logerrdist -= numpy.log(numpy.exp(logerrdist - logerrdist.max()).sum()) + logerrdist.max() #normalize
 
-    likely = sum([ pd*margLikelihoodMonteCarlo(delta*VTs,lambs,mu,mcerrs) for delta, pd in zip(fracerrs,errdist)]) #marginalize over errors
+    # shape mu.shape + (ncal,)
+    loglikely = logMargLikelihoodMonteCarlo(fracerrs[:,numpy.newaxis]*numpy.asarray(VTs, dtype=float), lambs, mu, mcerrs) + logerrdist
 
-    return likely
+    #marginalize over errors
+    peak = loglikely.max(axis=-1)
+    return peak + numpy.log(numpy.exp(loglikely - peak[...,numpy.newaxis]).sum(axis=-1))
+
+
+def margLikelihood(VTs, lambs, mu, calerr=0, mcerrs=None):
+    '''
+    This function marginalizes the loudest event likelihood over unknown
+    Monte Carlo and calibration errors. The vector VTs is the sensitive
+    volumes for independent searches and lambs is the vector of loudest
+    event likelihood. The statistical errors are assumed to be independent
+    between each experiment while the calibration errors are applied
+    the same in each experiment.
+    '''
+    return numpy.exp(logMargLikelihood(VTs, lambs, mu, calerr, mcerrs))
 
 
 def integral_element(mu, pdf):
@@ -166,28 +210,46 @@ def hpd_coverage(mu, pdf, thresh):
     return dp[bin_mean > thresh].sum()
 
 
-def hpd_threshold(mu_in, post, alpha, tol):
+def hpd_threshold(mu_in, post, alpha, tol=None):
     '''
     For a PDF post over samples mu_in, find a density 
     threshold such that the region having higher density 
-    has coverage of at least alpha, and less than alpha
-    plus a given tolerance.
+    has coverage of at least alpha.
+
+    The bins are sorted by their mean density once and the coverage is
+    accumulated from the densest bin down, so the threshold is exact and
+    found in O(n log n); tol is accepted for backward compatibility but
+    is no longer needed.
     '''
-    norm_post = normalize_pdf(mu_in, post)
-    # initialize bisection search
-    p_minus = 0.0
-    p_plus = max(post)
-    while abs(hpd_coverage(mu_in, post, p_minus)-hpd_coverage(mu_in, post, p_plus)) >= tol:
-        test = (p_minus + p_plus) /2
-        if hpd_coverage(mu_in, post, test) >= alpha: # test value was too low or just right
-            p_minus = p_test
-        else:                                        # test value was too high
-            p_plus = p_test
-    # p_minus never goes above the required threshold and p_plus never goes below 
-    # thus on exiting p_minus is at or below the required threshold and the 
-    # difference in coverage is within tolerance 
-
-    return p_minus
+    dp = integral_element(mu_in, post)
+    bin_mean = (post[1:] + post[:-1]) /2
+    order = numpy.argsort(bin_mean, kind='mergesort')[::-1]
+    coverage = dp[order].cumsum()/dp.sum()
+    # number of densest bins needed to reach the required coverage
+    nbins = numpy.searchsorted(coverage, alpha) + 1
+    # the threshold is the highest density below that of the last bin
+    # needed, so that bins tied with it are kept above the threshold
+    lower = bin_mean[bin_mean < bin_mean[order[min(nbins, len(order))-1]]]
+    if not len(lower):
+        return 0.0
+    return lower.max()
+
+
+def compute_upper_limits(mu_in, posts, alpha = 0.9):
+    """
+    Vectorized compute_upper_limit for many posteriors at once, e.g. for
+    several mass bins or bootstrap realizations. posts has the samples of
+    each posterior along its last axis and the limits are returned with
+    the shape of the remaining axes.
+    """
+    if not 0 < alpha < 1:
+        raise ValueError, "Confidence level must be in (0,1)."
+    posts = numpy.asarray(posts, dtype=float)
+    dp = (mu_in[1:] - mu_in[:-1]) * (posts[...,1:] + posts[...,:-1]) /2
+    cdf = dp.cumsum(axis=-1)
+    # equivalent to bisect_left on each normalized cdf
+    high_idx = (cdf < alpha*cdf[...,-1:]).sum(axis=-1)
+    return mu_in[high_idx]
 
 
 def hpd_credible_interval(mu_in, post, alpha = 0.9, tolerance = 1e-3):
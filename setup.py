@@ -264,10 +264,16 @@ setup(
             runtime_library_dirs = lal_pkg_config.libdirs + lalinspiral_pkg_config.libdirs,
             extra_compile_args = lal_pkg_config.extra_cflags
         ),
+        Extension(
+            "pylal._multiinspiralutils",
+            ["src/_multiinspiralutils.c"],
+            include_dirs = [numpy_get_include()],
+            extra_compile_args = ["-std=c99"]
+        ),
         Extension(
             "pylal.inspiral_metric",
             ["src/inspiral_metric.c", "src/xlal/misc.c"],
-            include_dirs = lal_pkg_config.incdirs + lalinspiral_pkg_config.incdirs + ["src/xlal/", "src/xlal/datatypes/"],
+            include_dirs = lal_pkg_config.incdirs + lalinspiral_pkg_config.incdirs + [numpy_get_include(), "src/xlal/", "src/xlal/datatypes/"],
             libraries = lal_pkg_config.libs + lalinspiral_pkg_config.libs,
             library_dirs = lal_pkg_config.libdirs + lalinspiral_pkg_config.libdirs,
             runtime_library_dirs = lal_pkg_config.libdirs + lalinspiral_pkg_config.libdirs,
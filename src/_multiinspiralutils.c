@@ -0,0 +1,330 @@
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+/*
+ * ============================================================================
+ *
+ *              Compiled Helpers for pylal.MultiInspiralUtils
+ *
+ * ============================================================================
+ */
+
+
+#include <Python.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <numpy/arrayobject.h>
+
+
+#define MODULE_NAME "pylal._multiinspiralutils"
+
+
+/*
+ * ============================================================================
+ *
+ *                              Time-Bin Clustering
+ *
+ * ============================================================================
+ */
+
+
+/*
+ * Python's float floor division, so that the bins are exactly those of the
+ * pure Python implementation this replaces.
+ */
+
+
+static double py_floordiv(double a, double b)
+{
+	double mod = fmod(a, b);
+	double div = (a - mod) / b;
+	double floordiv;
+
+	if(mod && ((b < 0) != (mod < 0)))
+		div -= 1.0;
+	if(div) {
+		floordiv = floor(div);
+		if(div - floordiv > 0.5)
+			floordiv += 1.0;
+	} else
+		floordiv = copysign(0.0, a / b);
+
+	return floordiv;
+}
+
+
+/*
+ * Sort the row indices into time bins of width dt.  On success, rows holds
+ * the row indices grouped by bin, each bin's rows in their original order,
+ * and the rows of bin i are rows[offsets[i]] to rows[offsets[i + 1] - 1].
+ * Returns the number of bins, or -1 if a row falls outside the bins.
+ */
+
+
+static npy_intp bin_rows(const double *end_time, npy_intp n, double dt, npy_intp **rows, npy_intp **offsets)
+{
+	double tmin = end_time[0], tmax = end_time[0];
+	double start, end;
+	npy_intp num_bins;
+	npy_intp *bin;
+	npy_intp i;
+
+	for(i = 1; i < n; i++) {
+		if(end_time[i] < tmin)
+			tmin = end_time[i];
+		if(end_time[i] > tmax)
+			tmax = end_time[i];
+	}
+	start = round(tmin);
+	end = round(tmax + 1);
+	num_bins = (npy_intp) py_floordiv(end - start, dt) + 1;
+
+	bin = malloc(n * sizeof(*bin));
+	*rows = malloc(n * sizeof(**rows));
+	*offsets = calloc(num_bins + 1, sizeof(**offsets));
+	if(!bin || !*rows || !*offsets) {
+		free(bin);
+		free(*rows);
+		free(*offsets);
+		*rows = *offsets = NULL;
+		return -2;
+	}
+
+	/* counting sort on the bin number.  start is rounded, so rows
+	 * slightly earlier than start get a bin number of -1 (or less) which,
+	 * being used as a Python list index, has always meant a bin counted
+	 * from the end;  keep that. */
+	for(i = 0; i < n; i++) {
+		npy_intp b = (npy_intp) py_floordiv(end_time[i] - start, dt);
+		if(b < 0)
+			b += num_bins;
+		if(b < 0 || b >= num_bins) {
+			free(bin);
+			free(*rows);
+			free(*offsets);
+			*rows = *offsets = NULL;
+			return -1;
+		}
+		bin[i] = b;
+		(*offsets)[b + 1]++;
+	}
+	for(i = 0; i < num_bins; i++)
+		(*offsets)[i + 1] += (*offsets)[i];
+	for(i = 0; i < n; i++)
+		(*rows)[(*offsets)[bin[i]]++] = i;
+	/* the fill advanced each offset to the start of the next bin */
+	for(i = num_bins; i > 0; i--)
+		(*offsets)[i] = (*offsets)[i - 1];
+	(*offsets)[0] = 0;
+
+	free(bin);
+	return num_bins;
+}
+
+
+/*
+ * Cluster one ranking statistic.  The indices of the surviving rows are
+ * written to keep in bin order and their number is returned.  loudest_stat
+ * and loudest_time are scratch arrays of length num_bins.
+ */
+
+
+static npy_intp cluster_stat(const double *end_time, const double *stat, const npy_intp *rows, const npy_intp *offsets, npy_intp num_bins, double dt, double *loudest_stat, double *loudest_time, npy_intp *keep)
+{
+	npy_intp nkeep = 0;
+	npy_intp i, j;
+
+	/* the loudest event in each bin */
+	for(i = 0; i < num_bins; i++) {
+		loudest_stat[i] = 0.0;
+		loudest_time[i] = 0.0;
+		for(j = offsets[i]; j < offsets[i + 1]; j++)
+			if(stat[rows[j]] > loudest_stat[i]) {
+				loudest_stat[i] = stat[rows[j]];
+				loudest_time[i] = end_time[rows[j]];
+			}
+	}
+
+	for(i = 0; i < num_bins; i++) {
+		int check_prev = i > 0 && offsets[i - 1] < offsets[i];
+		int check_next = i < num_bins - 1 && offsets[i + 1] < offsets[i + 2];
+		npy_intp idx;
+		double s, t;
+		int loudest = 1;
+
+		if(offsets[i] == offsets[i + 1])
+			continue;
+
+		/* pick the loudest event in the bin, the first one on ties */
+		idx = rows[offsets[i]];
+		for(j = offsets[i] + 1; j < offsets[i + 1]; j++)
+			if(stat[rows[j]] > stat[idx])
+				idx = rows[j];
+		s = stat[idx];
+		t = end_time[idx];
+
+		/* is the loudest event in a neighbouring bin louder and within
+		 * the window? */
+		if(check_prev && (t - loudest_time[i - 1]) < dt && s < loudest_stat[i - 1])
+			continue;
+		if(check_next && (loudest_time[i + 1] - t) < dt && s < loudest_stat[i + 1])
+			continue;
+
+		/* if not, look for any louder event within the window */
+		if(check_prev && !((t - loudest_time[i - 1]) < dt))
+			for(j = offsets[i - 1]; j < offsets[i]; j++)
+				if((t - end_time[rows[j]]) < dt && s < stat[rows[j]]) {
+					loudest = 0;
+					break;
+				}
+		if(loudest && check_next && !((loudest_time[i + 1] - t) < dt))
+			for(j = offsets[i + 1]; j < offsets[i + 2]; j++)
+				if((end_time[rows[j]] - t) < dt && s < stat[rows[j]]) {
+					loudest = 0;
+					break;
+				}
+
+		if(loudest)
+			keep[nkeep++] = idx;
+	}
+
+	return nkeep;
+}
+
+
+static PyObject *pylal_cluster_time_bins(PyObject *self, PyObject *args)
+{
+	PyObject *end_time_obj, *stat_obj;
+	PyArrayObject *end_time = NULL, *stat = NULL;
+	PyObject *result = NULL;
+	double dt;
+	npy_intp n, ncols, num_bins, col;
+	npy_intp *rows = NULL, *offsets = NULL, *keep = NULL, *nkeep = NULL;
+	double *scratch = NULL;
+
+	if(!PyArg_ParseTuple(args, "OOd", &end_time_obj, &stat_obj, &dt))
+		return NULL;
+	if(!(dt > 0)) {
+		PyErr_SetString(PyExc_ValueError, "dt must be positive");
+		return NULL;
+	}
+
+	end_time = (PyArrayObject *) PyArray_FROM_OTF(end_time_obj, NPY_DOUBLE, NPY_IN_ARRAY);
+	stat = (PyArrayObject *) PyArray_FROM_OTF(stat_obj, NPY_DOUBLE, NPY_IN_ARRAY);
+	if(!end_time || !stat)
+		goto done;
+	if(PyArray_NDIM(end_time) != 1 || (PyArray_NDIM(stat) != 1 && PyArray_NDIM(stat) != 2)) {
+		PyErr_SetString(PyExc_ValueError, "end_time must be 1-D and stat 1-D or 2-D");
+		goto done;
+	}
+	n = PyArray_DIM(end_time, 0);
+	ncols = PyArray_NDIM(stat) == 2 ? PyArray_DIM(stat, 0) : 1;
+	if(PyArray_DIM(stat, PyArray_NDIM(stat) - 1) != n) {
+		PyErr_SetString(PyExc_ValueError, "stat rows must have the same length as end_time");
+		goto done;
+	}
+
+	keep = malloc((n * ncols + 1) * sizeof(*keep));
+	nkeep = malloc((ncols + 1) * sizeof(*nkeep));
+	if(!keep || !nkeep) {
+		PyErr_NoMemory();
+		goto done;
+	}
+
+	num_bins = 0;
+	if(n) {
+		const double *t = PyArray_DATA(end_time);
+		const double *s = PyArray_DATA(stat);
+
+		Py_BEGIN_ALLOW_THREADS
+		num_bins = bin_rows(t, n, dt, &rows, &offsets);
+		if(num_bins > 0)
+			scratch = malloc(2 * num_bins * sizeof(*scratch));
+		if(scratch)
+			for(col = 0; col < ncols; col++)
+				nkeep[col] = cluster_stat(t, s + col * n, rows, offsets, num_bins, dt, scratch, scratch + num_bins, keep + col * n);
+		Py_END_ALLOW_THREADS
+
+		if(num_bins == -1) {
+			PyErr_SetString(PyExc_IndexError, "end_time outside of the clustering bins");
+			goto done;
+		}
+		if(!scratch) {
+			PyErr_NoMemory();
+			goto done;
+		}
+	} else
+		for(col = 0; col < ncols; col++)
+			nkeep[col] = 0;
+
+	/* one array of row indices per stat row */
+	result = PyList_New(ncols);
+	if(!result)
+		goto done;
+	for(col = 0; col < ncols; col++) {
+		PyObject *indices = PyArray_SimpleNew(1, &nkeep[col], NPY_INTP);
+		if(!indices) {
+			Py_DECREF(result);
+			result = NULL;
+			goto done;
+		}
+		memcpy(PyArray_DATA((PyArrayObject *) indices), keep + col * n, nkeep[col] * sizeof(*keep));
+		PyList_SET_ITEM(result, col, indices);
+	}
+	if(PyArray_NDIM(stat) == 1) {
+		PyObject *indices = PyList_GET_ITEM(result, 0);
+		Py_INCREF(indices);
+		Py_DECREF(result);
+		result = indices;
+	}
+
+done:
+	Py_XDECREF(end_time);
+	Py_XDECREF(stat);
+	free(rows);
+	free(offsets);
+	free(keep);
+	free(nkeep);
+	free(scratch);
+	return result;
+}
+
+
+/*
+ * ============================================================================
+ *
+ *                            Module Registration
+ *
+ * ============================================================================
+ */
+
+
+static struct PyMethodDef methods[] = {
+	{"cluster_time_bins", pylal_cluster_time_bins, METH_VARARGS, "cluster_time_bins(end_time, stat, dt)\n\nCluster events in time bins of width dt, as in\nMultiInspiralUtils.cluster_multi_inspirals().  Returns an array of the\nindices of the events that are loudest in their bin and louder than the\nevents within dt of them in the neighbouring bins.  stat may be 2-D, one\nrow per ranking statistic, in which case a list with one array of indices\nper row is returned."},
+	{NULL,}
+};
+
+
+PyMODINIT_FUNC init_multiinspiralutils(void)
+{
+	PyObject *module = Py_InitModule3(MODULE_NAME, methods, "Compiled helpers for pylal.MultiInspiralUtils.");
+	if(!module)
+		return;
+
+	import_array();
+}
@@ -5,6 +5,9 @@
 #include <math.h>
 #include <complex.h>
 #include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
 
 /* LAL Includes */
 
@@ -12,6 +15,7 @@
 #include <lal/LALStdlib.h>
 #include <lal/Units.h>
 #include <lal/LALInspiral.h>
+#include <lal/ComplexFFT.h>
 
 /* GSL includes */
 #include <gsl/gsl_complex.h>
@@ -23,23 +27,41 @@
 #include <gsl/gsl_blas.h>
 
 #include <numpy/arrayobject.h>
+#include <numpy/ufuncobject.h>
 
 
+/*
+ * Where the waveform generators write their output:  bin k of the
+ * frequency series is at data + k * stride, stored as complex double or,
+ * if single is set, complex float, and only bins kmin <= k < kmax are
+ * touched.  This lets a waveform be written straight into a row of a
+ * caller's template bank matrix, in single precision, and without
+ * zeroing the parts of the row outside the band of interest.
+ */
+typedef struct {
+	char *data;
+	npy_intp stride;
+	int single;
+	int kmin;
+	int kmax;
+} SPAOutput;
+
 /* static functions used by the python wrappers */
-static int SPAWaveform (double mass1, double mass2, int order, double deltaF, double deltaT, double fLower, double fFinal, int numPoints, complex double *expPsi);
+static int SPAWaveform (double mass1, double mass2, int order, double deltaF, double deltaT, double fLower, double fFinal, int numPoints, SPAOutput *out);
 static double chirp_time (double m1, double m2, double fLower, int order,double chi);
 static double chirp_time_between_f1_and_f2(double m1, double m2, double fLower, double fUpper, int order, double chi);
 static double schwarz_isco(double m1, double m2);
 static double bkl_isco(double m1, double m2);
 static double light_ring(double m1, double m2);
-static int IMRSPAWaveform(double mass1, double mass2, double spin1,  double spin2, double deltaF, double fLower, int numPoints, complex double *hOfF);
-static int SPAWaveformReduceSpin (double mass1, double mass2, double chi, int order, double startTime, double phi0, double deltaF, double fLower, double fFinal, int numPoints, complex double *hOfF);
-static int IMRSPAWaveformFromChi(double mass1, double mass2, double chi, double deltaF, double fLower, int numPoints, complex double *hOfF);
-static int GenericSPAWaveform (double *psis, double *psils, int order, double deltaF, double deltaT, double fLower, double fFinal, int numPoints, complex double *expPsi);
+static int IMRSPAWaveform(double mass1, double mass2, double spin1,  double spin2, double deltaF, double fLower, int numPoints, SPAOutput *out);
+static int SPAWaveformReduceSpin (double mass1, double mass2, double chi, int order, double startTime, double phi0, double deltaF, double fLower, double fFinal, int numPoints, SPAOutput *out);
+static int IMRSPAWaveformFromChi(double mass1, double mass2, double chi, double deltaF, double fLower, int numPoints, SPAOutput *out);
+static int GenericSPAWaveform (double *psis, double *psils, int order, double deltaF, double deltaT, double fLower, double fFinal, int numPoints, SPAOutput *out);
 static double imr_merger(double m1, double m2, double chi);
 static double imr_ring(double m1, double m2, double chi);
 static double imr_fcut(double m1, double m2, double chi);
 static double compute_chi(double m1, double m2, double spin1, double spin2);
+static npy_intp IIRFilterBank(const complex double *a1, const complex double *b0, const int *delay, const npy_intp *indptr, npy_intp ntemplates, npy_intp nfilters, complex double *y, double *history, npy_intp historylength, npy_intp head, const double *data, npy_intp nsamples, complex double *snr);
 
 /* doc string for help() */
 const char SPADocstring[] =
@@ -125,120 +147,145 @@ static PyObject *PyComputeChi(PyObject *self, PyObject *args)
 	return Py_BuildValue("d",compute_chi(mass1, mass2, spin1, spin2));
 	}
 
+/* Set up an SPAOutput for writing into the numpy array obj, which must be
+ * a writeable 1-D complex128 or complex64 array but may have any stride
+ * (e.g. a row or column of a 2-D array).  Only bins kmin <= k < kmax will
+ * be written;  kmax < 0 means the end of the array.  Returns 0 on
+ * success or -1 with an exception set. */
+static int SPAOutputFromArray(PyObject *obj, int kmin, int kmax, SPAOutput *out, int *numPoints)
+	{
+	if (!PyArray_Check(obj)) {
+		PyErr_SetString(PyExc_TypeError, "signalArray must be a numpy array");
+		return -1;
+		}
+	if (PyArray_TYPE(obj) != NPY_CDOUBLE && PyArray_TYPE(obj) != NPY_CFLOAT) {
+		PyErr_SetString(PyExc_TypeError, "signalArray must be complex128 or complex64");
+		return -1;
+		}
+	if (PyArray_NDIM(obj) != 1) {
+		PyErr_SetString(PyExc_ValueError, "signalArray must be 1-D, pass a row of a 2-D array to fill it in place");
+		return -1;
+		}
+	if (!PyArray_ISWRITEABLE(obj)) {
+		PyErr_SetString(PyExc_ValueError, "signalArray is not writeable");
+		return -1;
+		}
+	*numPoints = PyArray_DIM(obj, 0);
+	out->data = PyArray_DATA(obj);
+	out->stride = PyArray_STRIDE(obj, 0);
+	out->single = PyArray_TYPE(obj) == NPY_CFLOAT;
+	out->kmin = kmin > 0 ? kmin : 0;
+	out->kmax = kmax < 0 || kmax > *numPoints ? *numPoints : kmax;
+	return 0;
+	}
+
 /* Function to compute the frequency domain SPA waveform */
-static PyObject *PySPAWaveform(PyObject *self, PyObject *args)
+static PyObject *PySPAWaveform(PyObject *self, PyObject *args, PyObject *keywds)
 	{
 	/* Generate a SPA (frequency domain) waveform at a given PN order */
-	PyObject *arg9, *py_spa_array;
+	PyObject *arg9;
 	double mass1, mass2, deltaF, deltaT, fLower, fFinal;
-	int order;
-	npy_intp *dims = NULL;
-	complex double *data = NULL;
+	int order, numPoints;
+	int kmin = 0, kmax = -1;
+	SPAOutput out;
 	double spin1 = -100.0;
 	double spin2 = -100.0;
 	double chi = 0.0;
+	char *kwlist[] = {"m1", "m2", "order", "deltaF", "deltaT", "fLower", "fFinal", "signalArray", "spin1", "spin2", "kmin", "kmax", NULL};
 
-	/* FIXME properly handle references */
-	if(!PyArg_ParseTuple(args, "ddiddddO|dd", &mass1, &mass2, &order, &deltaF, &deltaT, &fLower, &fFinal, &arg9, &spin1, &spin2)) return NULL;
-	/* this gets a contiguous memory numpy array */
-        py_spa_array = PyArray_FROM_OTF(arg9, NPY_CDOUBLE, NPY_IN_ARRAY);
-	if (py_spa_array == NULL) return NULL;
+	if(!PyArg_ParseTupleAndKeywords(args, keywds, "ddiddddO|ddii", kwlist, &mass1, &mass2, &order, &deltaF, &deltaT, &fLower, &fFinal, &arg9, &spin1, &spin2, &kmin, &kmax)) return NULL;
+	/* the waveform is written directly into the caller's array */
+	if (SPAOutputFromArray(arg9, kmin, kmax, &out, &numPoints)) return NULL;
 	/* Actually call the SPA waveform C function */
-	/* FIXME no checking of the array dimensions, this could be done in a python wrapper */
-	dims = PyArray_DIMS(py_spa_array);
-	data = PyArray_DATA(py_spa_array);
 	if (spin1 == -100.0 && spin2 == -100.0)
-		SPAWaveform(mass1, mass2, order, deltaF, deltaT, fLower, fFinal, dims[0], data);
+		SPAWaveform(mass1, mass2, order, deltaF, deltaT, fLower, fFinal, numPoints, &out);
 	if (spin1 != -100.0 && spin2 == -100.0) {
 		chi = spin1; // only one spin argument is interpreted as chi
-		SPAWaveformReduceSpin(mass1, mass2, chi, order, 0.0, 0.0, deltaF, fLower, fFinal, dims[0], data);
+		SPAWaveformReduceSpin(mass1, mass2, chi, order, 0.0, 0.0, deltaF, fLower, fFinal, numPoints, &out);
 		}
 	if (spin1 != -100.0 && spin2 != -100.0)	{
 		chi = compute_chi(mass1, mass2, spin1, spin2);
-		SPAWaveformReduceSpin(mass1, mass2, chi, order, 0.0, 0.0, deltaF, fLower, fFinal, dims[0], data);
+		SPAWaveformReduceSpin(mass1, mass2, chi, order, 0.0, 0.0, deltaF, fLower, fFinal, numPoints, &out);
 		}
-	Py_DECREF(py_spa_array);
         Py_INCREF(Py_None);
         return Py_None;
 	}
 
 /* Function to compute the frequency domain IMR waveform */
-static PyObject *PyIMRSPAWaveform(PyObject *self, PyObject *args)
+static PyObject *PyIMRSPAWaveform(PyObject *self, PyObject *args, PyObject *keywds)
 	{
 	/* Generate a SPA (frequency domain) waveform at a given PN order */
-	PyObject *arg9, *py_spa_array;
+	PyObject *arg9;
 	double mass1, mass2, deltaF, fLower;
-	npy_intp *dims = NULL;
-	complex double *data = NULL;
+	int numPoints;
+	int kmin = 0, kmax = -1;
+	SPAOutput out;
 	/*FIXME get rid of this hack to handle optional spin arguments */
 	double spin1 = -100.0;
 	double spin2 = -100.0;
-	/* FIXME properly handle references */
-	if (!PyArg_ParseTuple(args, "ddddO|dd", &mass1, &mass2, &deltaF, &fLower, &arg9, &spin1, &spin2)) return NULL;
+	char *kwlist[] = {"m1", "m2", "deltaF", "fLower", "signalArray", "spin1", "spin2", "kmin", "kmax", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "ddddO|ddii", kwlist, &mass1, &mass2, &deltaF, &fLower, &arg9, &spin1, &spin2, &kmin, &kmax)) return NULL;
 	/* Check for no spin case */
 	if (spin1 == -100.0 && spin2 == -100.0) spin1 = spin2 = 0.0;
-	/* this gets a contiguous memory numpy array */
-        py_spa_array = PyArray_FROM_OTF(arg9, NPY_CDOUBLE, NPY_IN_ARRAY);
-	if (py_spa_array == NULL) return NULL;
-	/* Actually call the SPA waveform C function */
-	/* FIXME no checking of the array dimensions, this could be done in a python wrapper */
-	dims = PyArray_DIMS(py_spa_array);
-	data = PyArray_DATA(py_spa_array);
+	/* the waveform is written directly into the caller's array */
+	if (SPAOutputFromArray(arg9, kmin, kmax, &out, &numPoints)) return NULL;
 	/* depending on the number of arguments given call a different function */
-	if (spin1 != -100.0 && spin2 == -100.0) IMRSPAWaveformFromChi(mass1, mass2, spin1, deltaF, fLower, dims[0], data);
-	else IMRSPAWaveform(mass1, mass2, spin1, spin2, deltaF, fLower, dims[0], data);
-	Py_DECREF(py_spa_array);
+	if (spin1 != -100.0 && spin2 == -100.0) IMRSPAWaveformFromChi(mass1, mass2, spin1, deltaF, fLower, numPoints, &out);
+	else IMRSPAWaveform(mass1, mass2, spin1, spin2, deltaF, fLower, numPoints, &out);
         Py_INCREF(Py_None);
         return Py_None;
 	}
 
 /* Function to compute the frequency domain generic inspiral waveform */
-static PyObject *PyGenericSPAWaveform(PyObject *self, PyObject *args)
+static PyObject *PyGenericSPAWaveform(PyObject *self, PyObject *args, PyObject *keywds)
 	{
 	/* Generate a generic SPA (frequency domain) waveform of given PN order */
 	PyObject *arg1, *py_psi_array;
 	PyObject *arg2, *py_psil_array;
-	PyObject *arg8, *py_spa_array;
+	PyObject *arg8;
 	double deltaF, deltaT, fLower, fFinal;
-	int order;
+	int order, numPoints;
+	int kmin = 0, kmax = -1;
+	SPAOutput out;
 	npy_intp *psidims = NULL;
 	double *psis = NULL;
 	npy_intp *psildims = NULL;
 	double *psils = NULL;
-	npy_intp *dims = NULL;
-	complex double *data = NULL;
+	char *kwlist[] = {"psis", "psils", "order", "deltaF", "deltaT", "fLower", "fFinal", "signalArray", "kmin", "kmax", NULL};
 
-	/* FIXME properly handle references */
-	if(!PyArg_ParseTuple(args, "OOiddddO", &arg1, &arg2, &order, &deltaF, &deltaT, &fLower, &fFinal, &arg8)) return NULL;
+	if(!PyArg_ParseTupleAndKeywords(args, keywds, "OOiddddO|ii", kwlist, &arg1, &arg2, &order, &deltaF, &deltaT, &fLower, &fFinal, &arg8, &kmin, &kmax)) return NULL;
+	/* the waveform is written directly into the caller's array */
+	if (SPAOutputFromArray(arg8, kmin, kmax, &out, &numPoints)) return NULL;
 	/* this gets a contiguous memory numpy arrays */
         py_psi_array = PyArray_FROM_OTF(arg1, NPY_DOUBLE, NPY_IN_ARRAY);
 	if (py_psi_array == NULL) return NULL;
         py_psil_array = PyArray_FROM_OTF(arg2, NPY_DOUBLE, NPY_IN_ARRAY);
-	if (py_psil_array == NULL) return NULL;
-        py_spa_array = PyArray_FROM_OTF(arg8, NPY_CDOUBLE, NPY_IN_ARRAY);
-	if (py_spa_array == NULL) return NULL;
+	if (py_psil_array == NULL) {
+		Py_DECREF(py_psi_array);
+		return NULL;
+		}
 
 	/* get PN coefficients and check they match the order requested */
 	psidims = PyArray_DIMS(py_psi_array);
 	psis = PyArray_DATA(py_psi_array);
 	psildims = PyArray_DIMS(py_psil_array);
 	psils = PyArray_DATA(py_psil_array);
-	if (order != psidims[0]-1) return NULL;
-	if (order != psildims[0]-1) return NULL;
+	if (order != psidims[0]-1 || order != psildims[0]-1) {
+		PyErr_SetString(PyExc_ValueError, "psis and psils must have order + 1 elements");
+		Py_DECREF(py_psi_array);
+		Py_DECREF(py_psil_array);
+		return NULL;
+		}
 
 	/* Actually call the SPA waveform C function */
-	/* FIXME no checking of the array dimensions, this could be done in a python wrapper */
-	dims = PyArray_DIMS(py_spa_array);
-	data = PyArray_DATA(py_spa_array);
-	GenericSPAWaveform(psis, psils, order, deltaF, deltaT, fLower, fFinal, dims[0], data);
+	GenericSPAWaveform(psis, psils, order, deltaF, deltaT, fLower, fFinal, numPoints, &out);
 	Py_DECREF(py_psi_array);
 	Py_DECREF(py_psil_array);
-	Py_DECREF(py_spa_array);
         Py_INCREF(Py_None);
         return Py_None;
 	}
 
-/* Function to wrap GSLs SVD */
 static PyObject *PySVD(PyObject *self, PyObject *args, PyObject *keywds)
         {
 
@@ -488,23 +535,701 @@ static PyObject *PyIIRInnerProduct(PyObject *self, PyObject *args)
 	return Py_BuildValue("d", ip);
 }
 
+/* Convert the concatenated filters of a bank of IIR sets to contiguous
+ * arrays, stored in bank[0..3] as a1, b0, delay and indptr, and check
+ * their consistency.  The filters of template t are at positions
+ * indptr[t] ... indptr[t + 1] - 1.  Returns the number of templates, or
+ * -1 with an exception set, in which case the caller must still
+ * Py_XDECREF() the four arrays. */
+static npy_intp IIRBankArrays(PyObject *a1, PyObject *b0, PyObject *delay, PyObject *indptr, PyObject **bank)
+{
+	npy_intp nfilters, ntemplates, k;
+	npy_intp *indptr_data;
+
+	bank[0] = PyArray_FROM_OTF(a1, NPY_CDOUBLE, NPY_IN_ARRAY);
+	bank[1] = PyArray_FROM_OTF(b0, NPY_CDOUBLE, NPY_IN_ARRAY);
+	bank[2] = PyArray_FROM_OTF(delay, NPY_INT, NPY_IN_ARRAY);
+	bank[3] = PyArray_FROM_OTF(indptr, NPY_INTP, NPY_IN_ARRAY);
+	if (!bank[0] || !bank[1] || !bank[2] || !bank[3]) return -1;
+
+	nfilters = PyArray_SIZE(bank[0]);
+	ntemplates = PyArray_SIZE(bank[3]) - 1;
+	indptr_data = PyArray_DATA(bank[3]);
+	if (PyArray_SIZE(bank[1]) != nfilters || PyArray_SIZE(bank[2]) != nfilters) {
+		PyErr_SetString(PyExc_ValueError, "a1, b0 and delay must have the same length");
+		return -1;
+	}
+	if (ntemplates < 0 || indptr_data[0] != 0 || indptr_data[ntemplates] != nfilters) {
+		PyErr_SetString(PyExc_ValueError, "indptr must run from 0 to the number of filters");
+		return -1;
+	}
+	for (k = 0; k < ntemplates; k++) if (indptr_data[k + 1] < indptr_data[k]) {
+		PyErr_SetString(PyExc_ValueError, "indptr must be non-decreasing");
+		return -1;
+	}
+
+	return ntemplates;
+}
+
+static PyObject *PyIIRFilter(PyObject *self, PyObject *args)
+{
+	PyObject *a1, *b0, *delay, *indptr, *y, *history, *data, *snr;
+	PyObject *bank[4] = {NULL, NULL, NULL, NULL};
+	PyObject *y_array = NULL, *history_array = NULL, *data_array = NULL, *snr_array = NULL;
+	PyObject *out = NULL;
+	npy_intp nfilters, ntemplates, nsamples, historylength, k;
+	int *delay_data;
+	Py_ssize_t head;
+
+	if (!PyArg_ParseTuple(args, "OOOOOOnOO", &a1, &b0, &delay, &indptr, &y, &history, &head, &data, &snr)) return NULL;
+	ntemplates = IIRBankArrays(a1, b0, delay, indptr, bank);
+	if (ntemplates < 0) goto done;
+	data_array = PyArray_FROM_OTF(data, NPY_DOUBLE, NPY_IN_ARRAY);
+	/* the filter state and output are modified in place so must
+	 * already be contiguous arrays of the right type */
+	y_array = PyArray_FROM_OTF(y, NPY_CDOUBLE, NPY_INOUT_ARRAY);
+	history_array = PyArray_FROM_OTF(history, NPY_DOUBLE, NPY_INOUT_ARRAY);
+	snr_array = PyArray_FROM_OTF(snr, NPY_CDOUBLE, NPY_INOUT_ARRAY);
+	if (!data_array || !y_array || !history_array || !snr_array) goto done;
+
+	nfilters = PyArray_SIZE(bank[0]);
+	nsamples = PyArray_SIZE(data_array);
+	historylength = PyArray_SIZE(history_array);
+	delay_data = PyArray_DATA(bank[2]);
+	if (PyArray_SIZE(y_array) != nfilters) {
+		PyErr_SetString(PyExc_ValueError, "y must have one element per filter");
+		goto done;
+	}
+	for (k = 0; k < nfilters; k++) if (delay_data[k] < 0 || delay_data[k] >= historylength) {
+		PyErr_SetString(PyExc_ValueError, "delays must be non-negative and less than the history length");
+		goto done;
+	}
+	if (head < 0 || head >= historylength) {
+		PyErr_SetString(PyExc_ValueError, "head must index the history");
+		goto done;
+	}
+	if (PyArray_SIZE(snr_array) != ntemplates * nsamples) {
+		PyErr_SetString(PyExc_ValueError, "snr must have room for len(indptr) - 1 time series of len(data) samples");
+		goto done;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	head = IIRFilterBank(PyArray_DATA(bank[0]), PyArray_DATA(bank[1]), delay_data, PyArray_DATA(bank[3]), ntemplates, nfilters, PyArray_DATA(y_array), PyArray_DATA(history_array), historylength, head, PyArray_DATA(data_array), nsamples, PyArray_DATA(snr_array));
+	Py_END_ALLOW_THREADS
+	if (head < 0)
+		PyErr_NoMemory();
+	else
+		out = Py_BuildValue("n", head);
+
+done:
+	for (k = 0; k < 4; k++) Py_XDECREF(bank[k]);
+	Py_XDECREF(data_array);
+	Py_XDECREF(y_array);
+	Py_XDECREF(history_array);
+	Py_XDECREF(snr_array);
+
+	return out;
+}
+
+static PyObject *PyIIRResponses(PyObject *self, PyObject *args)
+{
+	PyObject *a1, *b0, *delay, *indptr, *resp;
+	PyObject *bank[4] = {NULL, NULL, NULL, NULL};
+	PyObject *resp_array = NULL;
+	PyObject *out = NULL;
+	npy_intp ntemplates, length, t, k;
+	npy_intp *indptr_data;
+	int failed = 0;
+
+	if (!PyArg_ParseTuple(args, "OOOOO", &a1, &b0, &delay, &indptr, &resp)) return NULL;
+	ntemplates = IIRBankArrays(a1, b0, delay, indptr, bank);
+	if (ntemplates < 0) goto done;
+	resp_array = PyArray_FROM_OTF(resp, NPY_CDOUBLE, NPY_INOUT_ARRAY);
+	if (!resp_array) goto done;
+	if (PyArray_NDIM(resp_array) != 2 || PyArray_DIM(resp_array, 0) != ntemplates) {
+		PyErr_SetString(PyExc_ValueError, "response array must be 2-D with one row per template");
+		goto done;
+	}
+	length = PyArray_DIM(resp_array, 1);
+	indptr_data = PyArray_DATA(bank[3]);
+
+	/* each row of the output is handed to LAL as the response vector,
+	 * so nothing is allocated or copied */
+	Py_BEGIN_ALLOW_THREADS
+	for (t = 0; t < ntemplates && !failed; t++) {
+		COMPLEX16Vector a1_complex16, b0_complex16, resp_complex16;
+		INT4Vector delay_int4;
+		a1_complex16.length = b0_complex16.length = delay_int4.length = indptr_data[t + 1] - indptr_data[t];
+		a1_complex16.data = (COMPLEX16 *) PyArray_DATA(bank[0]) + indptr_data[t];
+		b0_complex16.data = (COMPLEX16 *) PyArray_DATA(bank[1]) + indptr_data[t];
+		delay_int4.data = (INT4 *) PyArray_DATA(bank[2]) + indptr_data[t];
+		resp_complex16.length = length;
+		resp_complex16.data = (COMPLEX16 *) PyArray_DATA(resp_array) + t * length;
+		failed = XLALInspiralIIRSetResponse(&a1_complex16, &b0_complex16, &delay_int4, &resp_complex16) != 0;
+		}
+	Py_END_ALLOW_THREADS
+	if (failed) {
+		PyErr_SetString(PyExc_RuntimeError, "XLALInspiralIIRSetResponse() failed");
+		goto done;
+	}
+
+	Py_INCREF(resp_array);
+	out = resp_array;
+
+done:
+	for (k = 0; k < 4; k++) Py_XDECREF(bank[k]);
+	Py_XDECREF(resp_array);
+
+	return out;
+}
+
+/* work shared by the threads of PyIIRInnerProducts() */
+struct IIRInnerProductJob {
+	const COMPLEX16 *a1;
+	const COMPLEX16 *b0;
+	const INT4 *delay;
+	const npy_intp *indptr;
+	npy_intp ntemplates;
+	REAL8Vector *psd;
+	double *ip;
+	int nthreads;
+	int thread;
+	int failed;
+};
+
+static void *IIRInnerProductThread(void *arg)
+{
+	/* thread n does templates n, n + nthreads, ... so that runs of
+	 * long and short templates are shared out evenly */
+	struct IIRInnerProductJob *job = arg;
+	npy_intp t;
+
+	for (t = job->thread; t < job->ntemplates; t += job->nthreads) {
+		COMPLEX16Vector a1_complex16, b0_complex16;
+		INT4Vector delay_int4;
+		a1_complex16.length = b0_complex16.length = delay_int4.length = job->indptr[t + 1] - job->indptr[t];
+		a1_complex16.data = (COMPLEX16 *) job->a1 + job->indptr[t];
+		b0_complex16.data = (COMPLEX16 *) job->b0 + job->indptr[t];
+		delay_int4.data = (INT4 *) job->delay + job->indptr[t];
+		job->ip[t] = 0.0;
+		if (XLALInspiralCalculateIIRSetInnerProduct(&a1_complex16, &b0_complex16, &delay_int4, job->psd, &job->ip[t]))
+			job->failed = 1;
+		}
+
+	return NULL;
+}
+
+static PyObject *PyIIRInnerProducts(PyObject *self, PyObject *args)
+{
+	PyObject *a1, *b0, *delay, *indptr, *psd;
+	PyObject *bank[4] = {NULL, NULL, NULL, NULL};
+	PyObject *psd_array = NULL, *ip_array = NULL;
+	PyObject *out = NULL;
+	REAL8Vector psd_real8;
+	struct IIRInnerProductJob *jobs = NULL;
+	pthread_t *threads = NULL;
+	npy_intp ntemplates, k;
+	int nthreads = 0, started = 0, failed = 0, n;
+
+	if (!PyArg_ParseTuple(args, "OOOOO|i", &a1, &b0, &delay, &indptr, &psd, &nthreads)) return NULL;
+	ntemplates = IIRBankArrays(a1, b0, delay, indptr, bank);
+	if (ntemplates < 0) goto done;
+	psd_array = PyArray_FROM_OTF(psd, NPY_DOUBLE, NPY_IN_ARRAY);
+	if (!psd_array) goto done;
+	psd_real8.length = PyArray_SIZE(psd_array);
+	psd_real8.data = PyArray_DATA(psd_array);
+	ip_array = PyArray_SimpleNew(1, &ntemplates, NPY_DOUBLE);
+	if (!ip_array) goto done;
+
+	if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads <= 0) nthreads = 1;
+	if (nthreads > ntemplates) nthreads = ntemplates ? ntemplates : 1;
+	jobs = calloc(nthreads, sizeof(*jobs));
+	threads = calloc(nthreads, sizeof(*threads));
+	if (!jobs || !threads) {
+		PyErr_NoMemory();
+		goto done;
+	}
+	for (n = 0; n < nthreads; n++) {
+		jobs[n].a1 = PyArray_DATA(bank[0]);
+		jobs[n].b0 = PyArray_DATA(bank[1]);
+		jobs[n].delay = PyArray_DATA(bank[2]);
+		jobs[n].indptr = PyArray_DATA(bank[3]);
+		jobs[n].ntemplates = ntemplates;
+		jobs[n].psd = &psd_real8;
+		jobs[n].ip = PyArray_DATA(ip_array);
+		jobs[n].nthreads = nthreads;
+		jobs[n].thread = n;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	/* the calling thread does the first share itself */
+	for (n = 1; n < nthreads; n++, started++)
+		if (pthread_create(&threads[n], NULL, IIRInnerProductThread, &jobs[n]))
+			break;
+	/* if a thread could not be started do its share here */
+	for (n = started + 1; n < nthreads; n++)
+		IIRInnerProductThread(&jobs[n]);
+	IIRInnerProductThread(&jobs[0]);
+	for (n = 1; n <= started; n++)
+		pthread_join(threads[n], NULL);
+	Py_END_ALLOW_THREADS
+
+	for (n = 0; n < nthreads; n++) failed |= jobs[n].failed;
+	if (failed) {
+		PyErr_SetString(PyExc_RuntimeError, "XLALInspiralCalculateIIRSetInnerProduct() failed");
+		goto done;
+	}
+
+	out = ip_array;
+	ip_array = NULL;
+
+done:
+	free(jobs);
+	free(threads);
+	for (k = 0; k < 4; k++) Py_XDECREF(bank[k]);
+	Py_XDECREF(psd_array);
+	Py_XDECREF(ip_array);
+
+	return out;
+}
+
+/*
+ * Template bank match engine.  The matches between every template of one
+ * set (the "bank") and every template of another (the "injections") are
+ * computed without storing waveforms:  each thread generates one
+ * injection waveform at a time into its own scratch space, then for each
+ * bank template generates that waveform, forms the noise-weighted product
+ * and inverse FFTs it, maximizing the modulus over time and phase.
+ */
+
+enum {MATCH_IMR, MATCH_SPA};
+
+/* Newtonian chirp time, used to prune pairs that cannot match */
+static double match_tau0(double m1, double m2, double fLower)
+	{
+	double m = (m1 + m2) * LAL_MTSUN_SI;
+	double eta = m1 * m2 / (m1 + m2) / (m1 + m2);
+	return 5.0 / (256.0 * eta) * m * pow(LAL_PI * m * fLower, -8.0 / 3.0);
+	}
+
+/* work shared by the threads of PyMatchMatrix() */
+struct MatchJob {
+	/* m1, m2, chi of each template */
+	const double *bank;
+	npy_intp nbank;
+	const double *injections;
+	npy_intp ninjections;
+	/* chirp times, and the largest difference for which a pair is
+	 * tried, < 0 to try all pairs */
+	const double *bank_tau0;
+	const double *injection_tau0;
+	double dtau;
+	/* inverse psd, 0 outside the band */
+	const double *weight;
+	int numPoints;
+	int kmin;
+	int kmax;
+	double deltaF;
+	double fLower;
+	int approximant;
+	int order;
+	/* results:  the full matrix, or the best match and its bank index
+	 * for each injection */
+	double *matches;
+	double *best;
+	npy_intp *argbest;
+	/* thread-local */
+	COMPLEX16FFTPlan *plan;
+	int nthreads;
+	int thread;
+	int failed;
+};
+
+/* generate the waveform of template (m1, m2, chi) into the band of h */
+static void MatchWaveform(const struct MatchJob *job, const double *params, complex double *h)
+	{
+	SPAOutput out;
+	out.data = (char *) h;
+	out.stride = sizeof(*h);
+	out.single = 0;
+	out.kmin = job->kmin;
+	out.kmax = job->kmax;
+	if (job->approximant == MATCH_SPA)
+		SPAWaveformReduceSpin(params[0], params[1], params[2], job->order, 0.0, 0.0, job->deltaF, job->fLower, schwarz_isco(params[0], params[1]), job->numPoints, &out);
+	else
+		IMRSPAWaveformFromChi(params[0], params[1], params[2], job->deltaF, job->fLower, job->numPoints, &out);
+	}
+
+static void *MatchThread(void *arg)
+	{
+	struct MatchJob *job = arg;
+	int n = job->numPoints, k;
+	complex double *hinj = malloc(n * sizeof(*hinj));
+	complex double *hbank = malloc(n * sizeof(*hbank));
+	COMPLEX16Vector *prod = XLALCreateCOMPLEX16Vector(n);
+	COMPLEX16Vector *z = XLALCreateCOMPLEX16Vector(n);
+	npy_intp i, j;
+
+	if (!hinj || !hbank || !prod || !z) {
+		job->failed = 1;
+		goto done;
+		}
+	/* bins outside the band stay zero */
+	memset(prod->data, 0, n * sizeof(*prod->data));
+
+	for (j = job->thread; j < job->ninjections; j += job->nthreads) {
+		double sigmasq_inj = 0.0;
+		double best = 0.0;
+		npy_intp argbest = -1;
+
+		MatchWaveform(job, job->injections + 3 * j, hinj);
+		for (k = job->kmin; k < job->kmax; k++) {
+			sigmasq_inj += job->weight[k] * (creal(hinj[k]) * creal(hinj[k]) + cimag(hinj[k]) * cimag(hinj[k]));
+			hinj[k] *= job->weight[k];
+			}
+
+		for (i = 0; i < job->nbank; i++) {
+			double sigmasq_bank = 0.0, zmax = 0.0, match = 0.0;
+
+			if (job->dtau >= 0 && fabs(job->bank_tau0[i] - job->injection_tau0[j]) > job->dtau) {
+				if (job->matches) job->matches[i * job->ninjections + j] = 0.0;
+				continue;
+				}
+
+			MatchWaveform(job, job->bank + 3 * i, hbank);
+			for (k = job->kmin; k < job->kmax; k++) {
+				/* conj(hbank) * hinj / psd, written out so the
+				 * compiler does not call the slow complex multiply */
+				double br = creal(hbank[k]), bi = cimag(hbank[k]);
+				double ir = creal(hinj[k]), ii = cimag(hinj[k]);
+				sigmasq_bank += job->weight[k] * (br * br + bi * bi);
+				prod->data[k] = (br * ir + bi * ii) + (br * ii - bi * ir) * I;
+				}
+			if (XLALCOMPLEX16VectorFFT(z, prod, job->plan)) {
+				job->failed = 1;
+				goto done;
+				}
+			for (k = 0; k < n; k++) {
+				double zsq = creal(z->data[k]) * creal(z->data[k]) + cimag(z->data[k]) * cimag(z->data[k]);
+				if (zsq > zmax) zmax = zsq;
+				}
+			if (sigmasq_bank > 0 && sigmasq_inj > 0)
+				match = sqrt(zmax / sigmasq_bank / sigmasq_inj);
+
+			if (job->matches) job->matches[i * job->ninjections + j] = match;
+			if (match > best) {
+				best = match;
+				argbest = i;
+				}
+			}
+
+		if (job->best) {
+			job->best[j] = best;
+			job->argbest[j] = argbest;
+			}
+		}
+
+done:
+	free(hinj);
+	free(hbank);
+	XLALDestroyCOMPLEX16Vector(prod);
+	XLALDestroyCOMPLEX16Vector(z);
+	return NULL;
+	}
+
+static PyObject *PyMatchMatrix(PyObject *self, PyObject *args, PyObject *keywds)
+	{
+	PyObject *bank, *injections, *psd;
+	PyObject *bank_array = NULL, *injections_array = NULL, *psd_array = NULL;
+	PyObject *matches_array = NULL, *best_array = NULL, *argbest_array = NULL;
+	PyObject *out = NULL;
+	double *weight = NULL, *bank_tau0 = NULL, *injection_tau0 = NULL;
+	const double *psd_data;
+	struct MatchJob *jobs = NULL;
+	pthread_t *threads = NULL;
+	double deltaF, fLower, dtau = -1.0;
+	const char *approximant = "imr";
+	int order = 7, nthreads = 0, reduce = 0, started = 0, failed = 0, n;
+	npy_intp nbank, ninjections, nbins, i, dims[2];
+	char *kwlist[] = {"bank", "injections", "psd", "deltaF", "fLower", "approximant", "order", "dtau", "nthreads", "reduce", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, keywds, "OOOdd|sidii", kwlist, &bank, &injections, &psd, &deltaF, &fLower, &approximant, &order, &dtau, &nthreads, &reduce)) return NULL;
+	if (strcmp(approximant, "imr") && strcmp(approximant, "spa")) {
+		PyErr_SetString(PyExc_ValueError, "approximant must be imr | spa");
+		return NULL;
+		}
+	bank_array = PyArray_FROM_OTF(bank, NPY_DOUBLE, NPY_IN_ARRAY);
+	injections_array = PyArray_FROM_OTF(injections, NPY_DOUBLE, NPY_IN_ARRAY);
+	psd_array = PyArray_FROM_OTF(psd, NPY_DOUBLE, NPY_IN_ARRAY);
+	if (!bank_array || !injections_array || !psd_array) goto done;
+	if (PyArray_NDIM(bank_array) != 2 || PyArray_DIM(bank_array, 1) != 3 || PyArray_NDIM(injections_array) != 2 || PyArray_DIM(injections_array, 1) != 3) {
+		PyErr_SetString(PyExc_ValueError, "bank and injections must be arrays of (m1, m2, chi) rows");
+		goto done;
+		}
+	nbank = PyArray_DIM(bank_array, 0);
+	ninjections = PyArray_DIM(injections_array, 0);
+	nbins = PyArray_SIZE(psd_array);
+	if (nbins < 2) {
+		PyErr_SetString(PyExc_ValueError, "psd must have at least two frequency bins");
+		goto done;
+		}
+
+	/* results */
+	if (reduce) {
+		best_array = PyArray_SimpleNew(1, &ninjections, NPY_DOUBLE);
+		argbest_array = PyArray_SimpleNew(1, &ninjections, NPY_INTP);
+		if (!best_array || !argbest_array) goto done;
+		}
+	else {
+		dims[0] = nbank;
+		dims[1] = ninjections;
+		matches_array = PyArray_SimpleNew(2, dims, NPY_DOUBLE);
+		if (!matches_array) goto done;
+		}
+
+	/* inverse psd over the band, and chirp times for pruning */
+	weight = calloc(nbins, sizeof(*weight));
+	bank_tau0 = malloc((nbank ? nbank : 1) * sizeof(*bank_tau0));
+	injection_tau0 = malloc((ninjections ? ninjections : 1) * sizeof(*injection_tau0));
+	if (!weight || !bank_tau0 || !injection_tau0) {
+		PyErr_NoMemory();
+		goto done;
+		}
+	psd_data = PyArray_DATA(psd_array);
+	for (i = 0; i < nbins; i++)
+		weight[i] = i * deltaF >= fLower && psd_data[i] > 0 && isfinite(psd_data[i]) ? 1.0 / psd_data[i] : 0.0;
+	for (i = 0; i < nbank; i++)
+		bank_tau0[i] = match_tau0(((double *) PyArray_DATA(bank_array))[3 * i], ((double *) PyArray_DATA(bank_array))[3 * i + 1], fLower);
+	for (i = 0; i < ninjections; i++)
+		injection_tau0[i] = match_tau0(((double *) PyArray_DATA(injections_array))[3 * i], ((double *) PyArray_DATA(injections_array))[3 * i + 1], fLower);
+
+	if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads <= 0) nthreads = 1;
+	if (nthreads > ninjections) nthreads = ninjections ? ninjections : 1;
+	jobs = calloc(nthreads, sizeof(*jobs));
+	threads = calloc(nthreads, sizeof(*threads));
+	if (!jobs || !threads) {
+		PyErr_NoMemory();
+		goto done;
+		}
+	for (n = 0; n < nthreads; n++) {
+		jobs[n].bank = PyArray_DATA(bank_array);
+		jobs[n].nbank = nbank;
+		jobs[n].injections = PyArray_DATA(injections_array);
+		jobs[n].ninjections = ninjections;
+		jobs[n].bank_tau0 = bank_tau0;
+		jobs[n].injection_tau0 = injection_tau0;
+		jobs[n].dtau = dtau;
+		jobs[n].weight = weight;
+		/* the psd covers 0 ... Nyquist of a numPoints-long complex series */
+		jobs[n].numPoints = 2 * (nbins - 1);
+		jobs[n].kmin = ceil(fLower / deltaF) > 1 ? ceil(fLower / deltaF) : 1;
+		jobs[n].kmax = nbins;
+		jobs[n].deltaF = deltaF;
+		jobs[n].fLower = fLower;
+		jobs[n].approximant = strcmp(approximant, "spa") ? MATCH_IMR : MATCH_SPA;
+		jobs[n].order = order;
+		jobs[n].matches = matches_array ? PyArray_DATA(matches_array) : NULL;
+		jobs[n].best = best_array ? PyArray_DATA(best_array) : NULL;
+		jobs[n].argbest = argbest_array ? PyArray_DATA(argbest_array) : NULL;
+		jobs[n].nthreads = nthreads;
+		jobs[n].thread = n;
+		}
+
+	Py_BEGIN_ALLOW_THREADS
+	/* FFT plans are made one at a time, only their execution is
+	 * shared among threads */
+	for (n = 0; n < nthreads; n++)
+		if (!(jobs[n].plan = XLALCreateReverseCOMPLEX16FFTPlan(jobs[0].numPoints, 0)))
+			failed = 1;
+	if (!failed) {
+		for (n = 1; n < nthreads; n++, started++)
+			if (pthread_create(&threads[n], NULL, MatchThread, &jobs[n]))
+				break;
+		/* if a thread could not be started do its share here */
+		for (n = started + 1; n < nthreads; n++)
+			MatchThread(&jobs[n]);
+		MatchThread(&jobs[0]);
+		for (n = 1; n <= started; n++)
+			pthread_join(threads[n], NULL);
+		}
+	for (n = 0; n < nthreads; n++)
+		if (jobs[n].plan) XLALDestroyCOMPLEX16FFTPlan(jobs[n].plan);
+	Py_END_ALLOW_THREADS
+
+	for (n = 0; n < nthreads; n++) failed |= jobs[n].failed;
+	if (failed) {
+		PyErr_SetString(PyExc_RuntimeError, "match computation failed");
+		goto done;
+		}
+
+	if (reduce)
+		out = Py_BuildValue("OO", best_array, argbest_array);
+	else {
+		out = matches_array;
+		matches_array = NULL;
+		}
+
+done:
+	free(weight);
+	free(bank_tau0);
+	free(injection_tau0);
+	free(jobs);
+	free(threads);
+	Py_XDECREF(bank_array);
+	Py_XDECREF(injections_array);
+	Py_XDECREF(psd_array);
+	Py_XDECREF(matches_array);
+	Py_XDECREF(best_array);
+	Py_XDECREF(argbest_array);
+
+	return out;
+	}
+
+/*
+ * numpy ufuncs over the chirp time, cutoff frequency and chi functions, so
+ * that they can be evaluated for whole template banks and injection sets
+ * in one call with the usual broadcasting rules.  The loops run without
+ * the GIL.
+ */
+
+typedef double (*dd_d_func)(double, double);
+typedef double (*ddd_d_func)(double, double, double);
+typedef double (*dddd_d_func)(double, double, double, double);
+
+static void ufunc_dd_d(char **args, npy_intp *dimensions, npy_intp *steps, void *data)
+	{
+	dd_d_func f = (dd_d_func) data;
+	npy_intp i;
+	for (i = 0; i < dimensions[0]; i++)
+		*(double *) (args[2] + i * steps[2]) = f(*(double *) (args[0] + i * steps[0]), *(double *) (args[1] + i * steps[1]));
+	}
+
+static void ufunc_ddd_d(char **args, npy_intp *dimensions, npy_intp *steps, void *data)
+	{
+	ddd_d_func f = (ddd_d_func) data;
+	npy_intp i;
+	for (i = 0; i < dimensions[0]; i++)
+		*(double *) (args[3] + i * steps[3]) = f(*(double *) (args[0] + i * steps[0]), *(double *) (args[1] + i * steps[1]), *(double *) (args[2] + i * steps[2]));
+	}
+
+static void ufunc_dddd_d(char **args, npy_intp *dimensions, npy_intp *steps, void *data)
+	{
+	dddd_d_func f = (dddd_d_func) data;
+	npy_intp i;
+	for (i = 0; i < dimensions[0]; i++)
+		*(double *) (args[4] + i * steps[4]) = f(*(double *) (args[0] + i * steps[0]), *(double *) (args[1] + i * steps[1]), *(double *) (args[2] + i * steps[2]), *(double *) (args[3] + i * steps[3]));
+	}
+
+/* chirp_time(m1, m2, fLower, order, chi) */
+static void ufunc_chirp_time(char **args, npy_intp *dimensions, npy_intp *steps, void *data)
+	{
+	npy_intp i;
+	for (i = 0; i < dimensions[0]; i++)
+		*(double *) (args[5] + i * steps[5]) = chirp_time(*(double *) (args[0] + i * steps[0]), *(double *) (args[1] + i * steps[1]), *(double *) (args[2] + i * steps[2]), *(int *) (args[3] + i * steps[3]), *(double *) (args[4] + i * steps[4]));
+	}
+
+/* the same with order given as a long, numpy's default integer */
+static void ufunc_chirp_time_long(char **args, npy_intp *dimensions, npy_intp *steps, void *data)
+	{
+	npy_intp i;
+	for (i = 0; i < dimensions[0]; i++)
+		*(double *) (args[5] + i * steps[5]) = chirp_time(*(double *) (args[0] + i * steps[0]), *(double *) (args[1] + i * steps[1]), *(double *) (args[2] + i * steps[2]), (int) *(long *) (args[3] + i * steps[3]), *(double *) (args[4] + i * steps[4]));
+	}
+
+/* chirp_time_between_f1_and_f2(m1, m2, fLower, fUpper, order, chi) */
+static void ufunc_chirp_time_between_f1_and_f2(char **args, npy_intp *dimensions, npy_intp *steps, void *data)
+	{
+	npy_intp i;
+	for (i = 0; i < dimensions[0]; i++)
+		*(double *) (args[6] + i * steps[6]) = chirp_time_between_f1_and_f2(*(double *) (args[0] + i * steps[0]), *(double *) (args[1] + i * steps[1]), *(double *) (args[2] + i * steps[2]), *(double *) (args[3] + i * steps[3]), *(int *) (args[4] + i * steps[4]), *(double *) (args[5] + i * steps[5]));
+	}
+
+static void ufunc_chirp_time_between_f1_and_f2_long(char **args, npy_intp *dimensions, npy_intp *steps, void *data)
+	{
+	npy_intp i;
+	for (i = 0; i < dimensions[0]; i++)
+		*(double *) (args[6] + i * steps[6]) = chirp_time_between_f1_and_f2(*(double *) (args[0] + i * steps[0]), *(double *) (args[1] + i * steps[1]), *(double *) (args[2] + i * steps[2]), *(double *) (args[3] + i * steps[3]), (int) *(long *) (args[4] + i * steps[4]), *(double *) (args[5] + i * steps[5]));
+	}
+
+static PyUFuncGenericFunction ufunc_dd_d_loops[] = {ufunc_dd_d};
+static PyUFuncGenericFunction ufunc_ddd_d_loops[] = {ufunc_ddd_d};
+static PyUFuncGenericFunction ufunc_dddd_d_loops[] = {ufunc_dddd_d};
+/* an int64 order cannot be cast safely to int, so there are loops taking
+ * order as an int and as a long */
+static PyUFuncGenericFunction ufunc_chirp_time_loops[] = {ufunc_chirp_time, ufunc_chirp_time_long};
+static PyUFuncGenericFunction ufunc_chirp_time_between_f1_and_f2_loops[] = {ufunc_chirp_time_between_f1_and_f2, ufunc_chirp_time_between_f1_and_f2_long};
+
+static char ufunc_dd_d_types[] = {NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE};
+static char ufunc_ddd_d_types[] = {NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE};
+static char ufunc_dddd_d_types[] = {NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE};
+static char ufunc_chirp_time_types[] = {NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE, NPY_INT, NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE, NPY_LONG, NPY_DOUBLE, NPY_DOUBLE};
+static char ufunc_chirp_time_between_f1_and_f2_types[] = {NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE, NPY_INT, NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE, NPY_DOUBLE, NPY_LONG, NPY_DOUBLE, NPY_DOUBLE};
+
+static void *ufunc_schwarz_isco_data[] = {(void *) schwarz_isco};
+static void *ufunc_bkl_isco_data[] = {(void *) bkl_isco};
+static void *ufunc_light_ring_data[] = {(void *) light_ring};
+static void *ufunc_imr_merger_data[] = {(void *) imr_merger};
+static void *ufunc_imr_ring_data[] = {(void *) imr_ring};
+static void *ufunc_imr_fcut_data[] = {(void *) imr_fcut};
+static void *ufunc_compute_chi_data[] = {(void *) compute_chi};
+static void *ufunc_no_data[] = {NULL, NULL};
+
+/* add the ufuncs to the module's dictionary */
+static void add_ufuncs(PyObject *module)
+	{
+	PyModule_AddObject(module, "chirp_time", PyUFunc_FromFuncAndData(ufunc_chirp_time_loops, ufunc_no_data, ufunc_chirp_time_types, 2, 5, 1, PyUFunc_None, "chirp_time",
+		"chirp_time(m1, m2, fLower, order, chi)\n\n"
+		"ufunc version of chirptime(m1, m2, order, fLower, chi = chi).", 0));
+	PyModule_AddObject(module, "chirp_time_between_f1_and_f2", PyUFunc_FromFuncAndData(ufunc_chirp_time_between_f1_and_f2_loops, ufunc_no_data, ufunc_chirp_time_between_f1_and_f2_types, 2, 6, 1, PyUFunc_None, "chirp_time_between_f1_and_f2",
+		"chirp_time_between_f1_and_f2(m1, m2, fLower, fUpper, order, chi)\n\n"
+		"ufunc version of chirptime(m1, m2, order, fLower, fUpper, chi).", 0));
+	PyModule_AddObject(module, "schwarz_isco", PyUFunc_FromFuncAndData(ufunc_dd_d_loops, ufunc_schwarz_isco_data, ufunc_dd_d_types, 1, 2, 1, PyUFunc_None, "schwarz_isco",
+		"schwarz_isco(m1, m2)\n\n"
+		"ufunc version of ffinal(m1, m2, 'schwarz_isco').", 0));
+	PyModule_AddObject(module, "bkl_isco", PyUFunc_FromFuncAndData(ufunc_dd_d_loops, ufunc_bkl_isco_data, ufunc_dd_d_types, 1, 2, 1, PyUFunc_None, "bkl_isco",
+		"bkl_isco(m1, m2)\n\n"
+		"ufunc version of ffinal(m1, m2, 'bkl_isco').", 0));
+	PyModule_AddObject(module, "light_ring", PyUFunc_FromFuncAndData(ufunc_dd_d_loops, ufunc_light_ring_data, ufunc_dd_d_types, 1, 2, 1, PyUFunc_None, "light_ring",
+		"light_ring(m1, m2)\n\n"
+		"ufunc version of ffinal(m1, m2, 'light_ring').", 0));
+	PyModule_AddObject(module, "imr_merger", PyUFunc_FromFuncAndData(ufunc_ddd_d_loops, ufunc_imr_merger_data, ufunc_ddd_d_types, 1, 3, 1, PyUFunc_None, "imr_merger",
+		"imr_merger(m1, m2, chi)\n\n"
+		"ufunc version of imrffinal(m1, m2, chi, 'merger').", 0));
+	PyModule_AddObject(module, "imr_ring", PyUFunc_FromFuncAndData(ufunc_ddd_d_loops, ufunc_imr_ring_data, ufunc_ddd_d_types, 1, 3, 1, PyUFunc_None, "imr_ring",
+		"imr_ring(m1, m2, chi)\n\n"
+		"ufunc version of imrffinal(m1, m2, chi, 'ringdown').", 0));
+	PyModule_AddObject(module, "imr_fcut", PyUFunc_FromFuncAndData(ufunc_ddd_d_loops, ufunc_imr_fcut_data, ufunc_ddd_d_types, 1, 3, 1, PyUFunc_None, "imr_fcut",
+		"imr_fcut(m1, m2, chi)\n\n"
+		"ufunc version of imrffinal(m1, m2, chi, 'fcut').", 0));
+	PyModule_AddObject(module, "compute_chi", PyUFunc_FromFuncAndData(ufunc_dddd_d_loops, ufunc_compute_chi_data, ufunc_dddd_d_types, 1, 4, 1, PyUFunc_None, "compute_chi",
+		"compute_chi(m1, m2, spin1, spin2)\n\n"
+		"ufunc version of computechi(m1, m2, spin1, spin2).", 0));
+	}
+
 /* Structure defining the functions of this module and doc strings etc... */
 static struct PyMethodDef methods[] = {
-	{"waveform", PySPAWaveform, METH_VARARGS,
+	{"waveform", (PyCFunction) PySPAWaveform, METH_VARARGS | METH_KEYWORDS,
 	 "This function produces a frequency domain waveform at a "
 	 "specified mass1, mass2 and PN order.\n\n"
 	 "waveform(m1, m2, order, deltaF, deltaT, fLower, fFinal, signalArray)\n\n"
 	 "You can produce a spin aligned waveform by doing\n\n"
 	 "waveform(m1, m2, order, deltaF, deltaT, fLower, fFinal, signalArray, spin1, spin2)"
 	 "Or you can produce a spin aligned waveform by doing\n\n"
-	 "waveform(m1, m2, order, deltaF, deltaT, fLower, fFinal, signalArray, chi)"
+	 "waveform(m1, m2, order, deltaF, deltaT, fLower, fFinal, signalArray, chi)\n\n"
+	 "signalArray may be a complex128 or complex64 array with any stride, e.g. a row\n"
+	 "of a 2-D template bank matrix, and is written in place.  The keyword arguments\n"
+	 "kmin and kmax restrict the output to the bins kmin <= k < kmax;  bins outside\n"
+	 "that range are left untouched rather than zeroed."
 	},
-	{"genericwaveform", PyGenericSPAWaveform, METH_VARARGS,
+	{"genericwaveform", (PyCFunction) PyGenericSPAWaveform, METH_VARARGS | METH_KEYWORDS,
 	 "This function produces a frequency domain waveform at a "
 	 "specified PN order using user defined PN coefficients.\n\n"
-	 "genericwaveform(psis, psils, order, deltaF, deltaT, fLower, fFinal, signalArray)"
+	 "genericwaveform(psis, psils, order, deltaF, deltaT, fLower, fFinal, signalArray)\n\n"
+	 "signalArray, kmin and kmax are as for waveform()."
 	},
-	{"imrwaveform", PyIMRSPAWaveform, METH_VARARGS,
+	{"imrwaveform", (PyCFunction) PyIMRSPAWaveform, METH_VARARGS | METH_KEYWORDS,
 	 "This function produces a frequency domain IMR waveform at a "
 	 "specified mass1, mass2 by calling \n\n"
 	 "imrwaveform(m1, m2, deltaF, fLower, signalArray)\n\n"
@@ -514,6 +1239,7 @@ static struct PyMethodDef methods[] = {
 	 "This function is overlouded to produce a frequency domain IMR waveform at a "
 	 "specified mass1, mass2, z component spin1, z component spin2 by calling \n\n"
 	 "imrwaveform(m1, m2, deltaF, fLower, signalArray, spin1, spin2)\n\n"
+	 "signalArray, kmin and kmax are as for waveform().\n\n"
 	},
 	{"chirptime", PyChirpTime, METH_VARARGS,
 	 "This function calculates the SPA chirptime at a specified mass1, mass2 "
@@ -537,6 +1263,23 @@ static struct PyMethodDef methods[] = {
 	 "This function calculates the mass weighted spin parameter chi\n\n"
 	 "computechi(m1, m2, spin1, spin2)\n\n"
 	},
+	{"matchmatrix", (PyCFunction) PyMatchMatrix, METH_VARARGS | METH_KEYWORDS,
+	 "This function computes the matches, maximized over time and phase, between\n"
+	 "the templates of a bank and a set of injections, generating the waveforms on\n"
+	 "the fly so none are stored.\n\n"
+	 "matchmatrix(bank, injections, psd, deltaF, fLower, approximant = 'imr', order = 7, dtau = -1, nthreads = 0, reduce = False)\n\n"
+	 "bank and injections are arrays of (m1, m2, chi) rows.  psd is the one-sided\n"
+	 "noise power spectral density at frequencies k * deltaF from 0 to Nyquist.\n"
+	 "approximant is 'imr' for imrwaveform() or 'spa' for the reduced spin\n"
+	 "waveform() at the given PN order, cut off at the Schwarzschild ISCO.  Pairs\n"
+	 "whose Newtonian chirp times at fLower differ by more than dtau seconds\n"
+	 "are skipped and given match 0;  dtau < 0 tries every pair.  The injections\n"
+	 "are shared among nthreads threads, by default one per online CPU.  Returns\n"
+	 "the (len(bank), len(injections)) array of matches or, if reduce is true,\n"
+	 "the arrays (best_match, best_index) giving the fitting factor of each\n"
+	 "injection and the index of the bank template that attains it (-1 if none\n"
+	 "was tried).\n\n"
+	},
 	{"svd", (PyCFunction) PySVD, METH_KEYWORDS,
 	 "This function calculates the singular value decomposition of a matrix\n"
 	 "via the GSL implementation of the Golub-Reinsch algorithm.  The default\n"
@@ -573,14 +1316,43 @@ static struct PyMethodDef methods[] = {
 	 "This function outputs the inner product of the sum of iir responses\n\n"
 	 "iirinnerproduct(a1_set, b0_set, delay_set, psd\n\n"
 	},
+	{"iirfilter", PyIIRFilter, METH_VARARGS,
+	 "This function runs a bank of single pole IIR filters over a block of real data,\n"
+	 "carrying the filter state from one call to the next.  The filters of all templates\n"
+	 "are concatenated in a1, b0 and delay, and those of template t are at positions\n"
+	 "indptr[t]:indptr[t+1].  y (complex128, one per filter) and history (float64 ring\n"
+	 "buffer longer than the largest delay) hold the state and are updated in place, and\n"
+	 "head is the position of the most recent sample in history.  The sum of each\n"
+	 "template's filter outputs is written to snr, a complex128 array of shape\n"
+	 "(len(indptr) - 1, len(data)), and the new head is returned.  The GIL is released\n"
+	 "while filtering.  See spawaveform.IIRFilterBank for a wrapper that manages the state.\n\n"
+	 "head = iirfilter(a1, b0, delay, indptr, y, history, head, data, snr)\n\n"
+	},
+	{"iirresponses", PyIIRResponses, METH_VARARGS,
+	 "This function computes the truncated impulse responses of a bank of IIR filter sets,\n"
+	 "stored concatenated in a1, b0 and delay with template t's filters at positions\n"
+	 "indptr[t]:indptr[t+1].  The responses are written directly into the rows of resp,\n"
+	 "a C-contiguous complex128 array of shape (len(indptr) - 1, length_of_impulse_response),\n"
+	 "which is returned.\n\n"
+	 "iirresponses(a1, b0, delay, indptr, resp)\n\n"
+	},
+	{"iirinnerproducts", PyIIRInnerProducts, METH_VARARGS,
+	 "This function outputs the inner products of the sums of iir responses of a bank of\n"
+	 "IIR filter sets, packed as for iirresponses(), against one psd, as an array with one\n"
+	 "element per template.  The templates are shared among nthreads threads, by default\n"
+	 "one per online CPU.\n\n"
+	 "iirinnerproducts(a1, b0, delay, indptr, psd, [nthreads])\n\n"
+	},
 	{NULL, NULL, 0, NULL}
 	};
 
 /* The init function for this module */
 void init_spawaveform(void)
 	{
-	(void) Py_InitModule3("pylal._spawaveform", methods, SPADocstring);
+	PyObject *m = Py_InitModule3("pylal._spawaveform", methods, SPADocstring);
 	import_array();
+	import_umath();
+	add_ufuncs(m);
 	/* FIXME someday handle errors
 	 * SVMError = PyErr_NewException("_spawaveform.SPAWaveformError", NULL, NULL);
 	 * Py_INCREF(SPAWaveformError);
@@ -588,6 +1360,49 @@ void init_spawaveform(void)
          */
 	}
 
+/* Number of frequency bins the generators work on at a time */
+#define SPA_BLOCK 64
+
+/* sin and cos of x together, where the C library can do so */
+static inline void SPASinCos(double x, double *s, double *c)
+	{
+#ifdef __GLIBC__
+	sincos(x, s, c);
+#else
+	*s = sin(x);
+	*c = cos(x);
+#endif
+	}
+
+/* Zero the bins of the output band that lie within the first numPoints */
+static void SPAOutputZero(const SPAOutput *out, int numPoints)
+	{
+	int k;
+	int kmax = out->kmax < numPoints ? out->kmax : numPoints;
+	size_t size = out->single ? sizeof(complex float) : sizeof(complex double);
+	if (out->kmin >= kmax) return;
+	if (out->stride == (npy_intp) size)
+		memset(out->data + out->kmin * out->stride, 0, (kmax - out->kmin) * size);
+	else
+		for (k = out->kmin; k < kmax; k++) memset(out->data + k * out->stride, 0, size);
+	}
+
+/* Clip a generator's range of bins to the output band */
+static void SPAOutputBand(const SPAOutput *out, int *kmin, int *kmax)
+	{
+	if (*kmin < out->kmin) *kmin = out->kmin;
+	if (*kmax > out->kmax) *kmax = out->kmax;
+	}
+
+/* Store the value of bin k */
+static inline void SPAOutputSet(const SPAOutput *out, int k, complex double value)
+	{
+	if (out->single)
+		*(complex float *) (out->data + k * out->stride) = value;
+	else
+		*(complex double *) (out->data + k * out->stride) = value;
+	}
+
 /*****************************************************************************/
 /* The remainder of this code defines the static functions that the python   */
 /* functions will use to compute various quantities.  They are not exposed   */
@@ -600,7 +1415,7 @@ void init_spawaveform(void)
 
 static int SPAWaveformReduceSpin (double mass1, double mass2, double chi, 
         int order, double startTime, double phi0, double deltaF,
-        double fLower, double fFinal, int numPoints, complex double *hOfF) {
+        double fLower, double fFinal, int numPoints, SPAOutput *out) {
 
 	double m = mass1 + mass2;
 	double eta = mass1 * mass2 / m / m;
@@ -609,13 +1424,14 @@ static int SPAWaveformReduceSpin (double mass1, double mass2, double chi,
     double psi3S = 0., psi4S = 0., psi5S = 0., psi0; 
     double alpha2 = 0., alpha3 = 0., alpha4 = 0., alpha5 = 0., alpha6 = 0., alpha6L = 0.;
     double alpha7 = 0., alpha3S = 0., alpha4S = 0., alpha5S = 0.; 
-    double f, v, v2, v3, v4, v5, v6, v7, Psi, amp, shft, amp0, d_eff; 
-    int k, kmin, kmax; 
+    double shft, amp0, d_eff; 
+    double vScale, ampScale, phase0;
+    double vBlock[SPA_BLOCK], logvBlock[SPA_BLOCK], ampBlock[SPA_BLOCK], phaseBlock[SPA_BLOCK];
+    int j, k0, kmin, kmax; 
 
-    double mSevenBySix = -7./6.;
     double piM = LAL_PI*m*LAL_MTSUN_SI;
-    double oneByThree = 1./3.;
     double piBy4 = LAL_PI/4.;
+    double log4 = log(4.);
 
     /************************************************************************/
     /* spin terms in the ampl & phase in terms of the 'reduced-spin' param. */
@@ -672,51 +1488,67 @@ static int SPAWaveformReduceSpin (double mass1, double mass2, double chi,
     shft = 2.*LAL_PI *startTime;
 
     /* zero outout */    
-    memset (hOfF, 0, numPoints * sizeof (complex double));
+    SPAOutputZero(out, numPoints);
 
 	kmin = fLower / deltaF > 1 ? fLower / deltaF : 1;
 	kmax = fFinal / deltaF < numPoints  ? fFinal / deltaF : numPoints ;
+	/* bins below fLower are left at zero, and k < kmax already keeps
+	 * f below fFinal, so the loop below need not test either */
+	while (kmin * deltaF < fLower) kmin++;
+	SPAOutputBand(out, &kmin, &kmax);
 
     /************************************************************************/
-    /*          now generate the waveform at all frequency bins             */
+    /* quantities that do not depend on frequency.  with v = (piM f)^(1/3)  */
+    /* f^(-7/6) = piM^(7/6) v^(-7/2) and log(4 v) = log(4) + log(v), so     */
+    /* each bin needs only a cbrt, a log, a sqrt and a sincos               */
     /************************************************************************/
-    for (k = kmin; k < kmax; k++) {
-
-        /* fourier frequency corresponding to this bin */
-      	f = k * deltaF;
-        v = pow(piM*f, oneByThree);
-
-        v2 = v*v;   v3 = v2*v;  v4 = v3*v;  v5 = v4*v;  v6 = v5*v;  v7 = v6*v;
+    vScale = cbrt(piM*deltaF);
+    ampScale = amp0*pow(piM, 7./6.);
+    phase0 = phi0 + piBy4;
+    psi6 += psi6L*log4;
+    alpha6 += alpha6L*(LAL_GAMMA + log4);
 
-        /* compute the phase and amplitude */
-        if ((f < fLower) || (f > fFinal)) {
-            amp = 0.;
-            Psi = 0.;
+    /************************************************************************/
+    /*          now generate the waveform at all frequency bins             */
+    /************************************************************************/
+    /* the bins are done in blocks, with the transcendental functions       */
+    /* and the polynomial arithmetic in separate loops so the latter can be */
+    /* vectorized                                                           */
+    for (k0 = kmin; k0 < kmax; k0 += SPA_BLOCK) {
+        int n = kmax - k0 < SPA_BLOCK ? kmax - k0 : SPA_BLOCK;
+
+        for (j = 0; j < n; j++) {
+            vBlock[j] = vScale*cbrt((double) (k0 + j));
+            logvBlock[j] = log(vBlock[j]);
         }
-        else {
 
-            Psi = psi0*pow(v, -5.)*(1. 
-                    + psi2*v2 + psi3*v3 + psi4*v4 
-                    + psi5*v5*(1.+3.*log(v)) 
-                    + (psi6 + psi6L*log(4.*v))*v6 + psi7*v7); 
+        for (j = 0; j < n; j++) {
+            double v = vBlock[j], logv = logvBlock[j];
+            double v2 = v*v, v3 = v2*v, v5 = v3*v2;
 
-            amp = amp0*pow(f, mSevenBySix)*(1. 
-                    + alpha2*v2 + alpha3*v3 + alpha4*v4 
-                    + alpha5*v5 + (alpha6 + alpha6L*(LAL_GAMMA+log(4.*v)) )*v6 
-                    + alpha7*v7); 
+            /* compute the phase and amplitude, as Horner polynomials in v */
+            double Psi = psi0/v5*(1. + v2*(psi2 + v*(psi3 + v*(psi4
+                    + v*(psi5*(1.+3.*logv) + v*(psi6 + psi6L*logv + v*psi7))))));
 
+            ampBlock[j] = ampScale/(v3*sqrt(v))*(1. + v2*(alpha2 + v*(alpha3
+                    + v*(alpha4 + v*(alpha5 + v*(alpha6 + alpha6L*logv + v*alpha7))))));
+
+            phaseBlock[j] = Psi + shft*(k0 + j)*deltaF + phase0;
         }
 
         /* generate the waveform */
-       	hOfF[k] = amp * (cos(Psi+shft*f+phi0+piBy4) - I*sin(Psi+shft*f+phi0+piBy4)); 
-
+        for (j = 0; j < n; j++) {
+            double sinPhase, cosPhase;
+            SPASinCos(phaseBlock[j], &sinPhase, &cosPhase);
+            SPAOutputSet(out, k0 + j, ampBlock[j] * (cosPhase - I*sinPhase));
+        }
     }    
 
 	return 0;
 }
 
 /* FIXME make this function exist in LAL and have the LAL SPA waveform generator call it? */
-static int SPAWaveform (double mass1, double mass2, int order, double deltaF, double deltaT, double fLower, double fFinal, int numPoints,  complex double *expPsi)
+static int SPAWaveform (double mass1, double mass2, int order, double deltaF, double deltaT, double fLower, double fFinal, int numPoints,  SPAOutput *out)
 	{
 	double m = mass1 + mass2;
 	double eta = mass1 * mass2 / m / m;
@@ -750,7 +1582,8 @@ static int SPAWaveform (double mass1, double mass2, int order, double deltaF, do
 	tNorm *= distNorm;
 
 	/* zero output */
-	memset (expPsi, 0, numPoints * sizeof (complex double));
+	SPAOutputZero(out, numPoints);
+	SPAOutputBand(out, &kmin, &kmax);
 
 	/* Initialize all PN phase coeffs to zero. */
 	c0 = c10 = c15 = c20 = c25 = c25Log = c30 = c30Log = c35 = c40P = 0.;
@@ -817,7 +1650,6 @@ static int SPAWaveform (double mass1, double mass2, int order, double deltaF, do
 			/* XXX minus sign added because of new sign convention for fft */
 			/* FIXME minus sign put back because it makes a reverse chirp with scipy's ifft */
 			value = psi1 * (1 + psi2 * (s2 + psi2 * s4)) +  I * (0. - 1. - psi2 * (c2 + psi2 * c4));
-			expPsi[k]  = value;
 			}
 		else if (psi1 > LAL_PI / 2)
 			{
@@ -826,7 +1658,6 @@ static int SPAWaveform (double mass1, double mass2, int order, double deltaF, do
 			/* XXX minus sign added because of new sign convention for fft */
 			/* FIXME minus sign put back because it makes a reverse chirp with scipy's ifft */
 			value = psi1 * (1 + psi2 * (s2 + psi2 * s4)) + I * (0. - 1. - psi2 * (c2 + psi2 * c4));
-			expPsi[k] = value;
 			}
 		else
 			{
@@ -834,16 +1665,15 @@ static int SPAWaveform (double mass1, double mass2, int order, double deltaF, do
 			/* XXX minus sign added because of new sign convention for fft */
 			/* FIXME minus sign put back because it makes a reverse chirp with scipy's ifft */
 			value = psi1 * (1 + psi2 * (s2 + psi2 * s4)) + I * (1. + psi2 * (c2 + psi2 * c4));
-			expPsi[k] = value;
 			}
 		/* put in the first order amplitude factor */
-		expPsi[k] *= pow(k*deltaF, -7.0 / 6.0) * tNorm;
+		SPAOutputSet(out, k, value * pow(k*deltaF, -7.0 / 6.0) * tNorm);
 		}
 	return 0;
 	}
 
 /* FIXME make this function exist in LAL and have the LAL SPA waveform generator call it? */
-static int GenericSPAWaveform (double *psis, double *psils, int order, double deltaF, double deltaT, double fLower, double fFinal, int numPoints,  complex double *expPsi)
+static int GenericSPAWaveform (double *psis, double *psils, int order, double deltaF, double deltaT, double fLower, double fFinal, int numPoints,  SPAOutput *out)
 	{
 	int i,k = 0;
 	int kmin = fLower / deltaF > 1 ? fLower / deltaF : 1;
@@ -860,7 +1690,8 @@ static int GenericSPAWaveform (double *psis, double *psils, int order, double de
 	complex double value;
 
 	/* zero output */
-	memset (expPsi, 0, numPoints * sizeof (complex double));
+	SPAOutputZero(out, numPoints);
+	SPAOutputBand(out, &kmin, &kmax);
 
 	/* f1 */
 	x1 = pow ((double) deltaF, 1.0 / 3.0);
@@ -911,7 +1742,6 @@ static int GenericSPAWaveform (double *psis, double *psils, int order, double de
 			/* XXX minus sign added because of new sign convention for fft */
 			/* FIXME minus sign put back because it makes a reverse chirp with scipy's ifft */
 			value = psi1 * (1 + psi2 * (s2 + psi2 * s4)) +  I * (0. - 1. - psi2 * (c2 + psi2 * c4));
-			expPsi[k]  = value;
 			}
 		else if (psi1 > LAL_PI / 2)
 			{
@@ -920,7 +1750,6 @@ static int GenericSPAWaveform (double *psis, double *psils, int order, double de
 			/* XXX minus sign added because of new sign convention for fft */
 			/* FIXME minus sign put back because it makes a reverse chirp with scipy's ifft */
 			value = psi1 * (1 + psi2 * (s2 + psi2 * s4)) + I * (0. - 1. - psi2 * (c2 + psi2 * c4));
-			expPsi[k] = value;
 			}
 		else
 			{
@@ -928,10 +1757,9 @@ static int GenericSPAWaveform (double *psis, double *psils, int order, double de
 			/* XXX minus sign added because of new sign convention for fft */
 			/* FIXME minus sign put back because it makes a reverse chirp with scipy's ifft */
 			value = psi1 * (1 + psi2 * (s2 + psi2 * s4)) + I * (1. + psi2 * (c2 + psi2 * c4));
-			expPsi[k] = value;
 			}
 		/* put in the first order amplitude factor */
-		expPsi[k] *= pow(k*deltaF, -7.0 / 6.0);
+		SPAOutputSet(out, k, value * pow(k*deltaF, -7.0 / 6.0));
 		}
 	return 0;
 	}
@@ -1077,23 +1905,38 @@ static double _imrdur(double m1, double m2, double chi)
 	return out;
 	}
 
-int IMRSPAWaveform(double mass1, double mass2, double spin1, double spin2, double deltaF, double fLower, int numPoints,  complex double *hOfF) {
+/* The first bin k in [kmin, kmax] with k * deltaF > f, or kmax if none */
+static int IMRFirstBinAbove(double f, double deltaF, int kmin, int kmax)
+	{
+	double kf = floor(f / deltaF);
+	int k;
+	if (kf < kmin) return kmin;
+	if (kf >= kmax) return kmax;
+	k = kf;
+	/* guard against rounding in the division */
+	while (k > kmin && (k - 1) * deltaF > f) k--;
+	while (k < kmax && k * deltaF <= f) k++;
+	return k;
+	}
+
+int IMRSPAWaveform(double mass1, double mass2, double spin1, double spin2, double deltaF, double fLower, int numPoints,  SPAOutput *out) {
 	double chi = compute_chi(mass1, mass2, spin1, spin2);
-	return IMRSPAWaveformFromChi(mass1, mass2, chi, deltaF, fLower, numPoints, hOfF);
+	return IMRSPAWaveformFromChi(mass1, mass2, chi, deltaF, fLower, numPoints, out);
 	}
 
 /****************************************************************************/
 /* Ajith's code *************************************************************/
 /* FIXME make white space style similar	*************************************/
 /****************************************************************************/
-int IMRSPAWaveformFromChi(double mass1, double mass2, double chi, double deltaF, double fLower, int numPoints, complex double *hOfF) {
+int IMRSPAWaveformFromChi(double mass1, double mass2, double chi, double deltaF, double fLower, int numPoints, SPAOutput *out) {
 
     double totalMass, piM, eta;
     double psi0, psi1, psi2, psi3, psi4, psi5, psi6, psi7, psi8, fMerg, fRing, fCut, sigma;
-    double f, shft, amp0, ampEff, psiEff, fNorm;
-    double v, alpha2, alpha3, w1, vMerg, epsilon_1, epsilon_2, w2, vRing;
-    double startPhase = 0., startTime, distance, Lorentzian;
-    int k, kmin, kmax;
+    double shft, amp0, vScale;
+    double alpha2, alpha3, w1, vMerg, epsilon_1, epsilon_2, w2, vRing;
+    double startPhase = 0., startTime, distance;
+    double vBlock[SPA_BLOCK], ampBlock[SPA_BLOCK], phaseBlock[SPA_BLOCK];
+    int j, k0, kmin, kmax, segment, bounds[4];
 
     /* calculate the total mass, symmetric mass ratio and asymmetric       */
     /* mass ratio                                                          */
@@ -1165,6 +2008,7 @@ int IMRSPAWaveformFromChi(double mass1, double mass2, double chi, double deltaF,
 
 	kmin = fLower / deltaF > 1 ? fLower / deltaF : 1;
 	kmax = fCut / deltaF < numPoints / 2 ? fCut / deltaF : numPoints / 2;
+	SPAOutputBand(out, &kmin, &kmax);
 
     /*********************************************************************/
     /*      set other parameters required for the waveform generation    */
@@ -1199,47 +2043,128 @@ int IMRSPAWaveformFromChi(double mass1, double mass2, double chi, double deltaF,
             + epsilon_2*vRing*vRing);
 
     /* zero output */
-    memset (hOfF, 0, numPoints * sizeof (complex double));
-    ampEff = 0.;
-    psiEff = 0.;
+    SPAOutputZero(out, numPoints);
 
     /************************************************************************/
-    /*          now generate the waveform at all frequency bins             */
+    /* split the bins into the inspiral (f <= fMerg), merger (fMerg < f <=  */
+    /* fRing) and ringdown (f > fRing) segments so that each segment's loop */
+    /* below is free of branches                                            */
     /************************************************************************/
-    for (k = kmin; k < kmax; k++) {
-
-        /* fourier frequency corresponding to this bin                      */
-      	f = k * deltaF;
-        fNorm = f/fMerg;
+    bounds[0] = kmin;
+    bounds[1] = IMRFirstBinAbove(fMerg, deltaF, kmin, kmax);
+    bounds[2] = IMRFirstBinAbove(fRing, deltaF, bounds[1], kmax);
+    bounds[3] = kmax;
 
-        /* PN expansion parameter                                           */
-        v = pow(LAL_PI*totalMass*LAL_MTSUN_SI*f, 1./3.);
+    /* with v = (piM f)^(1/3), f / fMerg = (v / vMerg)^3 */
+    vScale = cbrt(piM*deltaF);
 
-    	/* compute the amplitude                                            */
-        if (f <= fMerg) {
-            ampEff = pow(fNorm, -7./6.)*(1. + alpha2*pow(v,2.) + alpha3*pow(v,3.));
-        }
-        else if ((f > fMerg) & (f <= fRing)) {
-            ampEff = w1*pow(fNorm, -2./3.)*(1. + epsilon_1*v + epsilon_2*v*v);
-        }
-        else if (f > fRing) {
-            Lorentzian =  sigma / (2.*LAL_PI * (pow(f-fRing, 2.) + sigma*sigma/4.0));
-            ampEff = w2*Lorentzian;
+    /************************************************************************/
+    /*          now generate the waveform at all frequency bins             */
+    /************************************************************************/
+    for (segment = 0; segment < 3; segment++) {
+    for (k0 = bounds[segment]; k0 < bounds[segment + 1]; k0 += SPA_BLOCK) {
+        int n = bounds[segment + 1] - k0 < SPA_BLOCK ? bounds[segment + 1] - k0 : SPA_BLOCK;
+
+        for (j = 0; j < n; j++)
+            vBlock[j] = vScale*cbrt((double) (k0 + j));
+
+        /* compute the amplitude                                            */
+        switch (segment) {
+        case 0:
+            for (j = 0; j < n; j++) {
+                double v = vBlock[j], r = vMerg/v;
+                /* (f/fMerg)^(-7/6) = (vMerg/v)^(7/2) */
+                ampBlock[j] = amp0*r*r*r*sqrt(r)*(1. + v*v*(alpha2 + v*alpha3));
+            }
+            break;
+        case 1:
+            for (j = 0; j < n; j++) {
+                double v = vBlock[j], r = vMerg/v;
+                /* (f/fMerg)^(-2/3) = (vMerg/v)^2 */
+                ampBlock[j] = amp0*w1*r*r*(1. + v*(epsilon_1 + v*epsilon_2));
+            }
+            break;
+        default:
+            for (j = 0; j < n; j++) {
+                double df = (k0 + j)*deltaF - fRing;
+                ampBlock[j] = amp0*w2*sigma/(2.*LAL_PI*(df*df + sigma*sigma/4.0));
+            }
+            break;
         }
 
-        /* now compute the phase                                             */
-        psiEff =  shft*f + startPhase
-                    + 3./(128.*eta*pow(v,5.))*(1 + psi2*pow(v, 2.)
-                    + psi3*pow(v, 3.) + psi4*pow(v, 4.)
-                    + psi5*pow(v, 5.) + psi6*pow(v, 6.)
-                    + psi7*pow(v, 7.) + psi8*pow(v, 8.));
+        /* now compute the phase, as a Horner polynomial in v               */
+        for (j = 0; j < n; j++) {
+            double v = vBlock[j], v2 = v*v;
+            phaseBlock[j] = shft*(k0 + j)*deltaF + startPhase
+                    + psi0/(v2*v2*v)*(1. + v2*(psi2 + v*(psi3 + v*(psi4
+                    + v*(psi5 + v*(psi6 + v*(psi7 + v*psi8)))))));
+        }
 
         /* generate the waveform                                             */
-        hOfF[k] = amp0*ampEff * (cos(psiEff) - I * sin(psiEff)); 
-
+        for (j = 0; j < n; j++) {
+            double sinPhase, cosPhase;
+            SPASinCos(phaseBlock[j], &sinPhase, &cosPhase);
+            SPAOutputSet(out, k0 + j, ampBlock[j] * (cosPhase - I * sinPhase));
+        }
+    }
     }
 
     return 0;
 
 }
 
+/*
+ * Run a bank of single pole IIR filters over a block of real input data.
+ * Filter k obeys
+ *
+ *	y_k[n] = a1_k y_k[n - 1] + b0_k x[n - delay_k]
+ *
+ * and the output of template t is the sum of the y_k of its filters,
+ * k = indptr[t] ... indptr[t + 1] - 1, written to
+ * snr[t * nsamples + n].  The past input is kept in the ring buffer
+ * history, whose most recent sample is at history[head];  the updated
+ * head is returned, or -1 if memory could not be allocated.  The y and
+ * history arrays carry the state from one block to the next.
+ */
+
+static npy_intp IIRFilterBank(const complex double *a1, const complex double *b0, const int *delay, const npy_intp *indptr, npy_intp ntemplates, npy_intp nfilters, complex double *y, double *history, npy_intp historylength, npy_intp head, const double *data, npy_intp nsamples, complex double *snr)
+	{
+	/* the complex arrays are worked on as interleaved (re, im) pairs
+	 * so the multiply-accumulate below is plain arithmetic that the
+	 * compiler can vectorize, without C99's inf/nan complex multiply */
+	const double *a = (const double *) a1;
+	const double *b = (const double *) b0;
+	double *yy = (double *) y;
+	double *x = malloc((nfilters ? nfilters : 1) * sizeof(*x));
+	npy_intp n, k, t, i;
+
+	if (!x) return -1;
+
+	for (n = 0; n < nsamples; n++) {
+		head = head + 1 == historylength ? 0 : head + 1;
+		history[head] = data[n];
+		/* gather each filter's delayed input */
+		for (k = 0; k < nfilters; k++) {
+			i = head - delay[k];
+			x[k] = history[i < 0 ? i + historylength : i];
+			}
+		/* complex multiply-accumulate across the filters */
+		for (k = 0; k < nfilters; k++) {
+			double re = yy[2 * k], im = yy[2 * k + 1];
+			yy[2 * k] = a[2 * k] * re - a[2 * k + 1] * im + b[2 * k] * x[k];
+			yy[2 * k + 1] = a[2 * k] * im + a[2 * k + 1] * re + b[2 * k + 1] * x[k];
+			}
+		/* sum the filters of each template */
+		for (t = 0; t < ntemplates; t++) {
+			double re = 0, im = 0;
+			for (k = indptr[t]; k < indptr[t + 1]; k++) {
+				re += yy[2 * k];
+				im += yy[2 * k + 1];
+				}
+			snr[t * nsamples + n] = re + im * I;
+			}
+		}
+
+	free(x);
+	return head;
+	}
@@ -23,6 +23,8 @@
 #include <lal/FrequencySeries.h> /* where the REAL8FrequencySeries lives */
 #include <lal/LALDatatypes.h>
 
+#include <numpy/arrayobject.h>
+
 #include <misc.h>
 #include <real8frequencyseries.h>
 
@@ -57,12 +59,86 @@ inspiral_metric_getGammas(PyObject *self, PyObject *args)
         return NULL;
     }
 
-    return Py_BuildValue("(ffffffffff)", metric.Gamma[0], metric.Gamma[1], metric.Gamma[2], metric.Gamma[3], metric.Gamma[4], metric.Gamma[5], metric.Gamma[6], metric.Gamma[7], metric.Gamma[8], metric.Gamma[9]);
+    return Py_BuildValue("(dddddddddd)", metric.Gamma[0], metric.Gamma[1], metric.Gamma[2], metric.Gamma[3], metric.Gamma[4], metric.Gamma[5], metric.Gamma[6], metric.Gamma[7], metric.Gamma[8], metric.Gamma[9]);
+
+}
+
+static PyObject *
+inspiral_metric_getGammasArray(PyObject *self, PyObject *args)
+{
+    double fLower;
+    double fCutoff;
+    pylal_REAL8FrequencySeries *psd = NULL;
+    int order; // Order must be between 0 and 7!
+    PyObject *t0_obj, *t3_obj;
+    PyObject *t0_array = NULL, *t3_array = NULL, *out = NULL;
+    double *t0, *t3, *gammas;
+    npy_intp dims[2] = {0, 10};
+    npy_intp i, j, failed = -1;
+
+    InspiralMomentsEtc moments;
+    InspiralMetric metric;
+
+    memset(&moments, 0, sizeof(moments));
+
+    if (!PyArg_ParseTuple(args, "ddiOOO!", &fLower, &fCutoff, &order, &t0_obj, &t3_obj, &pylal_REAL8FrequencySeries_Type, &psd))
+        return NULL;
+
+    t0_array = PyArray_FROM_OTF(t0_obj, NPY_DOUBLE, NPY_IN_ARRAY);
+    t3_array = PyArray_FROM_OTF(t3_obj, NPY_DOUBLE, NPY_IN_ARRAY);
+    if (!t0_array || !t3_array)
+        goto fail;
+    if (PyArray_SIZE(t0_array) != PyArray_SIZE(t3_array)) {
+        PyErr_SetString(PyExc_ValueError, "t0 and t3 must have the same length");
+        goto fail;
+    }
+
+    dims[0] = PyArray_SIZE(t0_array);
+    out = PyArray_SimpleNew(2, dims, NPY_DOUBLE);
+    if (!out)
+        goto fail;
+    t0 = PyArray_DATA(t0_array);
+    t3 = PyArray_DATA(t3_array);
+    gammas = PyArray_DATA(out);
+
+    /* the moments depend only on the PSD and frequency band, so they are
+     * computed once and shared by every (t0, t3) point */
+    if (XLALGetInspiralMoments(&moments, fLower, fCutoff, psd->series)) {
+        pylal_set_exception_from_xlalerrno();
+        goto fail;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 0; i < dims[0]; i++) {
+        memset(&metric, 0, sizeof(metric));
+        if (XLALInspiralComputeMetric(&metric, &moments, fLower, order, t0[i], t3[i])) {
+            failed = i;
+            break;
+        }
+        for (j = 0; j < 10; j++)
+            gammas[10 * i + j] = metric.Gamma[j];
+    }
+    Py_END_ALLOW_THREADS
+
+    if (failed >= 0) {
+        pylal_set_exception_from_xlalerrno();
+        goto fail;
+    }
+
+    Py_DECREF(t0_array);
+    Py_DECREF(t3_array);
+    return out;
 
+fail:
+    Py_XDECREF(t0_array);
+    Py_XDECREF(t3_array);
+    Py_XDECREF(out);
+    return NULL;
 }
 
 static PyMethodDef Inspiral_MetricMethods[] = {
-    {"compute_metric",  inspiral_metric_getGammas, METH_VARARGS, "Return the Gammas for given values of fLower, fCutoff, order, t0, t3, and psd. Gamma0 through Gamma5 are the upper diagonal values of the 2PN (tc, tau0, tau3) metric. Gamma6 through Gamma 9 were once used for various PTF metrics, but are return as 0 to match the SnglInspiralTable structure. Moments and metric are computed internally, so you can't reuse moments; this was done as a first cut to avoid wrapping the InspiralMomentsEtc structure."},
+    {"compute_metric",  inspiral_metric_getGammas, METH_VARARGS, "Return the Gammas for given values of fLower, fCutoff, order, t0, t3, and psd. Gamma0 through Gamma5 are the upper diagonal values of the 2PN (tc, tau0, tau3) metric. Gamma6 through Gamma 9 were once used for various PTF metrics, but are return as 0 to match the SnglInspiralTable structure. Moments and metric are computed internally, so you can't reuse moments; this was done as a first cut to avoid wrapping the InspiralMomentsEtc structure. Use compute_metric_array to evaluate many templates against one PSD."},
+    {"compute_metric_array",  inspiral_metric_getGammasArray, METH_VARARGS, "compute_metric_array(fLower, fCutoff, order, t0, t3, psd)\n\nReturn an (N x 10) array of the Gammas for arrays t0 and t3 of length N, as for compute_metric. The moments of the psd are computed once and reused for every template, and the metric loop runs with the GIL released."},
     {NULL, NULL, 0, NULL}        /* Sentinel */
 };
 
@@ -71,5 +147,6 @@ PyMODINIT_FUNC
 initinspiral_metric(void)
 {
     (void) Py_InitModule3("pylal.inspiral_metric", Inspiral_MetricMethods, "Compute (tc, tau0, tau3) metric coefficients");
+    import_array();
     pylal_real8frequencyseries_import();
 }
@@ -383,6 +383,167 @@ static PyObject *PyEThincaParameterForInjection(PyObject *self, PyObject *args)
     return PyFloat_FromDouble(result);
 }
 
+static int EThincaForInjectionSequence(SimInspiralTable *c_sim, PyObject *sngls, double *results) {
+    /* Helper for the batch functions below.  Fill results with the
+    ethinca parameter between c_sim and each element of the sequence
+    sngls.  Returns -1 with an exception set on failure. */
+
+    Py_ssize_t i, n = PySequence_Fast_GET_SIZE(sngls);
+    PyObject **items = PySequence_Fast_ITEMS(sngls);
+    SnglInspiralTable *c_sngl;
+
+    for(i = 0; i < n; i++) {
+        c_sngl = PySnglInspiral2CSnglInspiral(items[i]);
+        if(!c_sngl)
+            return -1;
+        results[i] = XLALEThincaParameterForInjection(c_sim, c_sngl);
+        free(c_sngl->event_id);
+        free(c_sngl);
+    }
+
+    return 0;
+}
+
+static PyObject *DoubleArrayToList(double *values, Py_ssize_t n) {
+    /* Copy a C array of doubles into a new Python list of floats. */
+
+    Py_ssize_t i;
+    PyObject *item, *list = PyList_New(n);
+
+    if(!list)
+        return NULL;
+    for(i = 0; i < n; i++) {
+        item = PyFloat_FromDouble(values[i]);
+        if(!item) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, i, item);
+    }
+
+    return list;
+}
+
+static PyObject *PyEThincaParameterForInjectionBatch(PyObject *self, PyObject *args) {
+    /* Take a Python SimInspiral value and a sequence of Python SnglInspiral
+    values and call XLALEThincaParameterForInjection for each SnglInspiral.
+    The SimInspiral is converted only once. */
+
+    double *results;
+    PyObject *py_sim, *py_sngls, *seq, *list;
+    SimInspiralTable *c_sim;
+    Py_ssize_t n;
+
+    if(!PyArg_ParseTuple(args, "OO", &py_sim, &py_sngls))
+        return NULL;
+
+    seq = PySequence_Fast(py_sngls, "expected a sequence of SnglInspiral objects");
+    if(!seq)
+        return NULL;
+    n = PySequence_Fast_GET_SIZE(seq);
+
+    c_sim = PySimInspiral2CSimInspiral(py_sim);
+    if(!c_sim) {
+        Py_DECREF(seq);
+        return NULL;
+    }
+
+    results = malloc((n ? n : 1) * sizeof(*results));
+    if(!results) {
+        free(c_sim->event_id);
+        free(c_sim);
+        Py_DECREF(seq);
+        return PyErr_NoMemory();
+    }
+
+    if(EThincaForInjectionSequence(c_sim, seq, results) < 0)
+        list = NULL;
+    else
+        list = DoubleArrayToList(results, n);
+
+    /* Free temporary memory */
+    free(results);
+    free(c_sim->event_id);
+    free(c_sim);
+    Py_DECREF(seq);
+
+    return list;
+}
+
+static PyObject *PyEThincaParameterForInjectionPairs(PyObject *self, PyObject *args) {
+    /* Take two equal-length sequences of Python SimInspiral and SnglInspiral
+    values and call XLALEThincaParameterForInjection on each pair.
+    Consecutive pairs sharing the same SimInspiral object reuse its
+    conversion, so sorting the pairs by injection keeps this cheap. */
+
+    double *results;
+    PyObject *py_sims, *py_sngls, *sims, *sngls, *list = NULL;
+    PyObject **sim_items, **sngl_items, *last_sim = NULL;
+    SimInspiralTable *c_sim = NULL;
+    SnglInspiralTable *c_sngl;
+    Py_ssize_t i, n;
+
+    if(!PyArg_ParseTuple(args, "OO", &py_sims, &py_sngls))
+        return NULL;
+
+    sims = PySequence_Fast(py_sims, "expected a sequence of SimInspiral objects");
+    if(!sims)
+        return NULL;
+    sngls = PySequence_Fast(py_sngls, "expected a sequence of SnglInspiral objects");
+    if(!sngls) {
+        Py_DECREF(sims);
+        return NULL;
+    }
+    n = PySequence_Fast_GET_SIZE(sims);
+    if(PySequence_Fast_GET_SIZE(sngls) != n) {
+        PyErr_SetString(PyExc_ValueError, "sequences must have the same length");
+        Py_DECREF(sims);
+        Py_DECREF(sngls);
+        return NULL;
+    }
+    sim_items = PySequence_Fast_ITEMS(sims);
+    sngl_items = PySequence_Fast_ITEMS(sngls);
+
+    results = malloc((n ? n : 1) * sizeof(*results));
+    if(!results) {
+        Py_DECREF(sims);
+        Py_DECREF(sngls);
+        return PyErr_NoMemory();
+    }
+
+    for(i = 0; i < n; i++) {
+        if(sim_items[i] != last_sim) {
+            if(c_sim) {
+                free(c_sim->event_id);
+                free(c_sim);
+            }
+            c_sim = PySimInspiral2CSimInspiral(sim_items[i]);
+            if(!c_sim)
+                goto done;
+            last_sim = sim_items[i];
+        }
+        c_sngl = PySnglInspiral2CSnglInspiral(sngl_items[i]);
+        if(!c_sngl)
+            goto done;
+        results[i] = XLALEThincaParameterForInjection(c_sim, c_sngl);
+        free(c_sngl->event_id);
+        free(c_sngl);
+    }
+    list = DoubleArrayToList(results, n);
+
+done:
+    /* Free temporary memory */
+    if(c_sim) {
+        free(c_sim->event_id);
+        free(c_sim);
+    }
+    free(results);
+    Py_DECREF(sims);
+    Py_DECREF(sngls);
+
+    return list;
+}
+
 
 static struct PyMethodDef tools_methods[] = {
     {"XLALCalculateEThincaParameter", PyCalculateEThincaParameter,
@@ -405,6 +566,20 @@ static struct PyMethodDef tools_methods[] = {
       "Takes a SimInspiral and a SnglInspiral object (rows of\n"
       "SimInspiralTable and SnglInspiralTable, respectively) and\n"
       "calculates the ethinca parameter required to put the SimInspiral\n"},   
+     {"XLALEThincaParameterForInjectionBatch", PyEThincaParameterForInjectionBatch,
+      METH_VARARGS,
+      "XLALEThincaParameterForInjectionBatch(SimInspiral, [SnglInspiral, ...])\n"
+      "\n"
+      "Like XLALEThincaParameterForInjection but takes a sequence of\n"
+      "SnglInspiral objects and returns a list of ethinca parameters, one\n"
+      "per SnglInspiral.  The SimInspiral is converted only once."},
+     {"XLALEThincaParameterForInjectionPairs", PyEThincaParameterForInjectionPairs,
+      METH_VARARGS,
+      "XLALEThincaParameterForInjectionPairs([SimInspiral, ...], [SnglInspiral, ...])\n"
+      "\n"
+      "Takes two sequences of equal length and returns the list of ethinca\n"
+      "parameters of each (SimInspiral, SnglInspiral) pair.  Runs of pairs\n"
+      "sharing the same SimInspiral object convert it only once."},
     {NULL, NULL, 0}
 };
 
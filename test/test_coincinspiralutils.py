@@ -0,0 +1,60 @@
+#!/usr/bin/env python
+
+import random
+import unittest
+
+import numpy
+
+from glue.ligolw import lsctables
+from pylal import CoincInspiralUtils
+
+
+def random_sngls(ncoincs = 200):
+	sngls = lsctables.New(lsctables.SnglInspiralTable, columns = ["ifo", "snr", "chisq", "chisq_dof", "alpha", "beta", "event_id"])
+	for event_id in range(ncoincs):
+		for ifo in random.sample(("H1", "H2", "L1", "V1"), random.randint(1, 4)):
+			sngl = lsctables.SnglInspiral()
+			sngl.ifo = ifo
+			sngl.snr = random.uniform(5., 20.)
+			sngl.chisq = random.uniform(5., 100.)
+			sngl.chisq_dof = 16
+			sngl.alpha = random.uniform(0., 1e-3)
+			sngl.beta = random.uniform(0., 10.)
+			sngl.event_id = event_id
+			sngls.append(sngl)
+	random.shuffle(sngls)
+	return sngls
+
+
+class test_coincInspiralColumns(unittest.TestCase):
+
+	def test_against_table(self):
+		'''
+		Check the column-wise coincs against coincInspiralTable
+		'''
+		sngls = random_sngls()
+		for statistic in (CoincInspiralUtils.coincStatistic("snr"), CoincInspiralUtils.coincStatistic("effective_snr"), CoincInspiralUtils.coincStatistic("new_snr"), CoincInspiralUtils.coincStatistic("bitten_l", a = 3, b = 20), CoincInspiralUtils.coincStatistic("bitten_lsq", a = 3, b = 20), CoincInspiralUtils.coincStatistic("far"), CoincInspiralUtils.coincStatistic("ifar"), CoincInspiralUtils.coincStatistic("lvS5stat")):
+			expected = CoincInspiralUtils.coincInspiralTable(sngls, statistic)
+			columns = CoincInspiralUtils.coincInspiralColumns(sngls, statistic)
+			self.assertEqual( len(columns), len(expected) )
+			self.assertTrue( numpy.allclose(columns.getstat(), expected.getstat()) )
+			for row, expected_row in zip(columns, expected):
+				self.assertEqual( row.event_id, expected_row.event_id )
+				self.assertEqual( row.numifos, expected_row.numifos )
+				self.assertEqual( row.ifos, expected_row.ifos )
+				self.assertTrue( all(getattr(row, ifo) is getattr(expected_row, ifo) for ifo in row.ifos) )
+
+	def test_collision(self):
+		'''
+		Two triggers from one ifo with the same event_id must be refused
+		'''
+		sngls = random_sngls(5)
+		sngl = lsctables.SnglInspiral()
+		for name in ("ifo", "snr", "chisq", "chisq_dof", "alpha", "beta", "event_id"):
+			setattr(sngl, name, getattr(sngls[0], name))
+		sngls.append(sngl)
+		self.assertRaises(ValueError, CoincInspiralUtils.coincInspiralColumns, sngls, CoincInspiralUtils.coincStatistic("snr"))
+
+
+if __name__ == '__main__':
+	unittest.main()
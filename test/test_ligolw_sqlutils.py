@@ -0,0 +1,115 @@
+#!/usr/bin/env python
+
+import random
+import sqlite3
+import unittest
+
+import numpy
+
+from pylal import ligolw_sqlutils
+
+
+def random_experiments():
+	'''
+	Two experiments, each with a zero-lag experiment_summ_id and some
+	slides, and a set of triggers spread over them
+	'''
+	esids = {1: [10, 11, 12, 13], 2: [20, 21, 22]}
+	summaries = ligolw_sqlutils.Summaries()
+	for eid, these in esids.items():
+		summaries.append_zero_lag_id(eid, these[0])
+		for esid in these:
+			summaries.append_duration(eid, esid, random.uniform(100., 1000.))
+	summaries.calc_bkg_durs()
+	triggers = []
+	for i in range(500):
+		eid = random.choice(esids.keys())
+		# round the stats so that some are equal, and some are zero
+		triggers.append( (eid, random.choice(esids[eid]), random.choice(("H1,L1", "H1,L1,V1")), random.randint(0, 1), round(random.uniform(0., 10.), 1)) )
+	for eid, these in esids.items():
+		for esid in these:
+			for i in range(random.randint(1, 5)):
+				summaries.append_max_bkg_far(esid, "ALL_IFOS", random.uniform(0., 0.1))
+	summaries.sort_max_bkg_fars()
+	return summaries, triggers
+
+
+class test_ArraySummaries(unittest.TestCase):
+
+	def setUp(self):
+		self.summaries, self.triggers = random_experiments()
+		for trigger in self.triggers:
+			self.summaries.add_to_bkg_stats(*trigger)
+		self.summaries.sort_bkg_stats()
+		self.arrays = ligolw_sqlutils.ArraySummaries(self.summaries)
+		# add the background in two parts
+		columns = zip(*self.triggers)
+		self.arrays.add_to_bkg_stats(*[column[:200] for column in columns])
+		self.arrays.add_to_bkg_stats(*[column[200:] for column in columns])
+		self.arrays.sort_bkg_stats()
+		self.columns = columns
+
+	def test_ufars(self):
+		'''
+		Check the uncombined fars against those of Summaries, computed one
+		trigger at a time
+		'''
+		for rank_by, calc_ufar in (("max", self.summaries.calc_ufar_by_max), ("min", self.summaries.calc_ufar_by_min)):
+			ufars = self.arrays.calc_ufars(*self.columns, rank_by = rank_by)
+			self.assertTrue( numpy.allclose(ufars, [calc_ufar(*trigger) for trigger in self.triggers], rtol = 1e-12, atol = 0.) )
+
+	def test_cfars(self):
+		'''
+		Check the combined fars against those of Summaries, computed one
+		trigger at a time
+		'''
+		esids = self.columns[1]
+		ufars = self.arrays.calc_ufars(*self.columns)
+		cfars = self.arrays.calc_cfars(esids, ["ALL_IFOS"] * len(esids), ufars)
+		self.assertTrue( numpy.allclose(cfars, [self.summaries.calc_cfar(esid, "ALL_IFOS", ufar) for esid, ufar in zip(esids, ufars)], rtol = 1e-12, atol = 0.) )
+
+
+class test_get_arrays_from_query(unittest.TestCase):
+
+	def setUp(self):
+		self.connection = sqlite3.connect(":memory:")
+		self.connection.execute("CREATE TABLE t (x INTEGER, y REAL)")
+		self.connection.executemany("INSERT INTO t VALUES (?, ?)", [(i, i % 3 and i + 0.5 or None) for i in range(10)])
+
+	def tearDown(self):
+		self.connection.close()
+
+	def test_mixed_column(self):
+		'''
+		A column that is an integer in some rows and a real in others, in
+		the first block and after it, must not be cut to integers
+		'''
+		query = "SELECT CASE WHEN x < 4 THEN x ELSE x + 0.25 END AS a, MAX(x, 2) AS b FROM t ORDER BY x"
+		for chunksize in (2, 100):
+			result = ligolw_sqlutils.get_arrays_from_query(self.connection, query, chunksize = chunksize)
+			self.assertEqual( result.a.dtype, numpy.float64 )
+			self.assertEqual( result.a.tolist(), [0., 1., 2., 3., 4.25, 5.25, 6.25, 7.25, 8.25, 9.25] )
+			self.assertEqual( result.b.tolist(), [2., 2., 2., 3., 4., 5., 6., 7., 8., 9.] )
+
+	def test_null(self):
+		'''
+		NULLs in the first block give an object column, later ones nan
+		'''
+		result = ligolw_sqlutils.get_arrays_from_query(self.connection, "SELECT y FROM t ORDER BY x")
+		self.assertEqual( result.y.dtype, numpy.dtype(object) )
+		self.assertEqual( result.y.tolist(), [None, 1.5, 2.5, None, 4.5, 5.5, None, 7.5, 8.5, None] )
+		result = ligolw_sqlutils.get_arrays_from_query(self.connection, "SELECT y FROM t WHERE x > 0 ORDER BY x", chunksize = 2)
+		self.assertEqual( result.y.dtype, numpy.float64 )
+		self.assertEqual( numpy.isnan(result.y).tolist(), [False, False, True, False, False, True, False, False, True] )
+
+	def test_dtype(self):
+		'''
+		An explicit integer dtype is kept
+		'''
+		result = ligolw_sqlutils.get_arrays_from_query(self.connection, "SELECT x FROM t ORDER BY x", dtype = numpy.int64)
+		self.assertEqual( result.x.dtype, numpy.int64 )
+		self.assertEqual( result.x.tolist(), range(10) )
+
+
+if __name__ == '__main__':
+	unittest.main()
@@ -0,0 +1,88 @@
+#!/usr/bin/env python
+
+import gzip
+import os
+import random
+import shutil
+import tempfile
+import unittest
+
+import numpy
+
+from pylal import ligolw_stream
+
+
+def random_document(nrows = 300):
+	rows = [(random.uniform(0., 100.), random.randint(0, 10**9), random.choice(("H1", "L1", "a,\"b")), i) for i in range(nrows)]
+	lines = ["\t\t\t%r,%d,\"%s\",\"sngl_inspiral:event_id:%d\"" % (snr, end_time, ifo.replace("\"", "\\\""), i) for snr, end_time, ifo, i in rows]
+	doc = """<?xml version='1.0' encoding='utf-8'?>
+<!DOCTYPE LIGO_LW SYSTEM "http://ldas-sw.ligo.caltech.edu/doc/ligolwAPI/html/ligolw_dtd.txt">
+<LIGO_LW>
+	<Table Name="process:table">
+		<Column Name="process:program" Type="lstring"/>
+		<Stream Name="process:table" Type="Local" Delimiter=",">
+			"test"
+		</Stream>
+	</Table>
+	<Table Name="sngl_inspiralgroup:sngl_inspiral:table">
+		<Column Name="sngl_inspiralgroup:sngl_inspiral:snr" Type="real_4"/>
+		<Column Name="sngl_inspiralgroup:sngl_inspiral:end_time" Type="int_4s"/>
+		<Column Name="sngl_inspiralgroup:sngl_inspiral:ifo" Type="lstring"/>
+		<Column Name="sngl_inspiralgroup:sngl_inspiral:event_id" Type="ilwd:char"/>
+		<Stream Name="sngl_inspiralgroup:sngl_inspiral:table" Type="Local" Delimiter=",">
+""" + ",\n".join(lines) + """
+		</Stream>
+	</Table>
+</LIGO_LW>
+"""
+	return rows, doc
+
+
+class test_ligolw_stream(unittest.TestCase):
+
+	def setUp(self):
+		self.flushsize = ligolw_stream.FLUSHSIZE
+		self.tmpdir = tempfile.mkdtemp()
+		self.rows, doc = random_document()
+		self.filenames = [os.path.join(self.tmpdir, "a.xml"), os.path.join(self.tmpdir, "b.xml.gz")]
+		open(self.filenames[0], "w").write(doc)
+		gzip.open(self.filenames[1], "w").write(doc)
+
+	def tearDown(self):
+		ligolw_stream.FLUSHSIZE = self.flushsize
+		shutil.rmtree(self.tmpdir)
+
+	def test_columns(self):
+		'''
+		Check the selected columns of plain and gzipped documents, read in
+		small blocks so that rows straddle the block boundaries
+		'''
+		ligolw_stream.FLUSHSIZE = 100
+		data = ligolw_stream.read_columns(self.filenames, "sngl_inspiral", ["end_time", "ifo", "snr"], blocksize = 37)
+		self.assertEqual( sorted(data), ["end_time", "ifo", "snr"] )
+		self.assertEqual( data["end_time"].dtype, numpy.int32 )
+		self.assertEqual( data["end_time"].tolist(), [row[1] for row in self.rows] * 2 )
+		self.assertEqual( data["ifo"].tolist(), [row[2] for row in self.rows] * 2 )
+		self.assertTrue( numpy.allclose(data["snr"], [row[0] for row in self.rows] * 2) )
+
+	def test_selection(self):
+		data = ligolw_stream.read_columns(self.filenames[:1], "sngl_inspiral", selection = lambda block: block["snr"] > 50.)
+		self.assertEqual( data["event_id"].tolist(), ["sngl_inspiral:event_id:%d" % row[3] for row in self.rows if numpy.float32(row[0]) > 50.] )
+
+	def test_tables(self):
+		data = ligolw_stream.read_tables(self.filenames, {"process": None, "sngl_inspiral": ["ifo"]})
+		self.assertEqual( data["process"]["program"].tolist(), ["test", "test"] )
+		self.assertEqual( data["sngl_inspiral"]["ifo"].tolist(), [row[2] for row in self.rows] * 2 )
+
+	def test_no_columns(self):
+		'''
+		An empty list of columns reads none of them, not all of them
+		'''
+		self.assertEqual( ligolw_stream.read_columns(self.filenames, "sngl_inspiral", []), {} )
+
+	def test_missing_column(self):
+		self.assertRaises(ValueError, ligolw_stream.read_columns, self.filenames, "sngl_inspiral", ["mchirp"])
+
+
+if __name__ == '__main__':
+	unittest.main()
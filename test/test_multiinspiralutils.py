@@ -0,0 +1,126 @@
+#!/usr/bin/env python
+
+import random
+import unittest
+
+import numpy
+
+from glue.ligolw import lsctables
+from pylal import MultiInspiralUtils
+from pylal import _multiinspiralutils
+
+
+def cluster_reference(end_time, stat, dt):
+	'''
+	The original pure Python time-bin clustering
+	'''
+	start = round(end_time.min())
+	end = round(end_time.max() + 1)
+	num_bins = int((end - start) // dt + 1)
+	time_bins = [[] for n in range(num_bins)]
+	loudest_stat = numpy.zeros(num_bins)
+	loudest_time = numpy.zeros(num_bins)
+	for i, (t, s) in enumerate(zip(end_time, stat)):
+		bin_ = int(float(t - start) // dt)
+		time_bins[bin_].append(i)
+		if s > loudest_stat[bin_]:
+			loudest_stat[bin_] = s
+			loudest_time[bin_] = t
+	keep = []
+	for i, bin_ in enumerate(time_bins):
+		if not bin_:
+			continue
+		check_prev = i > 0 and len(time_bins[i - 1]) > 0
+		check_next = i < num_bins - 1 and len(time_bins[i + 1]) > 0
+		idx = bin_[stat[bin_].argmax()]
+		s = stat[idx]
+		t = end_time[idx]
+		if check_prev and (t - loudest_time[i - 1]) < dt and s < loudest_stat[i - 1]:
+			continue
+		if check_next and (loudest_time[i + 1] - t) < dt and s < loudest_stat[i + 1]:
+			continue
+		if check_prev and not (t - loudest_time[i - 1]) < dt and [j for j in time_bins[i - 1] if (t - end_time[j]) < dt and s < stat[j]]:
+			continue
+		if check_next and not (loudest_time[i + 1] - t) < dt and [j for j in time_bins[i + 1] if (end_time[j] - t) < dt and s < stat[j]]:
+			continue
+		keep.append(idx)
+	return keep
+
+
+def random_multi_inspirals(n = 300):
+	mi_table = lsctables.New(lsctables.MultiInspiralTable, columns = ["end_time", "end_time_ns", "snr", "chisq"])
+	for i in range(n):
+		row = lsctables.MultiInspiral()
+		row.end_time = random.randint(1000000000, 1000000100)
+		row.end_time_ns = random.randint(0, 999999999)
+		row.snr = random.uniform(5., 20.)
+		row.chisq = random.uniform(0., 100.)
+		mi_table.append(row)
+	return mi_table
+
+
+class test_cluster_time_bins(unittest.TestCase):
+
+	def test_against_reference(self):
+		'''
+		Check the compiled clustering against the Python implementation
+		'''
+		for trial in range(100):
+			n = random.randint(1, 500)
+			dt = random.choice((0.1, 0.5, 1., 3.7))
+			end_time = 1e9 + numpy.random.uniform(0.3, 200., size = n)
+			stat = numpy.random.uniform(0., 20., size = n)
+			self.assertEqual( _multiinspiralutils.cluster_time_bins(end_time, stat, dt).tolist(), cluster_reference(end_time, stat, dt) )
+
+	def test_columns(self):
+		'''
+		Clustering several statistics at once must agree with clustering
+		them one at a time
+		'''
+		end_time = 1e9 + numpy.random.uniform(0., 100., size = 1000)
+		stats = numpy.random.uniform(0., 20., size = (3, 1000))
+		keep = _multiinspiralutils.cluster_time_bins(end_time, stats, 1.)
+		self.assertEqual( len(keep), 3 )
+		for idx, stat in zip(keep, stats):
+			self.assertEqual( idx.tolist(), _multiinspiralutils.cluster_time_bins(end_time, stat, 1.).tolist() )
+
+	def test_empty(self):
+		self.assertEqual( len(_multiinspiralutils.cluster_time_bins([], [], 1.)), 0 )
+
+
+class test_cluster_multi_inspirals(unittest.TestCase):
+
+	def setUp(self):
+		self.mi_table = random_multi_inspirals()
+		self.end_time = numpy.asarray(self.mi_table.get_end()).astype(float)
+		self.snr = numpy.asarray(self.mi_table.get_column("snr"))
+		self.chisq = numpy.asarray(self.mi_table.get_column("chisq"))
+		# ranked through the get_<column> method rather than get_column()
+		self.mi_table.get_loudness = lambda: self.snr / (1. + self.chisq)
+
+	def test_column(self):
+		'''
+		Cluster by a single column, given as a string
+		'''
+		clustered = MultiInspiralUtils.cluster_multi_inspirals(self.mi_table, 1., loudest_by = "snr")
+		expected = [self.mi_table[i] for i in cluster_reference(self.end_time, self.snr, 1.)]
+		self.assertEqual( type(clustered), type(self.mi_table) )
+		self.assertEqual( list(clustered), expected )
+
+	def test_columns(self):
+		'''
+		Cluster by a list of columns, one of them through get_<column>
+		'''
+		clustered = MultiInspiralUtils.cluster_multi_inspirals(self.mi_table, 1., loudest_by = ["snr", "loudness"])
+		self.assertEqual( len(clustered), 2 )
+		self.assertEqual( list(clustered[0]), [self.mi_table[i] for i in cluster_reference(self.end_time, self.snr, 1.)] )
+		self.assertEqual( list(clustered[1]), [self.mi_table[i] for i in cluster_reference(self.end_time, self.snr / (1. + self.chisq), 1.)] )
+
+	def test_empty(self):
+		mi_table = random_multi_inspirals(0)
+		self.assertEqual( len(MultiInspiralUtils.cluster_multi_inspirals(mi_table, 1.)), 0 )
+		self.assertEqual( [len(t) for t in MultiInspiralUtils.cluster_multi_inspirals(mi_table, 1., loudest_by = ["snr", "chisq"])], [0, 0] )
+
+
+if __name__ == '__main__':
+	unittest.main()
@@ -0,0 +1,62 @@
+#!/usr/bin/env python
+
+import random
+import unittest
+
+import numpy
+
+from glue import segments
+from pylal import segmentindex
+
+
+def random_segmentlist(n = 50, span = 1000):
+	seglist = segments.segmentlist()
+	for i in range(n):
+		start = random.randint(0, span)
+		seglist.append(segments.segment(start, start + random.randint(1, span / 20)))
+	return seglist.coalesce()
+
+
+class test_segmentindex(unittest.TestCase):
+
+	def test_contains(self):
+		'''
+		Check vectorized membership against glue.segments
+		'''
+		seglist = random_segmentlist()
+		idx = segmentindex.SegmentIndex.from_segmentlist(seglist)
+		times = numpy.arange(-10, 1100)
+		expected = numpy.array([t in seglist for t in times])
+		self.assertTrue( (idx.contains(times) == expected).all() )
+		self.assertEqual( [idx.contains_time(t) for t in times], expected.tolist() )
+
+	def test_nanoseconds(self):
+		idx = segmentindex.SegmentIndex([10], [11])
+		self.assertTrue( (idx.contains([9, 10, 10, 11], [999999999, 0, 999999999, 0]) == [False, True, True, False]).all() )
+
+	def test_algebra(self):
+		'''
+		Check union, intersection and difference against glue.segments
+		'''
+		for i in range(20):
+			a = random_segmentlist()
+			b = random_segmentlist()
+			idx_a = segmentindex.SegmentIndex.from_segmentlist(a)
+			idx_b = segmentindex.SegmentIndex.from_segmentlist(b)
+			for result, expected in ((idx_a | idx_b, a | b), (idx_a & idx_b, a & b), (idx_a - idx_b, a - b)):
+				self.assertEqual( [(int(s) / 1000000000, int(e) / 1000000000) for s, e in result], [tuple(seg) for seg in expected] )
+
+	def test_all(self):
+		lists = [random_segmentlist() for i in range(4)]
+		indexes = [segmentindex.SegmentIndex.from_segmentlist(seglist) for seglist in lists]
+		union = segments.segmentlist()
+		intersection = lists[0]
+		for seglist in lists:
+			union |= seglist
+			intersection = intersection & seglist
+		self.assertEqual( segmentindex.SegmentIndex.union_all(indexes).abs(), abs(union) * 1000000000 )
+		self.assertEqual( segmentindex.SegmentIndex.intersection_all(indexes).abs(), abs(intersection) * 1000000000 )
+
+
+if __name__ == '__main__':
+	unittest.main()
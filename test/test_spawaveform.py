@@ -0,0 +1,268 @@
+#!/usr/bin/env python
+
+import unittest
+
+import numpy
+
+import lal
+from pylal import spawaveform
+
+
+def random_iir_set(n, maxdelay = 50):
+	a1 = 0.9 * numpy.exp(2j * numpy.pi * numpy.random.uniform(size = n))
+	b0 = numpy.random.normal(size = n) + 1j * numpy.random.normal(size = n)
+	delay = numpy.random.randint(0, maxdelay, size = n).astype("intc")
+	return a1, b0, delay
+
+
+def direct_iir_filter(a1, b0, delay, data):
+	out = numpy.zeros(len(data), dtype = "complex128")
+	for a, b, d in zip(a1, b0, delay):
+		y = 0j
+		for n in range(len(data)):
+			y = a * y + b * (data[n - d] if n >= d else 0.)
+			out[n] += y
+	return out
+
+
+def reduce_spin_reference(m1, m2, chi, deltaF, fLower, fFinal, n):
+	'''
+	Direct evaluation of the 3.5 PN reduced spin waveform, term by term
+	'''
+	m = m1 + m2
+	eta = m1 * m2 / m / m
+	piM = numpy.pi * m * lal.MTSUN_SI
+	psi0 = 3. / (128. * eta)
+	psi2 = 3715. / 756. + 55. * eta / 9.
+	psi3 = 113. * chi / 3. - 16. * numpy.pi
+	psi4 = 15293365. / 508032. + 27145. * eta / 504. + 3085. * eta * eta / 72. + 63845. * (-81. + 4. * eta) * chi * chi / (8. * (-113. + 76. * eta)**2)
+	psi5 = 38645. * numpy.pi / 756. - 65. * numpy.pi * eta / 9. - 565. * (-146597. + 135856. * eta + 17136. * eta * eta) * chi / (2268. * (-113. + 76. * eta))
+	psi6 = 11583231236531. / 4694215680. - 640. * numpy.pi**2 / 3. - 6848. * lal.GAMMA / 21. + (-5162.983708047263 + 2255. * numpy.pi**2 / 12.) * eta + 76055. * eta * eta / 1728. - 127825. * eta**3 / 1296.
+	psi6L = -6848. / 21.
+	psi7 = 77096675. * numpy.pi / 254016. + 378515. * numpy.pi * eta / 1512. - 74045. * numpy.pi * eta * eta / 756.
+	alpha2 = 1.1056547619047619 + 11 * eta / 8.
+	alpha3 = -2 * numpy.pi + 113 * chi / 24.
+	alpha4 = 0.8939214212884228 + 18913 * eta / 16128. + 1379 * eta**2 / 1152. + 12769 * chi**2 * (-81 + 4 * eta) / (32. * (-113 + 76 * eta)**2)
+	alpha5 = -4757 * numpy.pi / 1344. + 57 * eta * numpy.pi / 16. - 113 * chi * (502429 - 591368 * eta + 1680 * eta**2) / (16128. * (-113 + 76 * eta))
+	alpha6 = -58.601030974347324 + 3526813753 * eta / 2.7869184e7 - 1041557 * eta**2 / 258048. + 67999 * eta**3 / 82944. + 10 * numpy.pi**2 / 3. - 451 * eta * numpy.pi**2 / 96.
+	alpha6L = 856 / 105.
+	alpha7 = -5111593 * numpy.pi / 2.709504e6 - 72221 * eta * numpy.pi / 24192. - 1349 * eta**2 * numpy.pi / 24192.
+	amp0 = numpy.sqrt(5. * eta / 24.) * (m * lal.MTSUN_SI)**(5. / 6.) / (1e6 * lal.PC_SI / lal.C_SI * numpy.pi**(2. / 3.))
+
+	h = numpy.zeros(n, dtype = "complex128")
+	f = numpy.arange(n) * deltaF
+	k = numpy.arange(n)
+	k = (f >= fLower) & (k < int(fFinal / deltaF)) & (k > 0)
+	f = f[k]
+	v = (piM * f)**(1. / 3.)
+	Psi = psi0 * v**-5. * (1. + psi2 * v**2 + psi3 * v**3 + psi4 * v**4 + psi5 * v**5 * (1. + 3. * numpy.log(v)) + (psi6 + psi6L * numpy.log(4. * v)) * v**6 + psi7 * v**7)
+	amp = amp0 * f**(-7. / 6.) * (1. + alpha2 * v**2 + alpha3 * v**3 + alpha4 * v**4 + alpha5 * v**5 + (alpha6 + alpha6L * (lal.GAMMA + numpy.log(4. * v))) * v**6 + alpha7 * v**7)
+	h[k] = amp * numpy.exp(-1j * (Psi + numpy.pi / 4.))
+	return h
+
+
+def imr_reference(m1, m2, chi, deltaF, fLower, n):
+	'''
+	Direct evaluation of the phenomenological IMR waveform, bin by bin
+	'''
+	m = m1 + m2
+	eta = m1 * m2 / m / m
+	piM = numpy.pi * m * lal.MTSUN_SI
+	psi2 = 3715. / 756. - 9.2091e+02 * eta + 4.9213e+02 * eta * chi + 1.3503e+02 * eta * chi**2 + 6.7419e+03 * eta**2 - 1.0534e+03 * eta**2 * chi - 1.3397e+04 * eta**3
+	psi3 = -16. * numpy.pi + 113. * chi / 3. + 1.7022e+04 * eta - 9.5659e+03 * eta * chi - 2.1821e+03 * eta * chi**2 - 1.2137e+05 * eta**2 + 2.0752e+04 * eta**2 * chi + 2.3859e+05 * eta**3
+	psi4 = 15293365. / 508032. - 405. * chi**2 / 8. - 1.2544e+05 * eta + 7.5066e+04 * eta * chi + 1.3382e+04 * eta * chi**2 + 8.7354e+05 * eta**2 - 1.6573e+05 * eta**2 * chi - 1.6936e+06 * eta**3
+	psi6 = -8.8977e+05 * eta + 6.3102e+05 * eta * chi + 5.0676e+04 * eta * chi**2 + 5.9808e+06 * eta**2 - 1.4148e+06 * eta**2 * chi - 1.1280e+07 * eta**3
+	psi7 = 8.6960e+05 * eta - 6.7098e+05 * eta * chi - 3.0082e+04 * eta * chi**2 - 5.8379e+06 * eta**2 + 1.5145e+06 * eta**2 * chi + 1.0891e+07 * eta**3
+	psi8 = -3.6600e+05 * eta + 3.0670e+05 * eta * chi + 6.3176e+02 * eta * chi**2 + 2.4265e+06 * eta**2 - 7.2180e+05 * eta**2 * chi - 4.5524e+06 * eta**3
+	fMerg = (1. - 4.4547 * (1. - chi)**0.217 + 3.521 * (1. - chi)**0.26 + 6.4365e-01 * eta + 8.2696e-01 * eta * chi - 2.7063e-01 * eta * chi**2 - 5.8218e-02 * eta**2 - 3.9346e+00 * eta**2 * chi - 7.0916e+00 * eta**3) / piM
+	fRing = ((1. - 0.63 * (1. - chi)**0.3) / 2. + 1.4690e-01 * eta - 1.2281e-01 * eta * chi - 2.6091e-02 * eta * chi**2 - 2.4900e-02 * eta**2 + 1.7013e-01 * eta**2 * chi + 2.3252e+00 * eta**3) / piM
+	sigma = ((1. - 0.63 * (1. - chi)**0.3) * (1. - chi)**0.45 / 4. - 4.0979e-01 * eta - 3.5226e-02 * eta * chi + 1.0082e-01 * eta * chi**2 + 1.8286e+00 * eta**2 - 2.0169e-02 * eta**2 * chi - 2.8698e+00 * eta**3) / piM
+	fCut = spawaveform.imr_fcut(m1, m2, chi)
+	shft = 2. * numpy.pi * -50. * m * lal.MTSUN_SI
+	amp0 = (lal.MTSUN_SI * m)**(5. / 6.) * fMerg**(-7. / 6.) / numpy.pi**(2. / 3.) * numpy.sqrt(5. * eta / 24.) / (1e6 * lal.PC_SI / lal.C_SI)
+	alpha2 = -323. / 224. + 451. * eta / 168.
+	alpha3 = (27. / 8. - 11. * eta / 6.) * chi
+	epsilon_1 = 1.4547 * chi - 1.8897
+	epsilon_2 = -1.8153 * chi + 1.6557
+	vMerg = (piM * fMerg)**(1. / 3.)
+	vRing = (piM * fRing)**(1. / 3.)
+	w1 = (1. + alpha2 * vMerg**2 + alpha3 * vMerg**3) / (1. + epsilon_1 * vMerg + epsilon_2 * vMerg**2)
+	w2 = w1 * (numpy.pi * sigma / 2.) * (fRing / fMerg)**(-2. / 3.) * (1. + epsilon_1 * vRing + epsilon_2 * vRing**2)
+
+	h = numpy.zeros(n, dtype = "complex128")
+	for k in range(max(int(fLower / deltaF), 1), min(int(fCut / deltaF), n / 2)):
+		f = k * deltaF
+		v = (piM * f)**(1. / 3.)
+		if f <= fMerg:
+			amp = (f / fMerg)**(-7. / 6.) * (1. + alpha2 * v**2 + alpha3 * v**3)
+		elif f <= fRing:
+			amp = w1 * (f / fMerg)**(-2. / 3.) * (1. + epsilon_1 * v + epsilon_2 * v**2)
+		else:
+			amp = w2 * sigma / (2. * numpy.pi * ((f - fRing)**2 + sigma**2 / 4.))
+		psi = shft * f + 3. / (128. * eta * v**5) * (1. + psi2 * v**2 + psi3 * v**3 + psi4 * v**4 + psi6 * v**6 + psi7 * v**7 + psi8 * v**8)
+		h[k] = amp0 * amp * numpy.exp(-1j * psi)
+	return h
+
+
+class test_reduce_spin(unittest.TestCase):
+
+	def test_against_reference(self):
+		'''
+		Check the reduced spin generator against a direct evaluation
+		'''
+		deltaF, n = 0.125, 65536
+		for m1, m2, chi in ((1.4, 1.4, 0.), (10., 3., 0.5), (5., 5., -0.7), (25., 1.2, 0.9)):
+			fFinal = spawaveform.ffinal(m1, m2, "schwarz_isco")
+			h = numpy.zeros(n, dtype = "complex128")
+			spawaveform.waveform(m1, m2, 7, deltaF, 1. / 8192, 40.1, fFinal, h, chi)
+			reference = reduce_spin_reference(m1, m2, chi, deltaF, 40.1, fFinal, n)
+			self.assertTrue( (abs(h - reference) <= 1e-9 * abs(reference).max()).all() )
+
+
+class test_iirfilter(unittest.TestCase):
+
+	def test_against_direct(self):
+		'''
+		Check the filter bank against a direct evaluation of the recursion
+		'''
+		sets = [random_iir_set(n) for n in (1, 5, 12)]
+		data = numpy.random.normal(size = 300)
+		bank = spawaveform.IIRFilterBank(sets)
+		out = bank.filter(data)
+		for n, (a1, b0, delay) in enumerate(sets):
+			self.assertTrue( numpy.allclose(out[n], direct_iir_filter(a1, b0, delay, data)) )
+
+	def test_streaming(self):
+		'''
+		Filtering in blocks must agree with filtering all the data at once
+		'''
+		sets = [random_iir_set(n) for n in (3, 7)]
+		data = numpy.random.normal(size = 500)
+		whole = spawaveform.IIRFilterBank(sets).filter(data)
+		bank = spawaveform.IIRFilterBank(sets)
+		blocks = numpy.hstack([bank.filter(block) for block in numpy.array_split(data, [1, 17, 64, 65, 300])])
+		self.assertTrue( numpy.allclose(whole, blocks) )
+
+
+class test_iirbank(unittest.TestCase):
+
+	def test_response(self):
+		'''
+		Bank-level responses must match iirresponse() template by template
+		'''
+		sets = [random_iir_set(n) for n in (2, 9, 4)]
+		resp = spawaveform.iirbankresponse(sets, 256)
+		for row, (a1, b0, delay) in zip(resp, sets):
+			self.assertTrue( numpy.allclose(row, spawaveform.iirresponse(256, a1, b0, delay)) )
+
+	def test_innerproduct(self):
+		'''
+		Threaded inner products must match iirinnerproduct() template by template
+		'''
+		sets = [random_iir_set(n) for n in range(1, 20)]
+		psd = numpy.random.uniform(1., 2., size = 1024)
+		expected = [spawaveform.iirinnerproduct(a1, b0, delay, psd) for a1, b0, delay in sets]
+		for nthreads in (1, 3, 0):
+			self.assertTrue( numpy.allclose(spawaveform.iirbankinnerproduct(sets, psd, nthreads), expected) )
+
+
+class test_ufuncs(unittest.TestCase):
+
+	def test_against_scalar(self):
+		'''
+		The ufuncs must agree with the scalar functions
+		'''
+		m1 = numpy.random.uniform(1., 20., size = 50)
+		m2 = numpy.random.uniform(1., 20., size = 50)
+		s1 = numpy.random.uniform(-0.9, 0.9, size = 50)
+		s2 = numpy.random.uniform(-0.9, 0.9, size = 50)
+		chi = spawaveform.compute_chi(m1, m2, s1, s2)
+		self.assertTrue( numpy.allclose(chi, [spawaveform.computechi(*args) for args in zip(m1, m2, s1, s2)]) )
+		for name in ("schwarz_isco", "bkl_isco", "light_ring"):
+			self.assertTrue( numpy.allclose(getattr(spawaveform, name)(m1, m2), [spawaveform.ffinal(a, b, name) for a, b in zip(m1, m2)]) )
+		for name, which in (("imr_merger", "merger"), ("imr_ring", "ringdown"), ("imr_fcut", "fcut")):
+			self.assertTrue( numpy.allclose(getattr(spawaveform, name)(m1, m2, chi), [spawaveform.imrffinal(a, b, c, which) for a, b, c in zip(m1, m2, chi)]) )
+		fFinal = spawaveform.schwarz_isco(m1, m2)
+		self.assertTrue( numpy.allclose(spawaveform.chirp_time(m1, m2, 40., 7, chi), [spawaveform.chirptime(a, b, 7, 40., 0., c) for a, b, c in zip(m1, m2, chi)]) )
+		self.assertTrue( numpy.allclose(spawaveform.chirp_time_between_f1_and_f2(m1, m2, 40., fFinal, 7, chi), [spawaveform.chirptime(a, b, 7, 40., f, c) for a, b, f, c in zip(m1, m2, fFinal, chi)]) )
+		# order arrays of either integer width are accepted
+		for dtype in (numpy.int32, numpy.int64):
+			order = numpy.array([4, 7] * 25, dtype = dtype)
+			self.assertTrue( numpy.allclose(spawaveform.chirp_time(m1, m2, 40., order, chi), [spawaveform.chirptime(a, b, o, 40., 0., c) for a, b, o, c in zip(m1, m2, order, chi)]) )
+			self.assertTrue( numpy.allclose(spawaveform.chirp_time_between_f1_and_f2(m1, m2, 40., fFinal, order, chi), [spawaveform.chirptime(a, b, o, 40., f, c) for a, b, f, o, c in zip(m1, m2, fFinal, order, chi)]) )
+		self.assertTrue( numpy.allclose(spawaveform.imrchirptime(m1, m2, 40., chi), [spawaveform.imrchirptime(a, b, 40., c) for a, b, c in zip(m1, m2, chi)]) )
+
+
+class test_waveform_output(unittest.TestCase):
+
+	def test_strided_single_band(self):
+		'''
+		Strided, single precision and band-limited output must agree with the default
+		'''
+		m1, m2, order, deltaF, deltaT, fLower, fFinal = 1.4, 1.4, 7, 0.25, 1. / 4096, 40., 1500.
+		for generate, args in ((spawaveform.waveform, (m1, m2, order, deltaF, deltaT, fLower, fFinal)), (spawaveform.imrwaveform, (10., 5., deltaF, fLower))):
+			reference = numpy.zeros(32768, dtype = "complex128")
+			generate(*(args + (reference,)))
+			# a column is a strided view
+			bank = numpy.ones((32768, 3), dtype = "complex64")
+			generate(*(args + (bank[:,1],)))
+			self.assertTrue( numpy.allclose(bank[:,1], reference, rtol = 1e-5, atol = 1e-5 * abs(reference).max()) )
+			self.assertTrue( (bank[:,0] == 1).all() and (bank[:,2] == 1).all() )
+			band = numpy.ones(32768, dtype = "complex128")
+			generate(*(args + (band,)), kmin = 200, kmax = 4000)
+			self.assertTrue( (band[:200] == 1).all() and (band[4000:] == 1).all() )
+			self.assertTrue( numpy.allclose(band[200:4000], reference[200:4000], atol = 1e-10 * abs(reference).max()) )
+
+	def test_rejects_copies(self):
+		'''
+		Output arrays that would be silently copied must be rejected
+		'''
+		self.assertRaises(TypeError, spawaveform.waveform, 1.4, 1.4, 7, 0.25, 1. / 4096, 40., 1500., numpy.zeros(1024, dtype = "float64"))
+		self.assertRaises(TypeError, spawaveform.waveform, 1.4, 1.4, 7, 0.25, 1. / 4096, 40., 1500., [0j] * 1024)
+
+
+class test_matchmatrix(unittest.TestCase):
+
+	def test_self_match(self):
+		'''
+		Templates match themselves, and the reduced output agrees with the matrix
+		'''
+		deltaF = 0.25
+		psd = numpy.ones(4097)
+		bank = numpy.array([[10., 10., 0.], [12., 8., 0.1], [20., 5., -0.2], [6., 6., 0.]])
+		for approximant in ("imr", "spa"):
+			matches = spawaveform.matchmatrix(bank, bank, psd, deltaF, 40., approximant = approximant, nthreads = 2)
+			self.assertTrue( numpy.allclose(numpy.diag(matches), 1.) )
+			self.assertTrue( (matches <= 1. + 1e-10).all() )
+			self.assertTrue( numpy.allclose(matches, matches.T) )
+			best, argbest = spawaveform.matchmatrix(bank, bank[::-1], psd, deltaF, 40., approximant = approximant, reduce = True)
+			self.assertTrue( numpy.allclose(best, 1.) )
+			self.assertEqual( argbest.tolist(), [3, 2, 1, 0] )
+
+	def test_pruning(self):
+		'''
+		Pairs with very different chirp times are skipped
+		'''
+		bank = numpy.array([[1.4, 1.4, 0.], [20., 20., 0.]])
+		matches = spawaveform.matchmatrix(bank, bank, numpy.ones(4097), 0.25, 40., dtau = 1.)
+		self.assertEqual( matches[0, 1], 0. )
+		self.assertEqual( matches[1, 0], 0. )
+		self.assertTrue( numpy.allclose(numpy.diag(matches), 1.) )
+
+
+class test_imr(unittest.TestCase):
+
+	def test_against_reference(self):
+		'''
+		Check the segmented IMR generator against a bin by bin evaluation
+		'''
+		deltaF, n = 0.25, 16384
+		for m1, m2, chi in ((20., 20., 0.), (60., 15., 0.6), (35., 10., -0.5)):
+			h = numpy.zeros(n, dtype = "complex128")
+			spawaveform.imrwaveform(m1, m2, deltaF, 30., h, chi)
+			reference = imr_reference(m1, m2, chi, deltaF, 30., n)
+			self.assertTrue( (abs(h - reference) <= 1e-9 * abs(reference).max()).all() )
+
+
+if __name__ == '__main__':
+	unittest.main()
@@ -129,6 +129,42 @@ class test_ulutils(unittest.TestCase):
         muhi_10 = upper_limit_utils.compute_upper_limit(mu, post, alpha = 0.90)
         self.assertTrue( abs( muhi_1p9 - muhi_10 ) < 0.01 )
 
+    def test_log_likelihood(self):
+        '''
+        Check the log-space likelihood against the direct product, and that
+        it stays finite where the direct product underflows.
+        '''
+        mu = numpy.logspace(-3,3,1e3)
+        VTs = numpy.array([1., 2.5, 4.])
+        lambs = [0., 1., 10.]
+        mcerrs = [0., 0.5, 1.]
+        likely = upper_limit_utils.margLikelihoodMonteCarlo(VTs, lambs, mu, mcerrs)
+        loglikely = upper_limit_utils.logMargLikelihoodMonteCarlo(VTs, lambs, mu, mcerrs)
+        ok = likely > 1e-300
+        self.assertTrue( numpy.allclose(numpy.log(likely[ok]), loglikely[ok]) )
+        self.assertTrue( numpy.isfinite(loglikely).all() )
+
+        # calibration marginalization agrees with the per-sample sum
+        calerr = 0.2
+        fracerrs = numpy.linspace(0.33,3,100)
+        errdist = numpy.exp(-numpy.log(fracerrs)**2/(2*calerr**2))/(fracerrs*calerr)
+        errdist /= errdist.sum()
+        expected = sum([ pd*upper_limit_utils.margLikelihoodMonteCarlo(delta*VTs,lambs,mu,mcerrs) for delta, pd in zip(fracerrs,errdist)])
+        self.assertTrue( numpy.allclose(upper_limit_utils.margLikelihood(VTs, lambs, mu, calerr, mcerrs), expected) )
+
+    def test_hpd_and_batched_limits(self):
+        '''
+        Check the HPD interval of a Gaussian and the batched upper limits.
+        '''
+        mu = numpy.linspace(-10,10,1e5)
+        post = numpy.exp(-(mu**2)/2)
+        mulo, muhi = upper_limit_utils.hpd_credible_interval(mu, post, alpha = 0.95)
+        self.assertTrue( abs(muhi - 1.95996) < 0.001 and abs(mulo + 1.95996) < 0.001 )
+
+        posts = numpy.array([numpy.exp(-(mu-shift)**2/2) for shift in (-1., 0., 2.)])
+        expected = [upper_limit_utils.compute_upper_limit(mu, p, alpha = 0.9) for p in posts]
+        self.assertTrue( numpy.allclose(upper_limit_utils.compute_upper_limits(mu, posts, alpha = 0.9), expected) )
+
     def test_integrate_efficiency_lind(self):
         '''
         Check that the numerical accuracy of the integration